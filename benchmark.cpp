@@ -0,0 +1,191 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "stats.h"
+
+namespace {
+
+/* Two-sided 95% quantiles of Student's t for 1 to 30 degrees of freedom */
+const double T_975[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+double t_975(unsigned df)
+{
+    if (df == 0)
+        return INFINITY;
+
+    if (df <= 30)
+        return T_975[df - 1];
+
+    /* Within 0.2% of the exact value above 30 */
+    return 1.96 + 2.4 / df;
+}
+
+double median_of_sorted(const std::vector<double> &sorted)
+{
+    size_t n = sorted.size();
+
+    return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+} // anonymous namespace
+
+const double Estimate::MAX_MODIFIED_Z = 3.5;
+
+Estimate::Estimate()
+: samples(0), outliers(0), warmup(0), converged(false), mean(0), stddev(0),
+  mean_low(0), mean_high(0), median(0), median_low(0), median_high(0)
+{
+}
+
+double Estimate::relativeError() const
+{
+    if (samples < 2)
+        return INFINITY;
+
+    return mean ? (mean_high - mean) / fabs(mean) : 0;
+}
+
+std::string Estimate::summary(double scale, const char *unit) const
+{
+    char buffer[256];
+
+    snprintf(buffer, sizeof(buffer),
+             "mean %.3f %s +-%.1f%% (95%% CI %.3f-%.3f), median %.3f "
+             "(%.3f-%.3f), %u samples, %u outliers, %u warm-up%s",
+             mean / scale, unit, relativeError() * 100, mean_low / scale,
+             mean_high / scale, median / scale, median_low / scale,
+             median_high / scale, samples, outliers, warmup,
+             converged ? "" : ", not converged");
+
+    return buffer;
+}
+
+Estimate Estimate::of(const std::vector<double> &samples)
+{
+    Estimate estimate;
+
+    if (samples.empty())
+        return estimate;
+
+    std::vector<double> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+
+    double median = median_of_sorted(sorted);
+    std::vector<double> deviations;
+
+    for (double x : sorted)
+        deviations.push_back(fabs(x - median));
+
+    std::sort(deviations.begin(), deviations.end());
+
+    double mad = median_of_sorted(deviations);
+    std::vector<double> kept;
+
+    /* With over half of the samples equal, there's no scale to judge by */
+    for (double x : sorted)
+        if (mad == 0 || 0.6745 * fabs(x - median) / mad <= MAX_MODIFIED_Z)
+            kept.push_back(x);
+
+    size_t n = kept.size();
+    double sum = 0, sum_squares = 0;
+
+    for (double x : kept)
+        sum += x;
+
+    estimate.mean = sum / n;
+
+    for (double x : kept)
+        sum_squares += (x - estimate.mean) * (x - estimate.mean);
+
+    estimate.samples = n;
+    estimate.outliers = samples.size() - n;
+    estimate.stddev = n > 1 ? sqrt(sum_squares / (n - 1)) : 0;
+
+    double half_width = n > 1 ? t_975(n - 1) * estimate.stddev / sqrt(n) : 0;
+
+    estimate.mean_low = estimate.mean - half_width;
+    estimate.mean_high = estimate.mean + half_width;
+
+    /* Ranks around the median covering it with 95% probability */
+    double spread = 0.98 * sqrt(n);
+    long low = std::max(1L, long(floor(n / 2.0 - spread)));
+    long high = std::min(long(n), long(ceil(n / 2.0 + spread)) + 1);
+
+    estimate.median = median_of_sorted(kept);
+    estimate.median_low = kept[low - 1];
+    estimate.median_high = kept[high - 1];
+
+    return estimate;
+}
+
+Benchmark::Settings::Settings()
+: warmup(2)
+, min_repetitions(10)
+, max_repetitions(200)
+, target_error(0.02)
+, max_seconds(10)
+{
+}
+
+Estimate Benchmark::run(const Settings &settings,
+                        const Repetition &repetition)
+{
+    uint64_t start = monotonic_ns();
+    std::vector<double> samples;
+    Estimate estimate;
+
+    for (unsigned i = 0; i < settings.warmup; i++)
+        repetition(true);
+
+    for (;;) {
+        samples.push_back(repetition(false));
+
+        if (samples.size() < settings.min_repetitions)
+            continue;
+
+        estimate = Estimate::of(samples);
+
+        if (estimate.relativeError() <= settings.target_error) {
+            estimate.converged = true;
+            break;
+        }
+
+        if (samples.size() >= settings.max_repetitions ||
+            monotonic_ns() - start >= settings.max_seconds * 1e9)
+            break;
+    }
+
+    estimate.warmup = settings.warmup;
+
+    return estimate;
+}
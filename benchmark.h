@@ -0,0 +1,90 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+ * Statistics of the repetitions of a measurement, after outlier
+ * rejection: samples further than 3.5 scaled median absolute deviations
+ * from the median (modified z-score of Iglewicz and Hoaglin) are left
+ * out. Intervals are 95% confidence intervals, Student's t for the mean
+ * and distribution-free order statistics for the median.
+ */
+struct Estimate {
+    Estimate();
+
+    unsigned samples;
+    unsigned outliers;
+    unsigned warmup;
+    bool converged;
+
+    double mean;
+    double stddev;
+    double mean_low, mean_high;
+    double median;
+    double median_low, median_high;
+
+    /* Half-width of the interval of the mean relative to the mean */
+    double relativeError() const;
+
+    /* "mean X ±Y% (95% CI X-X) median X (X-X), N samples, M outliers" */
+    std::string summary(double scale, const char *unit) const;
+
+    static Estimate of(const std::vector<double> &samples);
+
+    static const double MAX_MODIFIED_Z;
+};
+
+/*
+ * Runs a repetition of a measurement, e.g. a batch of submits returning
+ * the ns per submit, until the result is precise enough: after warm-up
+ * repetitions that are thrown away, for at least min_repetitions, and
+ * then until the 95% confidence interval of the mean is within
+ * target_error of it, max_repetitions were run or max_seconds passed.
+ */
+class Benchmark {
+public:
+    struct Settings {
+        Settings();
+
+        unsigned warmup;
+        unsigned min_repetitions;
+        unsigned max_repetitions;
+        double target_error;
+        double max_seconds;
+    };
+
+    /* The repetition gets whether it is a warm-up one */
+    typedef std::function<double(bool warmup)> Repetition;
+
+    static Estimate run(const Settings &settings,
+                        const Repetition &repetition);
+};
+
+#endif // BENCHMARK_H
@@ -0,0 +1,147 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "bo_cache.h"
+
+#include "util.h"
+
+BoCache::BoCache(DrmDevice &drm, size_t max_bytes, unsigned max_per_bucket)
+: _drm(drm)
+, _max_bytes(max_bytes)
+, _max_per_bucket(max_per_bucket)
+, _cached_bytes(0)
+, _hits(0)
+, _misses(0)
+{
+}
+
+BoCache::~BoCache()
+{
+    for (auto &it : _buckets)
+        for (auto &entry : it.second)
+            delete entry.bo;
+}
+
+size_t BoCache::bucketSize(size_t bytes)
+{
+    size_t size = 4096;
+
+    while (size < bytes)
+        size <<= 1;
+
+    return size;
+}
+
+bool BoCache::signalled(const Entry &entry)
+{
+    if (!entry.fenced)
+        return true;
+
+    /* Only go to the kernel if the last value read isn't recent enough */
+    uint32_t &value = _syncpt_values[entry.syncpt];
+    if (int32_t(value - entry.fence) >= 0)
+        return true;
+
+    value = read_syncpoint(_drm, entry.syncpt);
+
+    return int32_t(value - entry.fence) >= 0;
+}
+
+void BoCache::release(std::deque<Entry> &bucket)
+{
+    _cached_bytes -= bucket.front().bo->size();
+    delete bucket.front().bo;
+    bucket.pop_front();
+}
+
+std::unique_ptr<GemBuffer> BoCache::get(size_t bytes)
+{
+    size_t size = bucketSize(bytes);
+    auto &bucket = _buckets[size];
+
+    /* Buffers are returned in submission order, oldest completes first */
+    if (!bucket.empty() && signalled(bucket.front())) {
+        std::unique_ptr<GemBuffer> bo(bucket.front().bo);
+
+        bucket.pop_front();
+        _cached_bytes -= size;
+        _hits++;
+
+        return bo;
+    }
+
+    std::unique_ptr<GemBuffer> bo(new GemBuffer(_drm));
+
+    if (bo->allocate(size))
+        throw ioctl_error("GEM allocation failed");
+
+    if (!bo->map())
+        throw std::runtime_error("GEM mapping failed");
+
+    _misses++;
+
+    return bo;
+}
+
+void BoCache::insert(std::unique_ptr<GemBuffer> bo, const Entry &entry)
+{
+    /* Only buffers handed out by get() fit exactly into a bucket */
+    if (bucketSize(bo->size()) != bo->size())
+        return;
+
+    auto &bucket = _buckets[bo->size()];
+
+    bucket.push_back(entry);
+    bucket.back().bo = bo.release();
+    _cached_bytes += bucket.back().bo->size();
+
+    if (bucket.size() > _max_per_bucket)
+        release(bucket);
+
+    while (_cached_bytes > _max_bytes) {
+        auto largest = _buckets.rbegin();
+
+        while (largest->second.empty())
+            ++largest;
+
+        release(largest->second);
+    }
+}
+
+void BoCache::put(std::unique_ptr<GemBuffer> bo)
+{
+    insert(std::move(bo), { nullptr, false, 0, 0 });
+}
+
+void BoCache::put(std::unique_ptr<GemBuffer> bo, uint32_t syncpt,
+                  uint32_t fence)
+{
+    insert(std::move(bo), { nullptr, true, syncpt, fence });
+}
+
+void BoCache::trim()
+{
+    for (auto &it : _buckets)
+        while (!it.second.empty())
+            release(it.second);
+}
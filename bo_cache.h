@@ -0,0 +1,82 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef BO_CACHE_H
+#define BO_CACHE_H
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+
+#include "gem.h"
+
+/*
+ * Cache of idle, already mapped GEM buffers kept in power-of-two size
+ * buckets. A buffer returned together with a fence is only handed out
+ * again once its syncpoint has reached the fence. The cache holds at
+ * most max_per_bucket buffers per bucket, releasing the oldest of the
+ * bucket, and max_bytes in total, releasing the oldest of the largest
+ * bucket, as it frees the most for one GEM close.
+ */
+class BoCache {
+public:
+    BoCache(DrmDevice &drm, size_t max_bytes = 16 << 20,
+            unsigned max_per_bucket = 256);
+    BoCache(const BoCache &) = delete;
+    ~BoCache();
+
+    std::unique_ptr<GemBuffer> get(size_t bytes);
+    void put(std::unique_ptr<GemBuffer> bo);
+    void put(std::unique_ptr<GemBuffer> bo, uint32_t syncpt, uint32_t fence);
+    void trim();
+
+    unsigned hits() const { return _hits; }
+    unsigned misses() const { return _misses; }
+    size_t cachedBytes() const { return _cached_bytes; }
+
+private:
+    struct Entry {
+        GemBuffer *bo;
+        bool fenced;
+        uint32_t syncpt;
+        uint32_t fence;
+    };
+
+    static size_t bucketSize(size_t bytes);
+    bool signalled(const Entry &entry);
+    void insert(std::unique_ptr<GemBuffer> bo, const Entry &entry);
+    void release(std::deque<Entry> &bucket);
+
+    DrmDevice &_drm;
+    size_t _max_bytes;
+    unsigned _max_per_bucket;
+    size_t _cached_bytes;
+    unsigned _hits;
+    unsigned _misses;
+
+    std::map<size_t, std::deque<Entry>> _buckets;
+    std::map<uint32_t, uint32_t> _syncpt_values;
+};
+
+#endif // BO_CACHE_H
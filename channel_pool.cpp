@@ -0,0 +1,78 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "channel_pool.h"
+
+PooledChannel::PooledChannel(ChannelPool &pool,
+                             std::unique_ptr<Channel> channel)
+: _pool(&pool)
+, _channel(std::move(channel))
+{
+}
+
+PooledChannel::PooledChannel(PooledChannel &&other)
+: _pool(other._pool)
+, _channel(std::move(other._channel))
+{
+}
+
+PooledChannel::~PooledChannel()
+{
+    if (_channel)
+        _pool->release(std::move(_channel));
+}
+
+ChannelPool::ChannelPool()
+: _opened(0)
+{
+}
+
+PooledChannel ChannelPool::acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+
+        if (!_idle.empty()) {
+            std::unique_ptr<Channel> channel = std::move(_idle.back());
+            _idle.pop_back();
+
+            return PooledChannel(*this, std::move(channel));
+        }
+    }
+
+    /* Opening takes ioctls, don't hold up other threads meanwhile */
+    std::unique_ptr<Channel> channel(new Channel(_drm));
+
+    /* Look the syncpoint up now rather than in the first timed submit */
+    channel->syncpoint(0);
+    _opened++;
+
+    return PooledChannel(*this, std::move(channel));
+}
+
+void ChannelPool::release(std::unique_ptr<Channel> channel)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+
+    _idle.push_back(std::move(channel));
+}
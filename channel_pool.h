@@ -0,0 +1,87 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CHANNEL_POOL_H
+#define CHANNEL_POOL_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "gem.h"
+#include "util.h"
+
+class ChannelPool;
+
+/* Channel borrowed from a ChannelPool, given back on destruction */
+class PooledChannel {
+public:
+    PooledChannel(PooledChannel &&other);
+    PooledChannel(const PooledChannel &) = delete;
+    ~PooledChannel();
+
+    Channel & operator*() const { return *_channel; }
+    Channel * operator->() const { return _channel.get(); }
+    DrmDevice & drm() const { return _channel->_drm; }
+
+private:
+    friend class ChannelPool;
+
+    PooledChannel(ChannelPool &pool, std::unique_ptr<Channel> channel);
+
+    ChannelPool *_pool;
+    std::unique_ptr<Channel> _channel;
+};
+
+/*
+ * A long-lived DrmDevice and the channels opened on it. acquire() hands
+ * out an idle channel, or opens one if all are in use. A channel must
+ * be idle, with all its jobs waited for, when it is given back. The
+ * pool is thread safe, so worker threads each get their own channel
+ * without opening the device again.
+ */
+class ChannelPool {
+public:
+    ChannelPool();
+    ChannelPool(const ChannelPool &) = delete;
+
+    PooledChannel acquire();
+
+    DrmDevice & drm() { return _drm; }
+
+    /* Number of channels opened so far */
+    unsigned opened() const { return _opened; }
+
+private:
+    friend class PooledChannel;
+
+    void release(std::unique_ptr<Channel> channel);
+
+    DrmDevice _drm;
+    std::mutex _lock;
+    std::vector<std::unique_ptr<Channel>> _idle;
+    std::atomic<unsigned> _opened;
+};
+
+#endif // CHANNEL_POOL_H
@@ -0,0 +1,206 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "channel_uapi.h"
+
+#include <cstring>
+#include <ctime>
+#include <limits>
+
+#include "util.h"
+
+#ifdef DRM_IOCTL_TEGRA_CHANNEL_OPEN
+
+ChannelContext::ChannelContext(DrmDevice &drm, uint32_t host1x_class)
+: _drm(drm)
+{
+    drm_tegra_channel_open channel_open_args;
+    memset(&channel_open_args, 0, sizeof(channel_open_args));
+    channel_open_args.host1x_class = host1x_class;
+
+    int err = drm.ioctl(DRM_IOCTL_TEGRA_CHANNEL_OPEN, &channel_open_args);
+    if (err)
+        throw ioctl_error("Channel open failed");
+
+    _context = channel_open_args.context;
+    _version = channel_open_args.version;
+    _capabilities = channel_open_args.capabilities;
+}
+
+ChannelContext::~ChannelContext() {
+    drm_tegra_channel_close channel_close_args;
+    memset(&channel_close_args, 0, sizeof(channel_close_args));
+    channel_close_args.context = _context;
+
+    _drm.ioctl(DRM_IOCTL_TEGRA_CHANNEL_CLOSE, &channel_close_args);
+}
+
+uint32_t ChannelContext::map(GemBuffer &bo, uint32_t flags) {
+    drm_tegra_channel_map channel_map_args;
+    memset(&channel_map_args, 0, sizeof(channel_map_args));
+    channel_map_args.context = _context;
+    channel_map_args.handle = bo.handle();
+    channel_map_args.flags = flags;
+
+    int err = _drm.ioctl(DRM_IOCTL_TEGRA_CHANNEL_MAP, &channel_map_args);
+    if (err)
+        throw ioctl_error("Channel map failed");
+
+    return channel_map_args.mapping;
+}
+
+void ChannelContext::unmap(uint32_t mapping) {
+    drm_tegra_channel_unmap channel_unmap_args;
+    memset(&channel_unmap_args, 0, sizeof(channel_unmap_args));
+    channel_unmap_args.context = _context;
+    channel_unmap_args.mapping = mapping;
+
+    int err = _drm.ioctl(DRM_IOCTL_TEGRA_CHANNEL_UNMAP, &channel_unmap_args);
+    if (err)
+        throw ioctl_error("Channel unmap failed");
+}
+
+Syncpoint::Syncpoint(DrmDevice &drm) : _drm(drm) {
+    drm_tegra_syncpoint_allocate syncpoint_allocate_args;
+    memset(&syncpoint_allocate_args, 0, sizeof(syncpoint_allocate_args));
+
+    int err = drm.ioctl(DRM_IOCTL_TEGRA_SYNCPOINT_ALLOCATE,
+                        &syncpoint_allocate_args);
+    if (err)
+        throw ioctl_error("Syncpoint allocation failed");
+
+    _id = syncpoint_allocate_args.id;
+}
+
+Syncpoint::~Syncpoint() {
+    drm_tegra_syncpoint_free syncpoint_free_args;
+    memset(&syncpoint_free_args, 0, sizeof(syncpoint_free_args));
+    syncpoint_free_args.id = _id;
+
+    _drm.ioctl(DRM_IOCTL_TEGRA_SYNCPOINT_FREE, &syncpoint_free_args);
+}
+
+ChannelSubmit::ChannelSubmit() : _gathered(0) {
+}
+
+void ChannelSubmit::reset() {
+    _words.clear();
+    _cmds.clear();
+    _bufs.clear();
+    _gathered = 0;
+}
+
+void ChannelSubmit::push(const uint32_t *cmds, size_t count) {
+    _words.insert(_words.end(), cmds, cmds + count);
+}
+
+void ChannelSubmit::add_buf(uint32_t word_offset, uint32_t mapping,
+                            uint64_t target_offset, uint32_t shift)
+{
+    drm_tegra_submit_buf buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.mapping = mapping;
+    buf.reloc.target_offset = target_offset;
+    buf.reloc.gather_offset_words = word_offset;
+    buf.reloc.shift = shift;
+
+    _bufs.push_back(buf);
+}
+
+/* Words pushed since the previous command form a gather of their own */
+void ChannelSubmit::close_gather() {
+    if (_gathered == _words.size())
+        return;
+
+    drm_tegra_submit_cmd cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.type = DRM_TEGRA_SUBMIT_CMD_GATHER_UPTR;
+    cmd.gather_uptr.words = _words.size() - _gathered;
+
+    _cmds.push_back(cmd);
+    _gathered = _words.size();
+}
+
+void ChannelSubmit::add_wait(uint32_t syncpt, uint32_t threshold) {
+    close_gather();
+
+    drm_tegra_submit_cmd cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.type = DRM_TEGRA_SUBMIT_CMD_WAIT_SYNCPT;
+    cmd.wait_syncpt.id = syncpt;
+    cmd.wait_syncpt.value = threshold;
+
+    _cmds.push_back(cmd);
+}
+
+uint32_t ChannelSubmit::submit(ChannelContext &ch, Syncpoint &syncpt,
+                               uint32_t incrs)
+{
+    close_gather();
+
+    drm_tegra_channel_submit submit_args;
+    memset(&submit_args, 0, sizeof(submit_args));
+    submit_args.context = ch._context;
+    submit_args.num_bufs = _bufs.size();
+    submit_args.num_cmds = _cmds.size();
+    submit_args.gather_data_words = _words.size();
+    submit_args.bufs_ptr = (uintptr_t)_bufs.data();
+    submit_args.cmds_ptr = (uintptr_t)_cmds.data();
+    submit_args.gather_data_ptr = (uintptr_t)_words.data();
+    submit_args.syncpt.id = syncpt.id();
+    submit_args.syncpt.increments = incrs;
+
+    int err = ch._drm.ioctl(DRM_IOCTL_TEGRA_CHANNEL_SUBMIT, &submit_args);
+    if (err)
+        throw ioctl_error("Submit failed");
+
+    return submit_args.syncpt.value;
+}
+
+uint32_t wait_syncpoint(DrmDevice &drm, Syncpoint &syncpt,
+                        uint32_t threshold, int64_t timeout_ns)
+{
+    drm_tegra_syncpoint_wait syncpoint_wait_args;
+    memset(&syncpoint_wait_args, 0, sizeof(syncpoint_wait_args));
+    syncpoint_wait_args.id = syncpt.id();
+    syncpoint_wait_args.threshold = threshold;
+
+    /* The UAPI takes an absolute CLOCK_MONOTONIC deadline */
+    if (timeout_ns < 0) {
+        syncpoint_wait_args.timeout_ns = std::numeric_limits<int64_t>::max();
+    } else {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        syncpoint_wait_args.timeout_ns = now.tv_sec * 1000000000ll +
+                                         now.tv_nsec + timeout_ns;
+    }
+
+    int err = drm.ioctl(DRM_IOCTL_TEGRA_SYNCPOINT_WAIT, &syncpoint_wait_args);
+    if (err)
+        throw ioctl_error("Syncpoint wait failed");
+
+    return syncpoint_wait_args.value;
+}
+
+#endif // DRM_IOCTL_TEGRA_CHANNEL_OPEN
@@ -0,0 +1,111 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CHANNEL_UAPI_H
+#define CHANNEL_UAPI_H
+
+#include <cstdint>
+#include <vector>
+
+#include <libdrm/tegra_drm.h>
+
+#include "gem.h"
+
+/*
+ * Submission engine for the channel UAPI of Linux 5.17+. Buffers are
+ * mapped into the channel once, and jobs refer to them by mapping ID,
+ * so submits no longer carry GEM handles to be looked up and pinned
+ * every time. The command stream is passed inline, from user memory,
+ * instead of through a cmdbuf BO.
+ *
+ * Only available when built against headers providing the new UAPI.
+ */
+#ifdef DRM_IOCTL_TEGRA_CHANNEL_OPEN
+
+class ChannelContext {
+public:
+    ChannelContext(DrmDevice &drm, uint32_t host1x_class);
+    ChannelContext(const ChannelContext &) = delete;
+    ~ChannelContext();
+
+    uint32_t map(GemBuffer &bo,
+                 uint32_t flags = DRM_TEGRA_CHANNEL_MAP_READ_WRITE);
+    void unmap(uint32_t mapping);
+
+    uint32_t _context;
+    uint32_t _version;
+    uint32_t _capabilities;
+    DrmDevice &_drm;
+};
+
+/* Syncpoint allocated to the DRM file, freed on destruction */
+class Syncpoint {
+public:
+    Syncpoint(DrmDevice &drm);
+    Syncpoint(const Syncpoint &) = delete;
+    ~Syncpoint();
+
+    uint32_t id() const { return _id; }
+
+private:
+    DrmDevice &_drm;
+    uint32_t _id;
+};
+
+class ChannelSubmit {
+private:
+    std::vector<uint32_t> _words;
+    std::vector<drm_tegra_submit_cmd> _cmds;
+    std::vector<drm_tegra_submit_buf> _bufs;
+    size_t _gathered;
+
+    void close_gather();
+
+public:
+    ChannelSubmit();
+
+    void reset();
+    void push(uint32_t cmd) { _words.push_back(cmd); }
+    void push(const uint32_t *cmds, size_t count);
+
+    /*
+     * The word at word_offset of the job gets the address of target
+     * mapping + target_offset, shifted right by shift.
+     */
+    void add_buf(uint32_t word_offset, uint32_t mapping,
+                 uint64_t target_offset, uint32_t shift);
+    void add_wait(uint32_t syncpt, uint32_t threshold);
+
+    /* Returns the syncpoint value at which the job is complete */
+    uint32_t submit(ChannelContext &ch, Syncpoint &syncpt, uint32_t incrs);
+
+    size_t words() const { return _words.size(); }
+};
+
+/* Waits for up to timeout_ns from now, forever if negative */
+uint32_t wait_syncpoint(DrmDevice &drm, Syncpoint &syncpt,
+                        uint32_t threshold, int64_t timeout_ns);
+
+#endif // DRM_IOCTL_TEGRA_CHANNEL_OPEN
+
+#endif // CHANNEL_UAPI_H
@@ -0,0 +1,103 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cmdbuf_ring.h"
+
+CmdbufRing::CmdbufRing(Channel &ch, unsigned depth, size_t slot_bytes)
+: _ch(ch)
+, _slots(depth)
+, _next(0)
+, _waits(0)
+, _polling(false)
+{
+    _syncpt = ch.syncpoint(0);
+    _syncpt_value = read_syncpoint(ch._drm, _syncpt);
+
+    for (auto &slot : _slots) {
+        slot.bo.reset(new GemBuffer(ch._drm));
+        slot.busy = false;
+        slot.fence = 0;
+
+        if (slot.bo->allocate(slot_bytes))
+            throw ioctl_error("Cmdbuf GEM allocation failed");
+
+        if (!slot.bo->map())
+            throw std::runtime_error("Cmdbuf GEM mapping failed");
+    }
+}
+
+bool CmdbufRing::signalled(uint32_t fence) const
+{
+    return int32_t(_syncpt_value - fence) >= 0;
+}
+
+void CmdbufRing::wait(Slot &slot)
+{
+    if (!slot.busy)
+        return;
+
+    /* Fences complete in order, a later wait may have covered this one */
+    if (!signalled(slot.fence)) {
+        _waits++;
+
+        if (_polling) {
+            do {
+                _syncpt_value = read_syncpoint(_ch._drm, _syncpt);
+            } while (!signalled(slot.fence));
+        } else {
+            _syncpt_value = wait_syncpoint(_ch._drm, _syncpt, slot.fence,
+                                           DRM_TEGRA_NO_TIMEOUT);
+        }
+    }
+
+    slot.busy = false;
+}
+
+drm_tegra_submit CmdbufRing::submit(Submit &submit)
+{
+    Slot &slot = _slots[_next];
+
+    if (submit.words() * sizeof(uint32_t) > slot.bo->size())
+        throw std::runtime_error("Job doesn't fit into cmdbuf ring slot");
+
+    wait(slot);
+
+    auto result = submit.submit(_ch, *slot.bo);
+
+    slot.busy = true;
+    slot.fence = result.fence;
+    _next = (_next + 1) % _slots.size();
+
+    return result;
+}
+
+void CmdbufRing::drain()
+{
+    /* The most recently used slot holds the latest fence */
+    unsigned last = (_next + _slots.size() - 1) % _slots.size();
+
+    wait(_slots[last]);
+
+    for (auto &slot : _slots)
+        wait(slot);
+}
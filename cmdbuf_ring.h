@@ -0,0 +1,73 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CMDBUF_RING_H
+#define CMDBUF_RING_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "gem.h"
+#include "util.h"
+
+/*
+ * Fixed ring of command buffer BOs for pipelined submission on a channel.
+ * Every slot remembers the fence of the last job submitted from it, the
+ * ring only waits when it wraps onto a slot whose job is still running.
+ * Waiting either blocks in the kernel or polls the syncpoint value.
+ */
+class CmdbufRing {
+public:
+    CmdbufRing(Channel &ch, unsigned depth, size_t slot_bytes = 4096);
+    CmdbufRing(const CmdbufRing &) = delete;
+
+    drm_tegra_submit submit(Submit &submit);
+    void drain();
+
+    void setPolling(bool polling) { _polling = polling; }
+
+    unsigned depth() const { return _slots.size(); }
+    unsigned waits() const { return _waits; }
+
+private:
+    struct Slot {
+        std::unique_ptr<GemBuffer> bo;
+        bool busy;
+        uint32_t fence;
+    };
+
+    bool signalled(uint32_t fence) const;
+    void wait(Slot &slot);
+
+    Channel &_ch;
+    uint32_t _syncpt;
+    std::vector<Slot> _slots;
+    unsigned _next;
+    unsigned _waits;
+    bool _polling;
+    uint32_t _syncpt_value;
+};
+
+#endif // CMDBUF_RING_H
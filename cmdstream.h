@@ -0,0 +1,219 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CMDSTREAM_H
+#define CMDSTREAM_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Compile-time host1x command streams. A fixed-shape stream is declared
+ * as a type, assembled into a std::array by the compiler and only has
+ * its runtime values patched into known slots:
+ *
+ *   typedef cmdstream::Stream<
+ *       cmdstream::Nonincr<0x2b, cmdstream::Value<0xdeadbeef>>,
+ *       cmdstream::Nonincr<0x00, cmdstream::Slot<0>>> Job;
+ *
+ *   constexpr auto job_template = Job::build();
+ *   auto words = job_template;
+ *   Job::patch<0>(words, platform.incrementSyncpointOp(syncpt));
+ *
+ * emit() writes the template into a buffer of the caller, such as a
+ * mapped cmdbuf, so it can be patched in place without a copy.
+ *
+ * Opcode fields that don't fit their encoding fail to compile.
+ */
+namespace cmdstream {
+
+/* Data word known at compile time */
+template <uint32_t V>
+struct Value {
+    static constexpr uint32_t value = V;
+    static constexpr int slot = -1;
+};
+
+/* Data word patched at runtime, zero in the template */
+template <unsigned Id>
+struct Slot {
+    static constexpr uint32_t value = 0;
+    static constexpr int slot = Id;
+};
+
+namespace detail {
+
+template <typename... Data>
+struct Pack;
+
+template <>
+struct Pack<> {
+    static constexpr uint32_t value(unsigned) { return 0; }
+    static constexpr int slot(unsigned) { return -1; }
+};
+
+template <typename D, typename... Rest>
+struct Pack<D, Rest...> {
+    static constexpr uint32_t value(unsigned i) {
+        return i == 0 ? D::value : Pack<Rest...>::value(i - 1);
+    }
+    static constexpr int slot(unsigned i) {
+        return i == 0 ? D::slot : Pack<Rest...>::slot(i - 1);
+    }
+};
+
+constexpr unsigned popcount(uint32_t v) {
+    return v ? (v & 1) + popcount(v >> 1) : 0;
+}
+
+/* Opcode word followed by its data words */
+template <uint32_t Opcode, typename... Data>
+struct Op {
+    static constexpr unsigned size = 1 + sizeof...(Data);
+
+    static constexpr uint32_t word(unsigned i) {
+        return i == 0 ? Opcode : Pack<Data...>::value(i - 1);
+    }
+    static constexpr int slot(unsigned i) {
+        return i == 0 ? -1 : Pack<Data...>::slot(i - 1);
+    }
+};
+
+} // namespace detail
+
+template <unsigned ClassId, unsigned Offset, unsigned Mask, typename... Data>
+struct SetClass : detail::Op<(0u << 28) | (Offset << 16) | (ClassId << 6) |
+                             Mask, Data...> {
+    static_assert(ClassId <= 0x3ff, "SETCLASS class id exceeds 10 bits");
+    static_assert(Offset <= 0xfff, "SETCLASS offset exceeds 12 bits");
+    static_assert(Mask <= 0x3f, "SETCLASS mask exceeds 6 bits");
+    static_assert(detail::popcount(Mask) == sizeof...(Data),
+                  "SETCLASS mask doesn't match the number of data words");
+};
+
+template <unsigned Offset, typename... Data>
+struct Incr : detail::Op<(1u << 28) | (Offset << 16) | sizeof...(Data),
+                         Data...> {
+    static_assert(Offset <= 0xfff, "INCR offset exceeds 12 bits");
+    static_assert(sizeof...(Data) <= 0xffff, "INCR count exceeds 16 bits");
+};
+
+template <unsigned Offset, typename... Data>
+struct Nonincr : detail::Op<(2u << 28) | (Offset << 16) | sizeof...(Data),
+                            Data...> {
+    static_assert(Offset <= 0xfff, "NONINCR offset exceeds 12 bits");
+    static_assert(sizeof...(Data) <= 0xffff, "NONINCR count exceeds 16 bits");
+};
+
+template <unsigned Offset, unsigned Bits, typename... Data>
+struct Mask : detail::Op<(3u << 28) | (Offset << 16) | Bits, Data...> {
+    static_assert(Offset <= 0xfff, "MASK offset exceeds 12 bits");
+    static_assert(Bits <= 0xffff, "MASK mask exceeds 16 bits");
+    static_assert(detail::popcount(Bits) == sizeof...(Data),
+                  "MASK mask doesn't match the number of data words");
+};
+
+template <unsigned Offset, unsigned Data>
+struct Imm : detail::Op<(4u << 28) | (Offset << 16) | Data> {
+    static_assert(Offset <= 0xfff, "IMM offset exceeds 12 bits");
+    static_assert(Data <= 0xffff, "IMM data exceeds 16 bits");
+};
+
+/* Write of the SoC specific syncpoint increment word to INCR_SYNCPT */
+template <unsigned Id>
+using SyncptIncr = Nonincr<0x00, Slot<Id>>;
+
+template <typename... Ops>
+struct Stream;
+
+template <>
+struct Stream<> {
+    static constexpr unsigned words = 0;
+
+    static constexpr uint32_t word(unsigned) { return 0; }
+    static constexpr int slot(unsigned) { return -1; }
+};
+
+template <typename First, typename... Rest>
+struct Stream<First, Rest...> {
+    static constexpr unsigned words = First::size + Stream<Rest...>::words;
+
+    typedef std::array<uint32_t, words> Words;
+
+    static constexpr uint32_t word(unsigned i) {
+        return i < First::size ? First::word(i) :
+                                 Stream<Rest...>::word(i - First::size);
+    }
+    static constexpr int slot(unsigned i) {
+        return i < First::size ? First::slot(i) :
+                                 Stream<Rest...>::slot(i - First::size);
+    }
+
+    /* Word index of the given slot, words if there is no such slot */
+    static constexpr unsigned slotIndex(unsigned id) {
+        unsigned i = 0;
+
+        while (i < words && slot(i) != int(id))
+            i++;
+
+        return i;
+    }
+
+    static constexpr Words build() {
+        return build(std::make_index_sequence<words>());
+    }
+
+    /* Copies the template straight into a destination buffer */
+    static void emit(uint32_t *stream) {
+        static constexpr Words words_template = build();
+
+        std::copy(words_template.begin(), words_template.end(), stream);
+    }
+
+    template <unsigned Id>
+    static void patch(uint32_t *stream, uint32_t value) {
+        typedef std::integral_constant<unsigned, slotIndex(Id)> Index;
+
+        static_assert(Index::value < words, "No such slot in stream");
+        stream[Index::value] = value;
+    }
+
+    template <unsigned Id>
+    static void patch(Words &stream, uint32_t value) {
+        patch<Id>(stream.data(), value);
+    }
+
+private:
+    template <size_t... I>
+    static constexpr Words build(std::index_sequence<I...>) {
+        return Words{{ word(I)... }};
+    }
+};
+
+} // namespace cmdstream
+
+#endif // CMDSTREAM_H
@@ -0,0 +1,518 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "environment.h"
+
+#include <fcntl.h>
+#include <glob.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <stdexcept>
+
+#include "results.h"
+#include "stats.h"
+#include "util.h"
+
+namespace {
+
+std::string trim(const std::string &str)
+{
+    size_t end = str.find_last_not_of(" \t\n");
+
+    return end == std::string::npos ? "" : str.substr(0, end + 1);
+}
+
+struct CpuTimes {
+    int cpu;            /* -1 for the sum of all CPUs */
+    uint64_t busy;
+    uint64_t total;
+};
+
+std::vector<CpuTimes> read_cpu_times(int &procs_running)
+{
+    std::stringstream stat(read_file("/proc/stat"));
+    std::vector<CpuTimes> times;
+    std::string line;
+
+    procs_running = -1;
+
+    while (std::getline(stat, line)) {
+        if (!line.compare(0, 14, "procs_running "))
+            procs_running = atoi(line.c_str() + 14);
+
+        if (line.compare(0, 3, "cpu"))
+            continue;
+
+        std::stringstream fields(line);
+        std::string name;
+        uint64_t value, idle = 0, total = 0;
+        unsigned i = 0;
+
+        fields >> name;
+
+        /* user nice system idle iowait irq softirq steal */
+        while (i < 8 && fields >> value) {
+            if (i == 3 || i == 4)
+                idle += value;
+            total += value;
+            i++;
+        }
+
+        times.push_back({ name == "cpu" ? -1 : atoi(name.c_str() + 3),
+                          total - idle, total });
+    }
+
+    return times;
+}
+
+/* Signals after which the governors are put back before dying */
+const int FATAL_SIGNALS[] = {
+    SIGINT, SIGTERM, SIGHUP, SIGQUIT, SIGABRT, SIGSEGV, SIGBUS, SIGFPE, SIGILL,
+};
+const size_t NUM_FATAL_SIGNALS = sizeof(FATAL_SIGNALS) /
+                                 sizeof(FATAL_SIGNALS[0]);
+
+struct sigaction saved_actions[NUM_FATAL_SIGNALS];
+
+/* The environment whose governors exit() or a fatal signal put back */
+std::atomic<BenchmarkEnvironment *> active_environment(nullptr);
+
+uint64_t spin(uint64_t iterations)
+{
+    volatile uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++)
+        sum = sum + i;
+
+    return sum;
+}
+
+} // anonymous namespace
+
+const double BenchmarkEnvironment::MAX_QUIET_BUSY_PERCENT = 10.0;
+const double BenchmarkEnvironment::MAX_QUIET_CV_PERCENT = 5.0;
+const uint64_t BenchmarkEnvironment::WORK_NS;
+const uint64_t BenchmarkEnvironment::SLEEP_NS;
+const size_t BenchmarkEnvironment::PREFAULT_STACK;
+const size_t BenchmarkEnvironment::PREFAULT_HEAP;
+
+BenchmarkEnvironment::BenchmarkEnvironment(const std::string &governor,
+                                           int fifo_priority,
+                                           bool lock_memory)
+: _governor(governor)
+, _governors_restored(false)
+, _handlers_installed(false)
+, _num_cpufreq(0)
+, _num_governed(0)
+, _fifo_priority(fifo_priority)
+, _fifo_set(false)
+, _saved_policy(SCHED_OTHER)
+, _lock_memory(lock_memory)
+, _memory_locked(false)
+, _busy_percent(-1)
+, _busiest_cpu_percent(-1)
+, _busiest_cpu(-1)
+, _other_runnable(-1)
+, _loadavg(-1)
+, _jitter_runs(0)
+, _work_cv_percent(0)
+, _work_spread_percent(0)
+, _sleep_overshoot_p50(0)
+, _sleep_overshoot_p99(0)
+, _sleep_overshoot_max(0)
+{
+    if (!governor.empty())
+        setGovernors(governor);
+
+    if (!_governors.empty())
+        installRestoreHandlers();
+
+    if (fifo_priority)
+        setFifo(fifo_priority);
+
+    if (lock_memory)
+        lockMemory();
+}
+
+BenchmarkEnvironment::~BenchmarkEnvironment()
+{
+    if (_memory_locked) {
+        munlockall();
+        mallopt(M_TRIM_THRESHOLD, 128 * 1024);
+        mallopt(M_MMAP_MAX, 65536);
+    }
+
+    if (_fifo_set)
+        sched_setscheduler(0, _saved_policy, &_saved_param);
+
+    if (!_governors_restored.exchange(true)) {
+        for (const auto &governor : _governors) {
+            try {
+                write_file(governor.path, governor.saved);
+            }
+            catch (std::runtime_error e) {
+                fprintf(stderr, "%s\n", e.what());
+            }
+        }
+    }
+
+    if (_handlers_installed)
+        removeRestoreHandlers();
+}
+
+void BenchmarkEnvironment::setGovernors(const std::string &governor)
+{
+    glob_t paths;
+
+    if (glob("/sys/devices/system/cpu/cpu[0-9]*/cpufreq/scaling_governor",
+             0, nullptr, &paths))
+        return;
+
+    for (size_t i = 0; i < paths.gl_pathc; i++) {
+        std::string path = paths.gl_pathv[i];
+
+        _num_cpufreq++;
+
+        try {
+            std::string saved = trim(read_file(path));
+
+            if (saved != governor) {
+                write_file(path, governor);
+                _governors.push_back({ path, saved });
+            }
+
+            if (trim(read_file(path)) == governor)
+                _num_governed++;
+        }
+        catch (std::runtime_error) {
+        }
+    }
+
+    globfree(&paths);
+}
+
+void BenchmarkEnvironment::restoreGovernors()
+{
+    if (_governors_restored.exchange(true))
+        return;
+
+    /* Only system calls, no allocations: this runs in signal handlers */
+    for (const auto &governor : _governors) {
+        int fd = open(governor.path.c_str(), O_WRONLY | O_TRUNC);
+        if (fd < 0)
+            continue;
+
+        if (write(fd, governor.saved.data(), governor.saved.size()) < 0) {
+            /* Nothing to report to from here, try the next one */
+        }
+
+        close(fd);
+    }
+}
+
+void BenchmarkEnvironment::installRestoreHandlers()
+{
+    static bool at_exit_registered;
+    struct sigaction action;
+
+    if (!at_exit_registered)
+        at_exit_registered = atexit(restoreAtExit) == 0;
+
+    active_environment = this;
+
+    /* Once restored, the signal gets its default action */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = restoreOnSignal;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+
+    for (size_t i = 0; i < NUM_FATAL_SIGNALS; i++)
+        sigaction(FATAL_SIGNALS[i], &action, &saved_actions[i]);
+
+    _handlers_installed = true;
+}
+
+void BenchmarkEnvironment::removeRestoreHandlers()
+{
+    for (size_t i = 0; i < NUM_FATAL_SIGNALS; i++)
+        sigaction(FATAL_SIGNALS[i], &saved_actions[i], nullptr);
+
+    active_environment = nullptr;
+    _handlers_installed = false;
+}
+
+void BenchmarkEnvironment::restoreOnSignal(int sig)
+{
+    BenchmarkEnvironment *environment = active_environment;
+
+    if (environment)
+        environment->restoreGovernors();
+
+    /* Delivered with the default action once the handler returns */
+    raise(sig);
+}
+
+void BenchmarkEnvironment::restoreAtExit()
+{
+    BenchmarkEnvironment *environment = active_environment;
+
+    if (environment)
+        environment->restoreGovernors();
+}
+
+void BenchmarkEnvironment::setFifo(int priority)
+{
+    sched_param param;
+
+    _saved_policy = sched_getscheduler(0);
+    sched_getparam(0, &_saved_param);
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+
+    if (sched_setscheduler(0, SCHED_FIFO, &param) == 0)
+        _fifo_set = true;
+    else
+        _fifo_error = strerror(errno);
+}
+
+void BenchmarkEnvironment::lockMemory()
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+        _lock_error = strerror(errno);
+        return;
+    }
+
+    _memory_locked = true;
+
+    /* Keep freed heap in the process, where it stays faulted in */
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    void *heap = malloc(PREFAULT_HEAP);
+    if (heap) {
+        memset(heap, 0, PREFAULT_HEAP);
+        free(heap);
+    }
+
+    char stack[PREFAULT_STACK];
+    for (size_t i = 0; i < PREFAULT_STACK; i += 4096)
+        stack[i] = 0;
+
+    /* Keeps the stores to the otherwise dead array */
+    asm volatile("" : : "r"(stack) : "memory");
+}
+
+void BenchmarkEnvironment::measureLoad(unsigned ms)
+{
+    int procs_running;
+
+    try {
+        auto before = read_cpu_times(procs_running);
+        usleep(ms * 1000);
+        auto after = read_cpu_times(procs_running);
+
+        if (before.size() != after.size())
+            return;
+
+        _busiest_cpu_percent = -1;
+
+        for (size_t i = 0; i < after.size(); i++) {
+            uint64_t busy = after[i].busy - before[i].busy;
+            uint64_t total = after[i].total - before[i].total;
+            double percent = total ? 100.0 * busy / total : 0;
+
+            if (after[i].cpu < 0) {
+                _busy_percent = percent;
+            } else if (percent > _busiest_cpu_percent) {
+                _busiest_cpu_percent = percent;
+                _busiest_cpu = after[i].cpu;
+            }
+        }
+
+        /* Reading /proc/stat, this thread was running itself */
+        _other_runnable = procs_running - 1;
+
+        sscanf(read_file("/proc/loadavg").c_str(), "%lf", &_loadavg);
+    }
+    catch (std::runtime_error) {
+    }
+}
+
+void BenchmarkEnvironment::measureJitter(unsigned runs)
+{
+    uint64_t iterations = 1000, begin, elapsed;
+
+    /* Amount of work taking about WORK_NS */
+    for (;;) {
+        begin = monotonic_ns();
+        spin(iterations);
+        elapsed = monotonic_ns() - begin;
+
+        if (elapsed >= WORK_NS / 2)
+            break;
+
+        iterations *= 2;
+    }
+    iterations = iterations * WORK_NS / std::max<uint64_t>(elapsed, 1);
+
+    std::vector<double> work(runs);
+    LatencyHistogram overshoot;
+
+    for (unsigned i = 0; i < runs; i++) {
+        begin = monotonic_ns();
+        spin(iterations);
+        work[i] = monotonic_ns() - begin;
+    }
+
+    for (unsigned i = 0; i < runs; i++) {
+        timespec sleep = { 0, long(SLEEP_NS) };
+
+        begin = monotonic_ns();
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &sleep, nullptr);
+        elapsed = monotonic_ns() - begin;
+
+        overshoot.record(elapsed > SLEEP_NS ? elapsed - SLEEP_NS : 0);
+    }
+
+    double sum = 0, sum_squares = 0;
+
+    for (double ns : work) {
+        sum += ns;
+        sum_squares += ns * ns;
+    }
+
+    double mean = sum / runs;
+    double variance = std::max(0.0, sum_squares / runs - mean * mean);
+    auto minmax = std::minmax_element(work.begin(), work.end());
+
+    _jitter_runs = runs;
+    _work_cv_percent = 100 * sqrt(variance) / mean;
+    _work_spread_percent = 100 * (*minmax.second - *minmax.first) /
+                           *minmax.first;
+    _sleep_overshoot_p50 = overshoot.percentile(50);
+    _sleep_overshoot_p99 = overshoot.percentile(99);
+    _sleep_overshoot_max = overshoot.max();
+}
+
+std::string BenchmarkEnvironment::report() const
+{
+    char buffer[512];
+    std::string report;
+
+    if (_governor.empty())
+        report += "environment: CPU frequency governors left alone\n";
+    else if (!_num_cpufreq)
+        report += "environment: no CPU frequency governors found\n";
+    else {
+        sprintf(buffer, "environment: governor %s on %u of %u CPUs\n",
+                _governor.c_str(), _num_governed, _num_cpufreq);
+        report += buffer;
+    }
+
+    if (_fifo_set) {
+        sprintf(buffer, "environment: SCHED_FIFO priority %d\n",
+                _fifo_priority);
+        report += buffer;
+    } else if (_fifo_priority) {
+        report += "environment: setting SCHED_FIFO failed: " + _fifo_error +
+                  "\n";
+    }
+
+    if (_memory_locked)
+        report += "environment: memory locked, stack and heap pre-faulted\n";
+    else if (_lock_memory)
+        report += "environment: locking memory failed: " + _lock_error +
+                  "\n";
+
+    if (_busy_percent >= 0) {
+        sprintf(buffer, "environment: other tasks used %.1f%% of the CPUs, "
+                        "%.1f%% of CPU%d, %d other runnable, load average "
+                        "%.2f\n",
+                _busy_percent, _busiest_cpu_percent, _busiest_cpu,
+                _other_runnable, _loadavg);
+        report += buffer;
+
+        if (_busiest_cpu_percent > MAX_QUIET_BUSY_PERCENT ||
+            _other_runnable > 0)
+            report += "environment: WARNING: interfering load, results "
+                      "may be noisy\n";
+    }
+
+    if (_jitter_runs) {
+        sprintf(buffer, "environment: %u runs of %.0f us of work vary by "
+                        "%.2f%% (CV), %.1f%% min to max; %.0f us sleeps "
+                        "overshoot by p50 %.1f p99 %.1f max %.1f us\n",
+                _jitter_runs, WORK_NS / 1000.0, _work_cv_percent,
+                _work_spread_percent, SLEEP_NS / 1000.0,
+                _sleep_overshoot_p50 / 1000.0,
+                _sleep_overshoot_p99 / 1000.0,
+                _sleep_overshoot_max / 1000.0);
+        report += buffer;
+
+        if (_work_cv_percent > MAX_QUIET_CV_PERCENT)
+            report += "environment: WARNING: timing jitter, results may "
+                      "be noisy\n";
+    }
+
+    return report;
+}
+
+void BenchmarkEnvironment::record(Results &results) const
+{
+    results.addEnvironment("governor", _governor.empty() ? "unchanged"
+                                                         : _governor);
+    results.addEnvironment("governed_cpus", _num_governed);
+    results.addEnvironment("cpufreq_cpus", _num_cpufreq);
+    results.addEnvironment("sched_fifo_priority",
+                           _fifo_set ? _fifo_priority : 0);
+    results.addEnvironment("memory_locked", _memory_locked ? 1 : 0);
+
+    if (_busy_percent >= 0) {
+        results.addEnvironment("busy_percent", _busy_percent);
+        results.addEnvironment("busiest_cpu_percent", _busiest_cpu_percent);
+        results.addEnvironment("other_runnable", _other_runnable);
+        results.addEnvironment("loadavg", _loadavg);
+    }
+
+    if (_jitter_runs) {
+        results.addEnvironment("work_cv_percent", _work_cv_percent);
+        results.addEnvironment("work_spread_percent", _work_spread_percent);
+        results.addEnvironment("sleep_overshoot_p50_ns",
+                               _sleep_overshoot_p50);
+        results.addEnvironment("sleep_overshoot_p99_ns",
+                               _sleep_overshoot_p99);
+        results.addEnvironment("sleep_overshoot_max_ns",
+                               _sleep_overshoot_max);
+    }
+}
@@ -0,0 +1,132 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <sched.h>
+#include <signal.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Results;
+
+/*
+ * Machine settings that make benchmark numbers comparable between runs
+ * and boards, and measurements of how quiet the machine is. The
+ * constructor applies what was asked for, the destructor puts back what
+ * it changed, so that a run doesn't leave the board in performance mode.
+ * The governors outlive the process, so they are also put back on exit()
+ * and on fatal signals such as SIGINT or an abort().
+ *
+ * SCHED_FIFO applies to the calling thread and the threads it creates
+ * afterwards. A thread spinning on a CPU it shares with another FIFO
+ * thread of the same priority starves it until RT throttling kicks in.
+ */
+class BenchmarkEnvironment {
+public:
+    /*
+     * governor: cpufreq governor for every CPU, empty to keep them;
+     * fifo_priority: SCHED_FIFO priority, 0 to keep the policy;
+     * lock_memory: mlockall() and pre-fault the stack and heap.
+     */
+    BenchmarkEnvironment(const std::string &governor, int fifo_priority,
+                         bool lock_memory);
+    BenchmarkEnvironment(const BenchmarkEnvironment &) = delete;
+    ~BenchmarkEnvironment();
+
+    /* CPU time used by everything else in the system over ms */
+    void measureLoad(unsigned ms);
+
+    /* Spread of the time of a fixed amount of work and of short sleeps */
+    void measureJitter(unsigned runs);
+
+    /* Settings, interfering load and jitter, with warnings */
+    std::string report() const;
+
+    /* Stores the same, to be written with the JSON results */
+    void record(Results &results) const;
+
+    /* Above these, the report warns that results may be noisy */
+    static const double MAX_QUIET_BUSY_PERCENT;
+    static const double MAX_QUIET_CV_PERCENT;
+    static const uint64_t WORK_NS = 200000;
+    static const uint64_t SLEEP_NS = 100000;
+    static const size_t PREFAULT_STACK = 512 * 1024;
+    static const size_t PREFAULT_HEAP = 16 * 1024 * 1024;
+
+private:
+    struct Governor {
+        std::string path;
+        std::string saved;
+    };
+
+    void setGovernors(const std::string &governor);
+    void setFifo(int priority);
+    void lockMemory();
+
+    /* Async-signal-safe, only the first call writes the governors back */
+    void restoreGovernors();
+    void installRestoreHandlers();
+    void removeRestoreHandlers();
+    static void restoreOnSignal(int sig);
+    static void restoreAtExit();
+
+    std::string _governor;
+    std::vector<Governor> _governors;
+    std::atomic<bool> _governors_restored;
+    bool _handlers_installed;
+    unsigned _num_cpufreq;
+    unsigned _num_governed;
+
+    int _fifo_priority;
+    bool _fifo_set;
+    int _saved_policy;
+    sched_param _saved_param;
+    std::string _fifo_error;
+
+    bool _lock_memory;
+    bool _memory_locked;
+    std::string _lock_error;
+
+    /* From measureLoad(), negative if not measured */
+    double _busy_percent;
+    double _busiest_cpu_percent;
+    int _busiest_cpu;
+    int _other_runnable;
+    double _loadavg;
+
+    /* From measureJitter() */
+    unsigned _jitter_runs;
+    double _work_cv_percent;
+    double _work_spread_percent;
+    uint64_t _sleep_overshoot_p50;
+    uint64_t _sleep_overshoot_p99;
+    uint64_t _sleep_overshoot_max;
+};
+
+#endif // ENVIRONMENT_H
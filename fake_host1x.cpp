@@ -0,0 +1,854 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "fake_host1x.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <map>
+
+#include <sys/mman.h>
+
+#include "host1x.h"
+#include "platform.h"
+#include "validator.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const uint32_t NUM_SYNCPTS = 192;
+
+/* Syncpoint increment of a "running" job, applied once it's done */
+struct PendingIncr {
+    Clock::time_point done;
+    uint32_t id;
+
+    bool operator>(const PendingIncr &other) const {
+        return done > other.done;
+    }
+};
+
+/* A job that timed out gets its syncpoint forced to the fence */
+struct Recovery {
+    uint32_t id;
+    uint32_t fence;
+    Clock::time_point deadline;
+};
+
+
+struct SyncpointFile {
+    std::mutex lock;
+    std::condition_variable cond;
+
+    uint32_t value[NUM_SYNCPTS];
+    uint32_t max[NUM_SYNCPTS];
+    uint32_t next_free;
+    /* Syncpoints freed through the channel UAPI, for reallocation */
+    std::vector<uint32_t> free_ids;
+
+    std::map<uint32_t, uint32_t> client_syncpts;
+    std::map<uint32_t, Clock::time_point> client_busy;
+    /*
+     * Syncpoint increments of jobs still "running", a min-heap on the
+     * completion time; its storage is reused, so scheduling jobs doesn't
+     * allocate in steady state.
+     */
+    std::vector<PendingIncr> running;
+    std::vector<Recovery> recoveries;
+    /* Scratch space of reach_time() */
+    std::vector<Clock::time_point> times;
+    Clock::duration job_time;
+
+    SyncpointFile() : value(), max(), next_free(1), job_time(0) { }
+};
+
+SyncpointFile syncpoints;
+
+int fail(int err)
+{
+    errno = err;
+    return -1;
+}
+
+bool reached(uint32_t value, uint32_t threshold)
+{
+    return int32_t(value - threshold) >= 0;
+}
+
+/* Called with syncpoints.lock held */
+void update_syncpoints(Clock::time_point now)
+{
+    auto &incrs = syncpoints.running;
+
+    while (!incrs.empty() && incrs.front().done <= now) {
+        syncpoints.value[incrs.front().id]++;
+
+        std::pop_heap(incrs.begin(), incrs.end(),
+                      std::greater<PendingIncr>());
+        incrs.pop_back();
+    }
+
+    auto &list = syncpoints.recoveries;
+
+    for (auto it = list.begin(); it != list.end();) {
+        if (it->deadline > now) {
+            ++it;
+            continue;
+        }
+
+        if (!reached(syncpoints.value[it->id], it->fence))
+            syncpoints.value[it->id] = it->fence;
+
+        it = list.erase(it);
+    }
+}
+
+/* Called with syncpoints.lock held */
+bool allocate_syncpoint(uint32_t *id)
+{
+    if (!syncpoints.free_ids.empty()) {
+        *id = syncpoints.free_ids.back();
+        syncpoints.free_ids.pop_back();
+        return true;
+    }
+
+    if (syncpoints.next_free == NUM_SYNCPTS)
+        return false;
+
+    *id = syncpoints.next_free++;
+
+    return true;
+}
+
+/* Waits until the deadline, or forever if it's Clock::time_point::max() */
+int wait_syncpoint(uint32_t id, uint32_t thresh, Clock::time_point deadline,
+                   uint32_t *value)
+{
+    std::unique_lock<std::mutex> lock(syncpoints.lock);
+
+    for (;;) {
+        auto now = Clock::now();
+
+        update_syncpoints(now);
+        *value = syncpoints.value[id];
+
+        if (reached(*value, thresh))
+            return 0;
+
+        if (now >= deadline)
+            return fail(EAGAIN);
+
+        auto wake = deadline;
+        if (!syncpoints.running.empty())
+            wake = std::min(wake, syncpoints.running.front().done);
+        for (const auto &recovery : syncpoints.recoveries)
+            wake = std::min(wake, recovery.deadline);
+
+        if (wake == Clock::time_point::max())
+            syncpoints.cond.wait(lock);
+        else
+            syncpoints.cond.wait_until(lock, wake);
+    }
+}
+
+/*
+ * Time at which syncpoint id reaches the threshold with the increments
+ * queued so far, or time_point::max() if it never does. Called with
+ * syncpoints.lock held.
+ */
+Clock::time_point reach_time(uint32_t id, uint32_t threshold,
+                             Clock::time_point now)
+{
+    uint32_t value = syncpoints.value[id];
+
+    if (reached(value, threshold))
+        return now;
+
+    auto &times = syncpoints.times;
+    auto time = Clock::time_point::max();
+    uint32_t missing = threshold - value;
+
+    times.clear();
+    for (const auto &incr : syncpoints.running)
+        if (incr.id == id)
+            times.push_back(incr.done);
+
+    if (missing <= times.size()) {
+        std::nth_element(times.begin(), times.begin() + missing - 1,
+                         times.end());
+        time = times[missing - 1];
+    }
+
+    for (const auto &recovery : syncpoints.recoveries)
+        if (recovery.id == id && reached(recovery.fence, threshold))
+            time = std::min(time, recovery.deadline);
+
+    return time;
+}
+
+/*
+ * Queues the syncpoint increments performed by a job of the client once
+ * its waits are reached, returns the fence of the job: the value of
+ * syncpoint id once all of its expected increments are done.
+ */
+uint32_t schedule_job(uint32_t client, uint32_t id, uint32_t expected,
+                      const std::vector<uint32_t> &incrs,
+                      const std::vector<FakeHost1x::SyncptWait> &waits,
+                      Clock::duration timeout)
+{
+    std::lock_guard<std::mutex> guard(syncpoints.lock);
+
+    auto now = Clock::now();
+    auto start = now;
+    unsigned incrs_done = 0;
+
+    syncpoints.max[id] += expected;
+    uint32_t fence = syncpoints.max[id];
+
+    for (const auto &wait : waits) {
+        uint32_t value = syncpoints.value[wait.id];
+        uint32_t threshold = wait.threshold;
+
+        /* Narrow thresholds are relative to the current value */
+        if (wait.threshold_mask != ~0u)
+            threshold = value + (int32_t((threshold - value) << 8) >> 8);
+
+        start = std::max(start, reach_time(wait.id, threshold, now));
+    }
+
+    /* Jobs of an engine execute one after another */
+    auto &busy = syncpoints.client_busy[client];
+    auto done = now;
+
+    if (start == Clock::time_point::max()) {
+        /* Waiting for what never happens, the engine hangs */
+        busy = std::max(now, busy) + timeout;
+    } else {
+        done = std::max(start, busy) + syncpoints.job_time;
+        busy = done;
+
+        for (uint32_t incr : incrs) {
+            incrs_done += incr == id;
+
+            if (done <= now) {
+                syncpoints.value[incr]++;
+                continue;
+            }
+
+            syncpoints.running.push_back({ done, incr });
+            std::push_heap(syncpoints.running.begin(),
+                           syncpoints.running.end(),
+                           std::greater<PendingIncr>());
+        }
+    }
+
+    if (incrs_done < expected)
+        syncpoints.recoveries.push_back({ id, fence, done + timeout });
+
+    syncpoints.cond.notify_all();
+
+    return fence;
+}
+
+bool valid_client(uint32_t client)
+{
+    switch (client) {
+    case HOST1X_CLASS_GR2D:
+    case HOST1X_CLASS_GR2D_SB:
+    case HOST1X_CLASS_VIC:
+    case HOST1X_CLASS_GR3D:
+        return true;
+    default:
+        return false;
+    }
+}
+
+} // anonymous namespace
+
+FakeHost1x::FakeHost1x()
+: _next_handle(1)
+, _next_context(1)
+{
+    _syncpt_id_mask = platform.syncpointIdMask();
+}
+
+FakeHost1x::~FakeHost1x()
+{
+    for (auto &it : _bos)
+        ::munmap(it.second.data, it.second.size);
+
+    /* Closing the DRM file releases its syncpoints */
+    std::lock_guard<std::mutex> guard(syncpoints.lock);
+
+    for (uint32_t id : _syncpts)
+        syncpoints.free_ids.push_back(id);
+}
+
+DrmBackend *FakeHost1x::create()
+{
+    return new FakeHost1x();
+}
+
+void FakeHost1x::setJobTime(std::chrono::nanoseconds time)
+{
+    std::lock_guard<std::mutex> guard(syncpoints.lock);
+
+    syncpoints.job_time = time;
+}
+
+int FakeHost1x::ioctl(int request, void *ptr)
+{
+    switch ((unsigned int)request) {
+    case DRM_IOCTL_TEGRA_GEM_CREATE:
+        return gemCreate(static_cast<drm_tegra_gem_create *>(ptr));
+    case DRM_IOCTL_TEGRA_GEM_MMAP:
+        return gemMmap(static_cast<drm_tegra_gem_mmap *>(ptr));
+    case DRM_IOCTL_GEM_CLOSE:
+        return gemClose(static_cast<drm_gem_close *>(ptr));
+    case DRM_IOCTL_TEGRA_OPEN_CHANNEL:
+        return openChannel(static_cast<drm_tegra_open_channel *>(ptr));
+    case DRM_IOCTL_TEGRA_CLOSE_CHANNEL:
+        return closeChannel(static_cast<drm_tegra_close_channel *>(ptr));
+    case DRM_IOCTL_TEGRA_GET_SYNCPT:
+        return getSyncpt(static_cast<drm_tegra_get_syncpt *>(ptr));
+    case DRM_IOCTL_TEGRA_SYNCPT_READ:
+        return syncptRead(static_cast<drm_tegra_syncpt_read *>(ptr));
+    case DRM_IOCTL_TEGRA_SYNCPT_INCR:
+        return syncptIncr(static_cast<drm_tegra_syncpt_incr *>(ptr));
+    case DRM_IOCTL_TEGRA_SYNCPT_WAIT:
+        return syncptWait(static_cast<drm_tegra_syncpt_wait *>(ptr));
+    case DRM_IOCTL_TEGRA_SUBMIT:
+        return submit(static_cast<drm_tegra_submit *>(ptr));
+#ifdef DRM_IOCTL_TEGRA_CHANNEL_OPEN
+    case DRM_IOCTL_TEGRA_CHANNEL_OPEN:
+        return channelOpen(static_cast<drm_tegra_channel_open *>(ptr));
+    case DRM_IOCTL_TEGRA_CHANNEL_CLOSE:
+        return channelClose(static_cast<drm_tegra_channel_close *>(ptr));
+    case DRM_IOCTL_TEGRA_CHANNEL_MAP:
+        return channelMap(static_cast<drm_tegra_channel_map *>(ptr));
+    case DRM_IOCTL_TEGRA_CHANNEL_UNMAP:
+        return channelUnmap(static_cast<drm_tegra_channel_unmap *>(ptr));
+    case DRM_IOCTL_TEGRA_CHANNEL_SUBMIT:
+        return channelSubmit(static_cast<drm_tegra_channel_submit *>(ptr));
+    case DRM_IOCTL_TEGRA_SYNCPOINT_ALLOCATE:
+        return syncpointAllocate(
+                    static_cast<drm_tegra_syncpoint_allocate *>(ptr));
+    case DRM_IOCTL_TEGRA_SYNCPOINT_FREE:
+        return syncpointFree(static_cast<drm_tegra_syncpoint_free *>(ptr));
+    case DRM_IOCTL_TEGRA_SYNCPOINT_WAIT:
+        return syncpointWait(static_cast<drm_tegra_syncpoint_wait *>(ptr));
+#endif
+    case DRM_IOCTL_GEM_OPEN:
+        /* There is no one to share buffers with */
+        return fail(ENOENT);
+    default:
+        return fail(ENOTTY);
+    }
+}
+
+void * FakeHost1x::mmap(size_t size, uint64_t offset)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    auto bo = _bos.find(offset >> 12);
+    if (bo == _bos.end() || size > bo->second.size) {
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    return bo->second.data;
+}
+
+void FakeHost1x::munmap(void *, size_t)
+{
+    /* Backing storage belongs to the GEM object */
+}
+
+int FakeHost1x::gemCreate(drm_tegra_gem_create *args)
+{
+    if (args->size == 0)
+        return fail(EINVAL);
+
+    void *data = ::mmap(0, args->size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+        return fail(ENOMEM);
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    args->handle = _next_handle++;
+    _bos[args->handle] = { data, size_t(args->size) };
+
+    return 0;
+}
+
+int FakeHost1x::gemMmap(drm_tegra_gem_mmap *args)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if (!_bos.count(args->handle))
+        return fail(EINVAL);
+
+    args->offset = uint64_t(args->handle) << 12;
+
+    return 0;
+}
+
+int FakeHost1x::gemClose(drm_gem_close *args)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    auto bo = _bos.find(args->handle);
+    if (bo == _bos.end())
+        return fail(EINVAL);
+
+    ::munmap(bo->second.data, bo->second.size);
+    _bos.erase(bo);
+
+    return 0;
+}
+
+int FakeHost1x::openChannel(drm_tegra_open_channel *args)
+{
+    if (!valid_client(args->client))
+        return fail(ENODEV);
+
+    uint32_t syncpt;
+    {
+        std::lock_guard<std::mutex> guard(syncpoints.lock);
+
+        auto it = syncpoints.client_syncpts.find(args->client);
+        if (it == syncpoints.client_syncpts.end()) {
+            if (!allocate_syncpoint(&syncpt))
+                return fail(EBUSY);
+
+            syncpoints.client_syncpts[args->client] = syncpt;
+        } else {
+            syncpt = it->second;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    args->context = _next_context++;
+    _contexts[args->context] = { args->client, syncpt, {}, 1 };
+
+    return 0;
+}
+
+int FakeHost1x::closeChannel(drm_tegra_close_channel *args)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if (!_contexts.erase(args->context))
+        return fail(EINVAL);
+
+    return 0;
+}
+
+int FakeHost1x::getSyncpt(drm_tegra_get_syncpt *args)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    auto ctx = _contexts.find(args->context);
+    if (ctx == _contexts.end() || args->index != 0)
+        return fail(EINVAL);
+
+    args->id = ctx->second.syncpt;
+
+    return 0;
+}
+
+int FakeHost1x::syncptRead(drm_tegra_syncpt_read *args)
+{
+    if (args->id >= NUM_SYNCPTS)
+        return fail(EINVAL);
+
+    std::lock_guard<std::mutex> guard(syncpoints.lock);
+
+    update_syncpoints(Clock::now());
+    args->value = syncpoints.value[args->id];
+
+    return 0;
+}
+
+int FakeHost1x::syncptIncr(drm_tegra_syncpt_incr *args)
+{
+    if (args->id >= NUM_SYNCPTS)
+        return fail(EINVAL);
+
+    std::lock_guard<std::mutex> guard(syncpoints.lock);
+
+    syncpoints.value[args->id]++;
+    if (!reached(syncpoints.max[args->id], syncpoints.value[args->id]))
+        syncpoints.max[args->id] = syncpoints.value[args->id];
+
+    syncpoints.cond.notify_all();
+
+    return 0;
+}
+
+int FakeHost1x::syncptWait(drm_tegra_syncpt_wait *args)
+{
+    if (args->id >= NUM_SYNCPTS)
+        return fail(EINVAL);
+
+    auto deadline = Clock::time_point::max();
+    if (args->timeout != DRM_TEGRA_NO_TIMEOUT)
+        deadline = Clock::now() + std::chrono::milliseconds(args->timeout);
+
+    return wait_syncpoint(args->id, args->thresh, deadline, &args->value);
+}
+
+int FakeHost1x::submit(drm_tegra_submit *args)
+{
+    auto syncpts = reinterpret_cast<const drm_tegra_syncpt *>(
+                        uintptr_t(args->syncpts));
+    auto cmdbufs = reinterpret_cast<const drm_tegra_cmdbuf *>(
+                        uintptr_t(args->cmdbufs));
+    auto relocs = reinterpret_cast<const drm_tegra_reloc *>(
+                        uintptr_t(args->relocs));
+    /* Reused by the thread's next submit, to keep them allocation-free */
+    static thread_local std::vector<uint32_t> incrs;
+    static thread_local std::vector<SyncptWait> waits;
+    uint32_t client;
+
+    incrs.clear();
+    waits.clear();
+
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        auto ctx = _contexts.find(args->context);
+        if (ctx == _contexts.end())
+            return fail(EINVAL);
+
+        client = ctx->second.client;
+
+        /* Only one syncpoint, the one of the channel, is supported */
+        if (args->num_syncpts != 1 || syncpts[0].id != ctx->second.syncpt)
+            return fail(EINVAL);
+
+        for (uint32_t i = 0; i < args->num_relocs; i++) {
+            auto cmdbuf_bo = _bos.find(relocs[i].cmdbuf.handle);
+            auto target_bo = _bos.find(relocs[i].target.handle);
+
+            if (cmdbuf_bo == _bos.end() || target_bo == _bos.end())
+                return fail(ENOENT);
+
+            if (relocs[i].cmdbuf.offset % 4 ||
+                relocs[i].cmdbuf.offset + 4 > cmdbuf_bo->second.size)
+                return fail(EINVAL);
+
+            if (relocs[i].target.offset >= target_bo->second.size)
+                return fail(EINVAL);
+        }
+
+        for (uint32_t i = 0; i < args->num_cmdbufs; i++) {
+            auto bo = _bos.find(cmdbufs[i].handle);
+            if (bo == _bos.end())
+                return fail(ENOENT);
+
+            if (cmdbufs[i].offset % 4 ||
+                uint64_t(cmdbufs[i].offset) + cmdbufs[i].words * 4ull >
+                    bo->second.size)
+                return fail(EINVAL);
+
+            auto words = static_cast<const uint32_t *>(bo->second.data) +
+                         cmdbufs[i].offset / 4;
+
+            if (!execute(client, words, cmdbufs[i].words, incrs, waits))
+                return fail(EINVAL);
+        }
+    }
+
+    args->fence = schedule_job(client, syncpts[0].id, syncpts[0].incrs, incrs,
+                               waits, std::chrono::milliseconds(args->timeout));
+
+    return 0;
+}
+
+#ifdef DRM_IOCTL_TEGRA_CHANNEL_OPEN
+
+int FakeHost1x::channelOpen(drm_tegra_channel_open *args)
+{
+    if (args->flags || !valid_client(args->host1x_class))
+        return fail(EINVAL);
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    /* Jobs name their syncpoint themselves, channels don't own one */
+    args->context = _next_context++;
+    args->version = 0;
+    args->capabilities = 0;
+    _contexts[args->context] = { args->host1x_class, 0, {}, 1 };
+
+    return 0;
+}
+
+int FakeHost1x::channelClose(drm_tegra_channel_close *args)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if (!_contexts.erase(args->context))
+        return fail(EINVAL);
+
+    return 0;
+}
+
+int FakeHost1x::channelMap(drm_tegra_channel_map *args)
+{
+    if (args->flags & ~DRM_TEGRA_CHANNEL_MAP_READ_WRITE)
+        return fail(EINVAL);
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    auto ctx = _contexts.find(args->context);
+    if (ctx == _contexts.end())
+        return fail(EINVAL);
+
+    if (!_bos.count(args->handle))
+        return fail(ENOENT);
+
+    args->mapping = ctx->second.next_mapping++;
+    ctx->second.mappings[args->mapping] = args->handle;
+
+    return 0;
+}
+
+int FakeHost1x::channelUnmap(drm_tegra_channel_unmap *args)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    auto ctx = _contexts.find(args->context);
+    if (ctx == _contexts.end() || !ctx->second.mappings.erase(args->mapping))
+        return fail(EINVAL);
+
+    return 0;
+}
+
+int FakeHost1x::channelSubmit(drm_tegra_channel_submit *args)
+{
+    auto bufs = reinterpret_cast<const drm_tegra_submit_buf *>(
+                        uintptr_t(args->bufs_ptr));
+    auto cmds = reinterpret_cast<const drm_tegra_submit_cmd *>(
+                        uintptr_t(args->cmds_ptr));
+    auto data = reinterpret_cast<const uint32_t *>(
+                        uintptr_t(args->gather_data_ptr));
+    std::vector<uint32_t> incrs;
+    std::vector<SyncptWait> waits;
+    uint32_t client;
+
+    /* There are no syncobjs to wait for or signal */
+    if (args->syncobj_in || args->syncobj_out)
+        return fail(ENOENT);
+
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        auto ctx = _contexts.find(args->context);
+        if (ctx == _contexts.end())
+            return fail(EINVAL);
+
+        client = ctx->second.client;
+
+        if (!_syncpts.count(args->syncpt.id))
+            return fail(EINVAL);
+
+        /* Like the kernel, patch a copy of the gather data */
+        std::vector<uint32_t> words(data, data + args->gather_data_words);
+
+        for (uint32_t i = 0; i < args->num_bufs; i++) {
+            auto mapping = ctx->second.mappings.find(bufs[i].mapping);
+            if (mapping == ctx->second.mappings.end())
+                return fail(EINVAL);
+
+            auto bo = _bos.find(mapping->second);
+            if (bo == _bos.end())
+                return fail(ENOENT);
+
+            if (bufs[i].flags & ~DRM_TEGRA_SUBMIT_RELOC_SECTOR_LAYOUT ||
+                bufs[i].reloc.gather_offset_words >= words.size() ||
+                bufs[i].reloc.target_offset >= bo->second.size)
+                return fail(EINVAL);
+
+            /* Fake IOVA, the same as the mmap offset */
+            uint64_t iova = uint64_t(mapping->second) << 12;
+
+            words[bufs[i].reloc.gather_offset_words] =
+                (iova + bufs[i].reloc.target_offset) >> bufs[i].reloc.shift;
+        }
+
+        size_t pos = 0;
+
+        for (uint32_t i = 0; i < args->num_cmds; i++) {
+            switch (cmds[i].type) {
+            case DRM_TEGRA_SUBMIT_CMD_GATHER_UPTR:
+                if (cmds[i].gather_uptr.words > words.size() - pos)
+                    return fail(EINVAL);
+
+                if (!execute(client, &words[pos], cmds[i].gather_uptr.words,
+                             incrs, waits))
+                    return fail(EINVAL);
+
+                pos += cmds[i].gather_uptr.words;
+                break;
+            case DRM_TEGRA_SUBMIT_CMD_WAIT_SYNCPT:
+                if (cmds[i].wait_syncpt.id >= NUM_SYNCPTS)
+                    return fail(EINVAL);
+
+                waits.push_back({ cmds[i].wait_syncpt.id,
+                                  cmds[i].wait_syncpt.value, ~0u });
+                break;
+            default:
+                return fail(EINVAL);
+            }
+        }
+    }
+
+    /* The kernel applies a fixed 10 second timeout to these jobs */
+    args->syncpt.value = schedule_job(client, args->syncpt.id,
+                                      args->syncpt.increments, incrs, waits,
+                                      std::chrono::seconds(10));
+
+    return 0;
+}
+
+int FakeHost1x::syncpointAllocate(drm_tegra_syncpoint_allocate *args)
+{
+    uint32_t id;
+    {
+        std::lock_guard<std::mutex> guard(syncpoints.lock);
+
+        if (!allocate_syncpoint(&id))
+            return fail(EBUSY);
+    }
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    _syncpts.insert(id);
+    args->id = id;
+
+    return 0;
+}
+
+int FakeHost1x::syncpointFree(drm_tegra_syncpoint_free *args)
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        if (!_syncpts.erase(args->id))
+            return fail(EINVAL);
+    }
+
+    std::lock_guard<std::mutex> guard(syncpoints.lock);
+
+    syncpoints.free_ids.push_back(args->id);
+
+    return 0;
+}
+
+int FakeHost1x::syncpointWait(drm_tegra_syncpoint_wait *args)
+{
+    if (args->id >= NUM_SYNCPTS)
+        return fail(EINVAL);
+
+    /* The timeout is an absolute CLOCK_MONOTONIC time */
+    auto deadline = Clock::time_point(std::chrono::nanoseconds(
+                                          args->timeout_ns));
+
+    return wait_syncpoint(args->id, args->threshold, deadline, &args->value);
+}
+
+#endif // DRM_IOCTL_TEGRA_CHANNEL_OPEN
+
+/*
+ * Executes a command stream of a job of the client, collecting writes to
+ * the INCR_SYNCPT register (offset 0 of every class) and the syncpoint
+ * waits of the host1x class.
+ */
+bool FakeHost1x::execute(uint32_t client, const uint32_t *words,
+                         uint32_t count, std::vector<uint32_t> &incrs,
+                         std::vector<SyncptWait> &waits) const
+{
+    struct {
+        std::vector<uint32_t> &incrs;
+        std::vector<SyncptWait> &waits;
+        uint32_t id_mask;
+        uint32_t class_id;
+        uint32_t payload;
+
+        void opcode(size_t) { }
+
+        const char *setClass(uint32_t id) {
+            class_id = id;
+            return nullptr;
+        }
+
+        const char *write(uint32_t reg, uint32_t value, size_t) {
+            uint32_t id;
+
+            if (reg == HOST1X_UCLASS_INCR_SYNCPT) {
+                id = value & id_mask;
+                if (id >= NUM_SYNCPTS)
+                    return "Invalid syncpoint";
+
+                incrs.push_back(id);
+
+                return nullptr;
+            }
+
+            if (class_id != HOST1X_CLASS_HOST1X)
+                return nullptr;
+
+            switch (reg) {
+            case HOST1X_UCLASS_WAIT_SYNCPT:
+                id = value >> 24;
+                if (id >= NUM_SYNCPTS)
+                    return "Invalid syncpoint";
+
+                waits.push_back({ id, value & 0xffffff, 0xffffff });
+                break;
+            case HOST1X_UCLASS_LOAD_SYNCPT_PAYLOAD_32:
+                payload = value;
+                break;
+            case HOST1X_UCLASS_WAIT_SYNCPT_32:
+                id = value & id_mask;
+                if (id >= NUM_SYNCPTS)
+                    return "Invalid syncpoint";
+
+                waits.push_back({ id, payload, ~0u });
+                break;
+            }
+
+            return nullptr;
+        }
+    } visitor = { incrs, waits, _syncpt_id_mask, client, 0 };
+
+    return host1x_decode(words, count, visitor) == nullptr;
+}
@@ -0,0 +1,123 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FAKE_HOST1X_H
+#define FAKE_HOST1X_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <libdrm/tegra_drm.h>
+
+#include "gem.h"
+
+/*
+ * Software host1x emulator implementing the subset of the Tegra DRM UAPI
+ * used by the tests: GEM create/mmap/close, channel open/close, syncpoint
+ * get/read/incr/wait and job submission, plus the channel UAPI of Linux
+ * 5.17+ when the headers provide it. Submitted command buffers are
+ * validated like the kernel firewall does, decoded and executed right
+ * away, so syncpoint increments become visible by the time the submit
+ * ioctl returns. With a job time set, increments of a job only become
+ * visible once it has "run" for that long after the previous job of the
+ * same engine. Syncpoint waits of a job, in the host1x class or as
+ * channel UAPI commands, hold back its start until they are reached;
+ * they are not ordered against the rest of its stream. Jobs that don't
+ * perform all of their increments are "recovered" once their timeout
+ * expires, like the kernel does on a hang.
+ *
+ * Syncpoints are shared by all instances, like on real hardware; GEM
+ * handles and channel contexts are per instance, like per DRM file.
+ */
+class FakeHost1x : public DrmBackend {
+public:
+    FakeHost1x();
+    ~FakeHost1x();
+
+    int ioctl(int request, void *ptr) override;
+    void *mmap(size_t size, uint64_t offset) override;
+    void munmap(void *ptr, size_t size) override;
+
+    static DrmBackend *create();
+    static void setJobTime(std::chrono::nanoseconds time);
+
+    struct SyncptWait {
+        uint32_t id;
+        uint32_t threshold;
+        /* Bits of the threshold compared, 24 with the legacy opcode */
+        uint32_t threshold_mask;
+    };
+
+private:
+    struct Bo {
+        void *data;
+        size_t size;
+    };
+
+    struct Context {
+        uint32_t client;
+        uint32_t syncpt;
+        /* Channel UAPI buffer mappings, to GEM handles */
+        std::unordered_map<uint32_t, uint32_t> mappings;
+        uint32_t next_mapping;
+    };
+
+    int gemCreate(drm_tegra_gem_create *args);
+    int gemMmap(drm_tegra_gem_mmap *args);
+    int gemClose(drm_gem_close *args);
+    int openChannel(drm_tegra_open_channel *args);
+    int closeChannel(drm_tegra_close_channel *args);
+    int getSyncpt(drm_tegra_get_syncpt *args);
+    int syncptRead(drm_tegra_syncpt_read *args);
+    int syncptIncr(drm_tegra_syncpt_incr *args);
+    int syncptWait(drm_tegra_syncpt_wait *args);
+    int submit(drm_tegra_submit *args);
+#ifdef DRM_IOCTL_TEGRA_CHANNEL_OPEN
+    int channelOpen(drm_tegra_channel_open *args);
+    int channelClose(drm_tegra_channel_close *args);
+    int channelMap(drm_tegra_channel_map *args);
+    int channelUnmap(drm_tegra_channel_unmap *args);
+    int channelSubmit(drm_tegra_channel_submit *args);
+    int syncpointAllocate(drm_tegra_syncpoint_allocate *args);
+    int syncpointFree(drm_tegra_syncpoint_free *args);
+    int syncpointWait(drm_tegra_syncpoint_wait *args);
+#endif
+
+    bool execute(uint32_t client, const uint32_t *words, uint32_t count,
+                 std::vector<uint32_t> &incrs,
+                 std::vector<SyncptWait> &waits) const;
+
+    std::mutex _lock;
+    std::unordered_map<uint32_t, Bo> _bos;
+    std::unordered_map<uint64_t, Context> _contexts;
+    std::unordered_set<uint32_t> _syncpts;
+    uint32_t _next_handle;
+    uint64_t _next_context;
+    uint32_t _syncpt_id_mask;
+};
+
+#endif // FAKE_HOST1X_H
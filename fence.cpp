@@ -0,0 +1,269 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "fence.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <libdrm/tegra_drm.h>
+
+#include "util.h"
+
+static bool reached(uint32_t value, uint32_t threshold)
+{
+    return int32_t(value - threshold) >= 0;
+}
+
+Fence::Fence(FenceEngine &engine, uint32_t syncpt, uint32_t threshold)
+: _sync(engine._sync)
+, _syncpt(syncpt)
+, _threshold(threshold)
+, _signalled(false)
+, _error(0)
+, _done(false)
+{
+}
+
+void Fence::wait()
+{
+    std::unique_lock<std::mutex> lock(_sync->lock);
+
+    while (!_done)
+        _sync->signalled.wait(lock);
+
+    if (_error) {
+        ioctl_error error("Fence wait failed");
+        error.error = _error;
+        throw error;
+    }
+}
+
+void Fence::then(std::function<void()> callback)
+{
+    {
+        std::lock_guard<std::mutex> guard(_sync->lock);
+
+        if (!_signalled) {
+            _callbacks.push_back(std::move(callback));
+            return;
+        }
+    }
+
+    callback();
+}
+
+FenceEngine::FenceEngine(DrmDevice &drm)
+: _drm(drm)
+, _sync(std::make_shared<FenceSync>())
+, _idle(0)
+, _waiters(0)
+, _wakeups(0)
+, _stop(false)
+{
+}
+
+FenceEngine::~FenceEngine()
+{
+    std::vector<std::shared_ptr<Fence>> cancelled;
+
+    {
+        std::lock_guard<std::mutex> guard(_sync->lock);
+        _stop = true;
+    }
+
+    _request_cond.notify_all();
+
+    for (auto &thread : _threads)
+        thread.join();
+
+    std::unique_lock<std::mutex> lock(_sync->lock);
+
+    for (auto &it : _syncpts)
+        complete(it.second, ECANCELED, cancelled);
+
+    if (!cancelled.empty())
+        signal(cancelled, lock);
+}
+
+std::shared_ptr<Fence> FenceEngine::track(uint32_t syncpt, uint32_t threshold)
+{
+    auto fence = std::make_shared<Fence>(*this, syncpt, threshold);
+    std::lock_guard<std::mutex> guard(_sync->lock);
+    Syncpoint &sp = _syncpts[syncpt];
+
+    if (sp.known && reached(sp.value, threshold)) {
+        fence->_signalled = true;
+        fence->_done = true;
+        return fence;
+    }
+
+    sp.pending.push_back(fence);
+
+    if (covered(sp, threshold))
+        return fence;
+
+    sp.waits.push_back(threshold);
+    _requests.push_back({ syncpt, threshold });
+
+    /* Woken waiters only count as busy once they took their request */
+    if (_requests.size() > _idle) {
+        _threads.emplace_back(&FenceEngine::run, this);
+        _waiters++;
+    } else {
+        _request_cond.notify_one();
+    }
+
+    return fence;
+}
+
+/* True if a waiter of the syncpoint wakes up no later than threshold */
+bool FenceEngine::covered(const Syncpoint &sp, uint32_t threshold) const
+{
+    for (uint32_t wait : sp.waits)
+        if (reached(threshold, wait))
+            return true;
+
+    return false;
+}
+
+/* Moves out the fences that reached the syncpoint value, or all on error */
+void FenceEngine::complete(Syncpoint &sp, int error,
+                           std::vector<std::shared_ptr<Fence>> &completed)
+{
+    for (auto fence = sp.pending.begin(); fence != sp.pending.end();) {
+        if (error || (sp.known && reached(sp.value, (*fence)->_threshold))) {
+            (*fence)->_error = error;
+            completed.push_back(std::move(*fence));
+            fence = sp.pending.erase(fence);
+        } else {
+            ++fence;
+        }
+    }
+}
+
+/* Called with _sync->lock held, drops it while running the continuations */
+void FenceEngine::signal(std::vector<std::shared_ptr<Fence>> &fences,
+                         std::unique_lock<std::mutex> &lock)
+{
+    std::vector<std::function<void()>> callbacks;
+
+    for (auto &fence : fences) {
+        fence->_signalled = true;
+
+        for (auto &callback : fence->_callbacks)
+            callbacks.push_back(std::move(callback));
+
+        fence->_callbacks.clear();
+    }
+
+    lock.unlock();
+
+    for (auto &callback : callbacks)
+        callback();
+
+    lock.lock();
+
+    for (auto &fence : fences)
+        fence->_done = true;
+
+    _sync->signalled.notify_all();
+
+    fences.clear();
+}
+
+void FenceEngine::run()
+{
+    std::unique_lock<std::mutex> lock(_sync->lock);
+    std::vector<std::shared_ptr<Fence>> completed;
+
+    while (!_stop) {
+        if (_requests.empty()) {
+            _idle++;
+            _request_cond.wait(lock);
+            _idle--;
+            continue;
+        }
+
+        Request request = _requests.back();
+        _requests.pop_back();
+
+        /* Syncpoints are never removed, the reference stays valid */
+        Syncpoint &sp = _syncpts[request.syncpt];
+        uint32_t threshold = request.threshold;
+
+        /* Follow the earliest fence of the syncpoint until none is left */
+        for (;;) {
+            /* The timeout only bounds the time to notice a stop request */
+            drm_tegra_syncpt_wait syncpt_wait_args;
+            memset(&syncpt_wait_args, 0, sizeof(syncpt_wait_args));
+            syncpt_wait_args.id = request.syncpt;
+            syncpt_wait_args.thresh = threshold;
+            syncpt_wait_args.timeout = 100;
+
+            lock.unlock();
+
+            int err = 0;
+            if (_drm.ioctl(DRM_IOCTL_TEGRA_SYNCPT_WAIT, &syncpt_wait_args))
+                err = errno;
+
+            lock.lock();
+
+            _wakeups++;
+            sp.waits.erase(std::find(sp.waits.begin(), sp.waits.end(),
+                                     threshold));
+
+            /* A timed out wait still reports the current value */
+            if (err == 0 || err == EAGAIN) {
+                sp.value = syncpt_wait_args.value;
+                sp.known = true;
+                complete(sp, 0, completed);
+            } else if (err != EINTR) {
+                complete(sp, err, completed);
+            }
+
+            if (!completed.empty())
+                signal(completed, lock);
+
+            if (_stop || sp.pending.empty())
+                break;
+
+            auto earliest = std::min_element(sp.pending.begin(),
+                                             sp.pending.end(),
+                [&sp](const std::shared_ptr<Fence> &a,
+                      const std::shared_ptr<Fence> &b) {
+                    return a->_threshold - sp.value <
+                           b->_threshold - sp.value;
+                });
+
+            threshold = (*earliest)->_threshold;
+
+            /* Another waiter sleeps on an earlier or the same threshold */
+            if (covered(sp, threshold))
+                break;
+
+            sp.waits.push_back(threshold);
+        }
+    }
+}
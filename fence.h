@@ -0,0 +1,140 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FENCE_H
+#define FENCE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "gem.h"
+
+class FenceEngine;
+
+/*
+ * Lock and condition of a FenceEngine, shared with its fences so that
+ * they stay usable after the engine is gone.
+ */
+struct FenceSync {
+    std::mutex lock;
+    std::condition_variable signalled;
+};
+
+/*
+ * Completion of a (syncpoint, threshold) pair tracked by a FenceEngine.
+ * Continuations run on one of the engine's waiter threads, or right away
+ * in the caller if the fence has already signalled. wait() returns once
+ * the continuations attached before the fence signalled have finished.
+ * A fence whose syncpoint wait failed signals with error() set, and
+ * wait() throws. Fences may outlive their engine: destroying the engine
+ * signals the pending ones with ECANCELED, after which wait() and then()
+ * still work.
+ */
+class Fence {
+public:
+    Fence(FenceEngine &engine, uint32_t syncpt, uint32_t threshold);
+    Fence(const Fence &) = delete;
+
+    bool signalled() const { return _signalled; }
+    int error() const { return _error; }
+    void wait();
+    void then(std::function<void()> callback);
+
+    uint32_t syncpt() const { return _syncpt; }
+    uint32_t threshold() const { return _threshold; }
+
+private:
+    friend class FenceEngine;
+
+    std::shared_ptr<FenceSync> _sync;
+    uint32_t _syncpt;
+    uint32_t _threshold;
+    std::atomic<bool> _signalled;
+    std::atomic<int> _error;
+    bool _done;
+    std::vector<std::function<void()>> _callbacks;
+};
+
+/*
+ * Waiter threads for any number of outstanding fences. Each waiter sleeps
+ * in the kernel on the earliest pending fence of one syncpoint, so every
+ * fence is noticed as soon as it completes. A fence tracked after the
+ * waiter of its syncpoint went to sleep on a later threshold gets a
+ * waiter of its own; idle waiters are kept around for reuse.
+ */
+class FenceEngine {
+public:
+    FenceEngine(DrmDevice &drm);
+    FenceEngine(const FenceEngine &) = delete;
+    ~FenceEngine();
+
+    std::shared_ptr<Fence> track(uint32_t syncpt, uint32_t threshold);
+
+    unsigned wakeups() const { return _wakeups; }
+    unsigned waiters() const { return _waiters; }
+
+private:
+    friend class Fence;
+
+    struct Syncpoint {
+        Syncpoint() : known(false), value(0) {}
+
+        bool known;
+        uint32_t value;
+        std::vector<std::shared_ptr<Fence>> pending;
+        /* Thresholds the waiters of the syncpoint are sleeping on */
+        std::vector<uint32_t> waits;
+    };
+
+    struct Request {
+        uint32_t syncpt;
+        uint32_t threshold;
+    };
+
+    void run();
+    bool covered(const Syncpoint &sp, uint32_t threshold) const;
+    void complete(Syncpoint &sp, int error,
+                  std::vector<std::shared_ptr<Fence>> &completed);
+    void signal(std::vector<std::shared_ptr<Fence>> &fences,
+                std::unique_lock<std::mutex> &lock);
+
+    DrmDevice &_drm;
+    std::shared_ptr<FenceSync> _sync;
+    std::condition_variable _request_cond;
+    std::map<uint32_t, Syncpoint> _syncpts;
+    std::vector<Request> _requests;
+    std::vector<std::thread> _threads;
+    unsigned _idle;
+    std::atomic<unsigned> _waiters;
+    std::atomic<unsigned> _wakeups;
+    bool _stop;
+};
+
+#endif // FENCE_H
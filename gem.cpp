@@ -27,13 +27,32 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
 
 #include <libdrm/tegra_drm.h>
 
+#include "trace.h"
+
+DrmDevice::BackendFactory DrmDevice::_backend_factory = nullptr;
+TraceRecorder *DrmDevice::_trace_recorder = nullptr;
+thread_local uint64_t DrmDevice::_ioctl_count = 0;
+std::atomic<long> GemBuffer::_open_handles(0);
+
 DrmDevice::DrmDevice()
+: _fd(-1)
+, _recorder(_trace_recorder)
+, _trace_id(0)
 {
+    if (_recorder)
+        _trace_id = _recorder->openDevice();
+
+    if (_backend_factory) {
+        _backend.reset(_backend_factory());
+        return;
+    }
+
     _fd = open("/dev/dri/card0", O_RDWR);
     if (_fd == -1) {
         perror("Failed to open DRM device");
@@ -44,13 +63,74 @@ DrmDevice::~DrmDevice()
 {
     if (_fd != -1)
         close(_fd);
+
+    if (_recorder)
+        _recorder->closeDevice(_trace_id);
 }
 
 int DrmDevice::ioctl(int request, void *ptr)
 {
+    _ioctl_count++;
+
+    if (!_recorder)
+        return doIoctl(request, ptr);
+
+    _recorder->beginIoctl(_trace_id, request, ptr);
+    int ret = doIoctl(request, ptr);
+    int err = errno;
+    _recorder->endIoctl(_trace_id, request, ptr, ret, err);
+    errno = err;
+
+    return ret;
+}
+
+int DrmDevice::doIoctl(int request, void *ptr)
+{
+    if (_backend)
+        return _backend->ioctl(request, ptr);
+
     return ::ioctl(_fd, request, ptr);
 }
 
+void * DrmDevice::mmap(size_t size, uint64_t offset)
+{
+    void *ptr;
+
+    if (_backend) {
+        ptr = _backend->mmap(size, offset);
+    } else {
+        ptr = ::mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, offset);
+        if (ptr == MAP_FAILED)
+            ptr = nullptr;
+    }
+
+    if (ptr && _recorder)
+        _recorder->mapped(_trace_id, offset, ptr, size);
+
+    return ptr;
+}
+
+void DrmDevice::munmap(void *ptr, size_t size)
+{
+    if (_recorder)
+        _recorder->unmapped(_trace_id, ptr);
+
+    if (_backend)
+        return _backend->munmap(ptr, size);
+
+    ::munmap(ptr, size);
+}
+
+void DrmDevice::setBackendFactory(BackendFactory factory)
+{
+    _backend_factory = factory;
+}
+
+void DrmDevice::setTraceRecorder(TraceRecorder *recorder)
+{
+    _trace_recorder = recorder;
+}
+
 GemBuffer::GemBuffer(DrmDevice &dev)
 : _dev(dev), _valid(false), _handle(0), _map(nullptr)
 {
@@ -59,7 +139,7 @@ GemBuffer::GemBuffer(DrmDevice &dev)
 GemBuffer::~GemBuffer()
 {
     if (_map) {
-        munmap(_map, _size);
+        _dev.munmap(_map, _size);
     }
 
     if (_valid) {
@@ -68,7 +148,8 @@ GemBuffer::~GemBuffer()
 
         close_args.handle = _handle;
 
-        _dev.ioctl(DRM_IOCTL_GEM_CLOSE, &close_args);
+        if (_dev.ioctl(DRM_IOCTL_GEM_CLOSE, &close_args) == 0)
+            _open_handles--;
     }
 }
 
@@ -89,6 +170,7 @@ int GemBuffer::allocate(size_t bytes)
     _handle = gem_create_args.handle;
     _size = bytes;
     _valid = true;
+    _open_handles++;
 
     return 0;
 }
@@ -110,6 +192,7 @@ int GemBuffer::openByName(uint32_t name)
     _size = open_args.size;
 
     _valid = true;
+    _open_handles++;
 
     return 0;
 }
@@ -133,10 +216,8 @@ void * GemBuffer::map()
         return nullptr;
     }
 
-    _map = mmap(0, _size, PROT_READ | PROT_WRITE, MAP_SHARED,
-                _dev.fd(), gem_mmap_args.offset);
-    if (_map == MAP_FAILED) {
-        _map = nullptr;
+    _map = _dev.mmap(_size, gem_mmap_args.offset);
+    if (!_map) {
         perror("mmap failed");
         return nullptr;
     }
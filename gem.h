@@ -25,20 +25,67 @@
 #define GEM_H
 
 #include <cstdint>
+#include <atomic>
 #include <cstdlib>
+#include <memory>
+
+class TraceRecorder;
+
+/*
+ * Userspace implementation of the DRM device, used in place of the kernel
+ * driver. ioctl() follows the ioctl(2) convention of returning -1 and
+ * setting errno on failure, mmap() returns nullptr on failure.
+ */
+class DrmBackend {
+public:
+    virtual ~DrmBackend() {}
+
+    virtual int ioctl(int request, void *ptr) = 0;
+    virtual void *mmap(size_t size, uint64_t offset) = 0;
+    virtual void munmap(void *ptr, size_t size) = 0;
+};
 
 class DrmDevice {
 public:
+    typedef DrmBackend *(*BackendFactory)();
+
     DrmDevice();
     DrmDevice(const DrmDevice &) = delete;
     ~DrmDevice();
 
     int ioctl(int request, void *ptr);
+    void *mmap(size_t size, uint64_t offset);
+    void munmap(void *ptr, size_t size);
 
     int fd() const { return _fd; }
 
+    /*
+     * Devices created after this call get their backend from the factory
+     * instead of opening /dev/dri/card0. Pass nullptr to go back to the
+     * kernel driver.
+     */
+    static void setBackendFactory(BackendFactory factory);
+
+    /*
+     * Calls made through devices created after this call are recorded.
+     * Pass nullptr to stop recording for devices created afterwards.
+     */
+    static void setTraceRecorder(TraceRecorder *recorder);
+
+    /* Number of ioctl() calls made by the calling thread on any device */
+    static uint64_t ioctlCount() { return _ioctl_count; }
+
 private:
     int _fd;
+    std::unique_ptr<DrmBackend> _backend;
+    TraceRecorder *_recorder;
+    uint32_t _trace_id;
+
+    int doIoctl(int request, void *ptr);
+
+    static BackendFactory _backend_factory;
+    static TraceRecorder *_trace_recorder;
+    static thread_local uint64_t _ioctl_count;
 };
 
 typedef uint32_t gem_handle;
@@ -56,6 +103,9 @@ public:
     gem_handle handle() const { return _handle; }
     size_t size() const { return _size; }
 
+    /* Handles created or opened by any GemBuffer and not closed yet */
+    static long openHandles() { return _open_handles; }
+
 private:
     DrmDevice &_dev;
 
@@ -64,6 +114,8 @@ private:
     size_t _size;
 
     void *_map;
+
+    static std::atomic<long> _open_handles;
 };
 
 #endif // GEM_H
@@ -34,6 +34,16 @@ enum host1x_class {
 	HOST1X_CLASS_GR3D = 0x60,
 };
 
+/* Registers of the host1x class */
+enum host1x_uclass_reg {
+	HOST1X_UCLASS_INCR_SYNCPT = 0x00,
+	/* Syncpoint index in bits 31:24, 24-bit threshold below */
+	HOST1X_UCLASS_WAIT_SYNCPT = 0x08,
+	/* Tegra186+: 32-bit threshold, then the syncpoint to wait for */
+	HOST1X_UCLASS_LOAD_SYNCPT_PAYLOAD_32 = 0x4e,
+	HOST1X_UCLASS_WAIT_SYNCPT_32 = 0x50,
+};
+
 static inline uint32_t host1x_opcode_setclass(
 	unsigned class_id, unsigned offset, unsigned mask)
 {
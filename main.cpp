@@ -21,25 +21,58 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <cstdint>
 #include <cstring>
 #include <ctime>
+#include <exception>
+#include <memory>
+#include <random>
+#include <thread>
 #include <vector>
 #include <stdexcept>
 #include <cerrno>
 
 #include <poll.h>
+#include <pthread.h>
 #include <sched.h>
 
+#include "alloc_count.h"
+#include "benchmark.h"
+#include "bo_cache.h"
+#include "channel_uapi.h"
+#include "channel_pool.h"
+#include "cmdbuf_ring.h"
+#include "cmdstream.h"
+#include "environment.h"
+#include "fake_host1x.h"
+#include "fence.h"
 #include "gem.h"
 #include "host1x.h"
+#include "options.h"
+#include "perf_counters.h"
 #include "util.h"
 #include "platform.h"
+#include "replay.h"
+#include "results.h"
+#include "scheduler.h"
+#include "soak.h"
+#include "soc.h"
+#include "stats.h"
+#include "suballoc.h"
+#include "trace.h"
+#include "validator.h"
 
 #include <libdrm/tegra_drm.h>
 
 Platform platform;
+Options options;
+Results results;
+
+/* Shared by the perf tests, set up once the backend is configured */
+std::unique_ptr<ChannelPool> pool;
 
 void test_submit_wait(std::string& message) {
     DrmDevice drm;
@@ -211,16 +244,219 @@ done:
     return;
 }
 
-float submit_performance_test(std::string& message, unsigned num_batches,
-                              unsigned num_submits, unsigned num_relocs)
-{
+void test_validator(std::string& message) {
     DrmDevice drm;
     Channel ch(drm);
+    CmdbufValidator validator;
+
+    GemBuffer target_bo(drm);
+    if (target_bo.allocate(128))
+        throw std::runtime_error("Allocation failed");
+
+    validator.addBuffer(target_bo);
+
+    uint32_t syncpt = ch.syncpoint(0);
+
+    struct Case {
+        const char *name;
+        uint32_t force_cmdbuf_words;
+        uint32_t force_cmdbuf_offset;
+        uint32_t reloc_offset;
+        uint32_t reloc_target_offset;
+        unsigned incrs;
+        bool valid;
+    } cases[] = {
+        { "Valid job",                          0, 0, 4,    0,    1, true  },
+        { "Command buffer larger than stream",  10000, 0, 4, 0,   1, false },
+        { "Command buffer with unaligned offset", 0, 1, 4,  0,    1, false },
+        { "Reloc with offset larger than BO",   0, 0, 8192, 0,    1, false },
+        { "Reloc with unaligned offset",        0, 0, 1,    0,    1, false },
+        { "Reloc patching an opcode",           0, 0, 0,    0,    1, false },
+        { "Reloc with target offset larger than target BO",
+                                                0, 0, 4,    8192, 1, false },
+        { "Fence beyond syncpoint increments",  0, 0, 4,    0,    2, false },
+    };
+
+    for (const auto &c : cases) {
+        Submit submit;
+        submit.push(host1x_opcode_nonincr(0x2b, 1));
+        submit.push(0xdeadbeef);
+        submit.push(host1x_opcode_nonincr(0, 1));
+        submit.push(platform.incrementSyncpointOp(syncpt));
+
+        submit.add_incr(syncpt, c.incrs);
+        submit.add_reloc(c.reloc_offset, target_bo.handle(),
+                         c.reloc_target_offset, 0);
+
+        submit.quirks.force_cmdbuf_words = c.force_cmdbuf_words;
+        submit.quirks.force_cmdbuf_offset = c.force_cmdbuf_offset;
+
+        const char *err = submit.validate(validator);
+        if (!err != c.valid)
+            throw std::runtime_error(std::string(c.name) + ": " +
+                                     (err ?: "not rejected"));
+    }
+
+    /* Class switches */
+    {
+        Submit submit;
+        submit.push(host1x_opcode_setclass(HOST1X_CLASS_GR3D, 0, 0));
+        submit.push(host1x_opcode_nonincr(0, 1));
+        submit.push(platform.incrementSyncpointOp(syncpt));
+
+        submit.add_incr(syncpt, 1);
+
+        if (platform.defaultClass() != HOST1X_CLASS_GR3D &&
+            !submit.validate(validator))
+            throw std::runtime_error("Foreign class switch not rejected");
+    }
+
+    /* Truncated data */
+    {
+        Submit submit;
+        submit.push(host1x_opcode_nonincr(0, 1));
+        submit.push(platform.incrementSyncpointOp(syncpt));
+        submit.push(host1x_opcode_incr(0x2b, 4));
+        submit.push(0);
+
+        submit.add_incr(syncpt, 1);
+
+        if (!submit.validate(validator))
+            throw std::runtime_error("Truncated INCR not rejected");
+    }
+
+    /* Data running into the next gather */
+    {
+        GemBuffer gather_bo(drm);
+        if (gather_bo.allocate(4096))
+            throw std::runtime_error("Allocation failed");
+
+        uint32_t *words = static_cast<uint32_t *>(gather_bo.map());
+        words[0] = host1x_opcode_incr(0x2b, 2);
+        words[1] = 0;
+
+        for (unsigned split = 0; split < 2; split++) {
+            Submit submit;
+            submit.add_gather(gather_bo, 0, 2);
+            /* The second INCR data word, only valid in one stream */
+            if (split)
+                submit.push(0);
+            submit.push(host1x_opcode_nonincr(0, 1));
+            submit.push(platform.incrementSyncpointOp(syncpt));
+
+            submit.add_incr(syncpt, 1);
+
+            if (!submit.validate(validator))
+                throw std::runtime_error("INCR across gathers not rejected");
+        }
+
+        words[0] = host1x_opcode_incr(0x2b, 1);
+
+        Submit submit;
+        submit.add_gather(gather_bo, 0, 2);
+        submit.push(host1x_opcode_nonincr(0, 1));
+        submit.push(platform.incrementSyncpointOp(syncpt));
+
+        submit.add_incr(syncpt, 1);
+
+        const char *err = submit.validate(validator);
+        if (err)
+            throw std::runtime_error(std::string("Two gathers: ") + err);
+    }
+}
+
+/*
+ * Adds the per-call counts of a --counters run to the message and the
+ * results, as "<what>_<counter>" metrics.
+ */
+static void report_counters(std::string& message, const char *what,
+                            const PerfCounters &counters,
+                            const Results::Params &params)
+{
+    message += std::string("perf:   per ") + what + ": " +
+               counters.summary() + "\n";
+
+    for (unsigned i = 0; i < PerfCounters::NUM_COUNTERS; i++) {
+        auto counter = PerfCounters::Counter(i);
+
+        if (counters.source(counter) == PerfCounters::UNAVAILABLE)
+            continue;
+
+        results.addValue(std::string(what) + "_" + counters.name(counter),
+                         params, counters.perCall(counter), "events", false);
+    }
+}
+
+/* Sweep of the submit perf tests unless overridden on the command line */
+static const std::initializer_list<unsigned> DEFAULT_RELOCS =
+    { 0, 3, 6, 9, 12, 15, 18, 21 };
+static const std::initializer_list<Shape> DEFAULT_SHAPES =
+    { { 50, 10 }, { 30, 50 }, { 10, 255 } };
+
+/*
+ * Settings of Benchmark::run() from the command line. A test passes its
+ * own minimum of repetitions, such as the batches of its sweep point,
+ * and of warm-up repetitions, e.g. ahead of allocation checks. The
+ * "batches" result parameter of a sweep point is that minimum; the
+ * batches actually run are the sample count of the estimate.
+ */
+static Benchmark::Settings benchmark_settings(unsigned min_repetitions,
+                                              unsigned min_warmup = 0)
+{
+    Benchmark::Settings settings;
+
+    settings.warmup = std::max(options.warmup, min_warmup);
+    settings.min_repetitions = options.min_repetitions ?: min_repetitions;
+    settings.max_repetitions = std::max(options.max_repetitions,
+                                        settings.min_repetitions);
+    settings.target_error = options.target_error;
+
+    return settings;
+}
+
+/* Words of the job emitted by emit_reloc_job() */
+static constexpr size_t reloc_job_words(unsigned num_relocs)
+{
+    return num_relocs * 2 + 2;
+}
+
+/*
+ * Command stream of the submit perf tests: one relocated register write
+ * per relocation, then a syncpoint increment. Instantiated per SoC
+ * generation, the loop only stores constants; nothing in it depends on
+ * the platform.
+ */
+template <typename Soc>
+static void emit_reloc_job(uint32_t *words, unsigned num_relocs,
+                           uint32_t syncpt)
+{
+    for (unsigned i = 0; i < num_relocs; i++) {
+        *words++ = host1x_opcode_nonincr(0x2b, 1);
+        *words++ = 0xdeadbeef;
+    }
+    *words++ = host1x_opcode_nonincr(0, 1);
+    *words++ = Soc::incrementSyncpointOp(syncpt);
+}
+
+/*
+ * With num_gathers > 1, every submit also carries num_gathers - 1
+ * gathers of a separate, shared job incrementing the syncpoint, so that
+ * several logical jobs go through a single ioctl.
+ */
+void submit_performance_test(std::string& message, unsigned num_batches,
+                              unsigned num_submits, unsigned num_relocs,
+                              unsigned num_gathers = 1)
+{
+    PooledChannel pooled = pool->acquire();
+    DrmDevice &drm = pooled.drm();
+    Channel &ch = *pooled;
     uint32_t syncpt = ch.syncpoint(0);
-    unsigned i = 0, k;
+    unsigned i = 0;
 
     std::vector<GemBuffer*> relocs(num_relocs);
     std::vector<GemBuffer*> cmdbufs(num_submits);
+    size_t cmdbuf_size = std::max<size_t>(4096,
+                                          reloc_job_words(num_relocs) * 4);
 
     for (auto &bo : relocs) {
         bo = new GemBuffer(drm);
@@ -232,159 +468,2120 @@ float submit_performance_test(std::string& message, unsigned num_batches,
     for (auto &bo : cmdbufs) {
         bo = new GemBuffer(drm);
 
-        if (bo->allocate(4096))
+        if (bo->allocate(cmdbuf_size))
             throw std::runtime_error("Allocation failed");
     }
 
-    Submit submit;
-    for (auto &bo : relocs) {
-        submit.push(host1x_opcode_nonincr(0x2b, 1));
-        submit.push(0xdeadbeef);
-    }
-    submit.push(host1x_opcode_nonincr(0, 1));
-    submit.push(platform.incrementSyncpointOp(syncpt));
+    GemBuffer job_bo(drm);
+    if (job_bo.allocate(4096))
+        throw std::runtime_error("Allocation failed");
 
-    submit.add_incr(syncpt, 1);
+    uint32_t *job = static_cast<uint32_t *>(job_bo.map());
+    if (!job)
+        throw std::runtime_error("Mapping failed");
+
+    std::vector<uint32_t> words(reloc_job_words(num_relocs));
+
+    /* The shared job is the same stream without relocations */
+    with_soc(platform.soc(), [&](auto soc) {
+        emit_reloc_job<decltype(soc)>(words.data(), num_relocs, syncpt);
+        emit_reloc_job<decltype(soc)>(job, 0, syncpt);
+    });
+
+    Submit submit;
+    submit.push(words.data(), words.size());
+    submit.add_incr(syncpt, num_gathers);
 
     for (auto &bo : relocs)
         submit.add_reloc(i++ * 8 + 4, bo->handle(), 0, 0);
 
-    clock_t clocks = 0;
+    for (i = 1; i < num_gathers; i++)
+        submit.add_gather(job_bo, 0, 2);
+
+    LatencyHistogram latency;
+    std::unique_ptr<PerfCounters> submit_counters, wait_counters;
+
+    if (options.counters) {
+        submit_counters.reset(new PerfCounters);
+        wait_counters.reset(new PerfCounters);
+    }
 
-    for (i = 0; i < num_batches; i++) {
+    /* One batch is a repetition, measuring ns per submit */
+    auto batch = [&](bool warmup) {
         drm_tegra_submit result;
-        clock_t begin = clock();
+        uint64_t batch_ns = 0;
+
+        for (unsigned k = 0; k < num_submits; k++) {
+            if (submit_counters && !warmup)
+                submit_counters->start();
+
+            uint64_t begin = monotonic_ns();
 
-        for (k = 0; k < num_submits; k++)
             result = submit.submit(ch, *cmdbufs[k]);
 
-        clocks += clock() - begin;
+            uint64_t ns = monotonic_ns() - begin;
+
+            if (submit_counters && !warmup)
+                submit_counters->stop();
+
+            if (!warmup)
+                latency.record(ns);
+
+            batch_ns += ns;
+        }
+
+        if (wait_counters && !warmup)
+            wait_counters->start();
+
         wait_syncpoint(drm, syncpt, result.fence, DRM_TEGRA_NO_TIMEOUT);
-    }
+
+        if (wait_counters && !warmup)
+            wait_counters->stop();
+
+        return double(batch_ns) / num_submits;
+    };
+
+    Estimate estimate = Benchmark::run(benchmark_settings(num_batches),
+                                       batch);
 
     for (auto &bo : relocs)
         delete bo;
 
-    char buffer[256];
-    float elapsed = double(clocks) / CLOCKS_PER_SEC;
+    for (auto &bo : cmdbufs)
+        delete bo;
+
+    char buffer[512];
 
-    sprintf(buffer, "perf: %3u batches of %3u submits of %3u "
-                    "relocations took %f sec per batch on average, "
-                    "one submit takes %f us\n",
-            i, k, relocs.size(),
-            elapsed / i, elapsed / i / k * 1000000);
+    sprintf(buffer, "perf: batches of %3u submits of %3u relocations in "
+                    "%2u gathers, %f us per gather, one submit takes %s\n"
+                    "perf:   submit per batch: %s\n",
+            num_submits, num_relocs, num_gathers,
+            latency.mean() / 1000 / num_gathers, latency.summary().c_str(),
+            estimate.summary(1000, "us").c_str());
 
     message += buffer;
 
-    return elapsed;
+    Results::Params params = { { "batches", num_batches },
+                               { "submits", num_submits },
+                               { "relocs", num_relocs },
+                               { "gathers", num_gathers } };
+
+    results.addLatency("submit", params, latency);
+    results.addEstimate("submit_batch_mean", params, estimate, "ns", false);
+
+    if (submit_counters) {
+        report_counters(message, "submit", *submit_counters, params);
+        report_counters(message, "wait", *wait_counters, params);
+    }
 }
 
 void test_submit_performance(std::string& message) {
-    std::string path = "/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor";
-    std::string governor;
-
     /*
-     * Bind process to CPU0 and change its freq governor to reduce
-     * performance jitter.
+     * Without --gathers, multi-gather submits are only sampled at a
+     * couple of reloc counts, as the full cross product takes a while.
      */
-    try {
-        governor = read_file(path);
-        write_file(path, "performance");
+    if (options.gathers.empty()) {
+        for (unsigned i : Options::pick(options.relocs, DEFAULT_RELOCS))
+            for (const auto &shape : options.shapes(DEFAULT_SHAPES))
+                submit_performance_test(message, shape.batches,
+                                        shape.submits, i);
+
+        for (unsigned gathers = 2; gathers <= 16; gathers *= 2)
+            for (unsigned i : Options::pick(options.relocs, { 0, 9 }))
+                for (const auto &shape : options.shapes(DEFAULT_SHAPES))
+                    submit_performance_test(message, shape.batches,
+                                            shape.submits, i, gathers);
+    } else {
+        for (unsigned gathers : options.gathers)
+            for (unsigned i : Options::pick(options.relocs, DEFAULT_RELOCS))
+                for (const auto &shape : options.shapes(DEFAULT_SHAPES))
+                    submit_performance_test(message, shape.batches,
+                                            shape.submits, i, gathers);
+    }
+}
+
+#ifdef DRM_IOCTL_TEGRA_CHANNEL_OPEN
+/*
+ * Same jobs as submit_performance_test(), through the channel UAPI: the
+ * reloc targets are mapped into the channel once, up front, and every
+ * submit passes its command stream inline instead of in a cmdbuf BO.
+ */
+void channel_submit_performance_test(std::string& message,
+                                      unsigned num_batches,
+                                      unsigned num_submits,
+                                      unsigned num_relocs)
+{
+    DrmDevice drm;
+    ChannelContext ch(drm, platform.defaultClass());
+    Syncpoint syncpt(drm);
+    unsigned i = 0;
 
-        if (read_file(path).compare("performance") < 0)
-            governor.clear();
+    std::vector<std::unique_ptr<GemBuffer>> relocs(num_relocs);
+    std::vector<uint32_t> mappings;
+
+    for (auto &bo : relocs) {
+        bo.reset(new GemBuffer(drm));
+
+        if (bo->allocate(4096))
+            throw std::runtime_error("Allocation failed");
+
+        mappings.push_back(ch.map(*bo));
     }
-    catch (...) {
-        governor.clear();
+
+    ChannelSubmit submit;
+    for (uint32_t mapping : mappings) {
+        submit.push(host1x_opcode_nonincr(0x2b, 1));
+        submit.push(0xdeadbeef);
+        submit.add_buf(i++ * 2 + 1, mapping, 0, 0);
+    }
+    submit.push(host1x_opcode_nonincr(0, 1));
+    submit.push(platform.incrementSyncpointOp(syncpt.id()));
+
+    LatencyHistogram latency;
+    std::unique_ptr<PerfCounters> submit_counters, wait_counters;
+
+    if (options.counters) {
+        submit_counters.reset(new PerfCounters);
+        wait_counters.reset(new PerfCounters);
     }
 
-    if (governor.empty())
-        message += "perf: CPU frequency scaling governor change failed!\n";
+    /* One batch is a repetition, measuring ns per submit */
+    auto batch = [&](bool warmup) {
+        uint32_t fence;
+        uint64_t batch_ns = 0;
+
+        for (unsigned k = 0; k < num_submits; k++) {
+            if (submit_counters && !warmup)
+                submit_counters->start();
+
+            uint64_t begin = monotonic_ns();
 
-    cpu_set_t mask;
-    CPU_ZERO(&mask);
-    CPU_SET(0, &mask);
+            fence = submit.submit(ch, syncpt, 1);
+
+            uint64_t ns = monotonic_ns() - begin;
+
+            if (submit_counters && !warmup)
+                submit_counters->stop();
+
+            if (!warmup)
+                latency.record(ns);
+
+            batch_ns += ns;
+        }
+
+        if (wait_counters && !warmup)
+            wait_counters->start();
+
+        wait_syncpoint(drm, syncpt, fence, -1);
+
+        if (wait_counters && !warmup)
+            wait_counters->stop();
+
+        return double(batch_ns) / num_submits;
+    };
+
+    Estimate estimate = Benchmark::run(benchmark_settings(num_batches),
+                                       batch);
+
+    for (uint32_t mapping : mappings)
+        ch.unmap(mapping);
+
+    char buffer[512];
+
+    sprintf(buffer, "perf: batches of %3u channel submits of %3u buffers, "
+                    "one submit takes %s\n"
+                    "perf:   channel submit per batch: %s\n",
+            num_submits, num_relocs, latency.summary().c_str(),
+            estimate.summary(1000, "us").c_str());
+
+    message += buffer;
 
-    if (sched_setaffinity(0, sizeof(mask), &mask) != 0)
-         message += "perf: Binding to CPU0 failed!\n";
+    Results::Params params = { { "batches", num_batches },
+                               { "submits", num_submits },
+                               { "relocs", num_relocs } };
 
-    float time = 0;
+    results.addLatency("channel_submit", params, latency);
+    results.addEstimate("channel_submit_batch_mean", params, estimate, "ns",
+                        false);
 
-    for (unsigned i = 0; i < 22; i += 3) {
-        time += submit_performance_test(message, 50,  10, i);
-        time += submit_performance_test(message, 30,  50, i);
-        time += submit_performance_test(message, 10, 255, i);
+    if (submit_counters) {
+        report_counters(message, "channel_submit", *submit_counters, params);
+        report_counters(message, "channel_wait", *wait_counters, params);
     }
+}
+#endif
 
-    message += "perf: spent " + std::to_string(time) + " sec in total\n";
+/*
+ * The sweep of test_submit_performance() with the channel UAPI engine,
+ * for comparing the per-reloc cost of both.
+ */
+void test_channel_submit_performance(std::string& message) {
+#ifdef DRM_IOCTL_TEGRA_CHANNEL_OPEN
+    try {
+        DrmDevice drm;
+        ChannelContext ch(drm, platform.defaultClass());
+    }
+    catch (ioctl_error) {
+        message += "perf: channel UAPI not supported by the kernel\n";
+        return;
+    }
 
-    /* Restore original governor */
-    if (!governor.empty())
-        write_file(path, governor);
+    for (unsigned i : Options::pick(options.relocs, DEFAULT_RELOCS))
+        for (const auto &shape : options.shapes(DEFAULT_SHAPES))
+            channel_submit_performance_test(message, shape.batches,
+                                            shape.submits, i);
+#else
+    message += "perf: built without channel UAPI support\n";
+#endif
 }
 
-int main(int argc, char **argv) {
-    fprintf(stderr, "host1x_test - Linux host1x driver test suite\n");
+/*
+ * Fails a perf test whose steady-state loop allocated, allocs being the
+ * allocation_count() at the start of the loop.
+ */
+static void check_no_allocations(const char *what, uint64_t allocs)
+{
+    uint64_t count = allocation_count() - allocs;
 
-    if (platform.initialize()) {
-        const char *name;
-        switch (platform.soc()) {
-            case Platform::Tegra20:
-                name = "Tegra20 [Tegra 2]";
-                break;
-            case Platform::Tegra30:
-                name = "Tegra30 [Tegra 3]";
-                break;
-            case Platform::Tegra114:
-                name = "Tegra114 [Tegra 4]";
-                break;
-            case Platform::Tegra124:
-                name = "Tegra124 [Tegra K1]";
-                break;
-            case Platform::Tegra210:
-                name = "Tegra210 [Tegra X1]";
-                break;
-            case Platform::Tegra186:
-                name = "Tegra186 [Tegra X2]";
-                break;
+    if (count)
+        throw std::runtime_error(std::string(what) + " allocated " +
+                                 std::to_string(count) +
+                                 " times in steady state");
+}
+
+/*
+ * Per-job cost of building and submitting a stream of num_words words,
+ * with Submit staging it in a vector and copying it into the cmdbuf BO,
+ * and with DirectSubmit emitting it into the BO mapping. A repetition
+ * is a batch of num_jobs jobs, measuring CPU time per job.
+ */
+void cmdbuf_builder_performance_test(std::string& message, unsigned num_jobs,
+                                     unsigned num_words)
+{
+    PooledChannel pooled = pool->acquire();
+    DrmDevice &drm = pooled.drm();
+    Channel &ch = *pooled;
+    uint32_t syncpt = ch.syncpoint(0);
+    unsigned fill = num_words - 3;
+
+    if (num_words < 4)
+        throw std::runtime_error("Jobs need at least 4 words");
+
+    GemBuffer cmdbuf_bo(drm);
+    if (cmdbuf_bo.allocate(num_words * 4))
+        throw std::runtime_error("Allocation failed");
+
+    auto vector_batch = [&](bool) {
+        uint64_t begin = thread_cpu_ns();
+
+        for (unsigned i = 0; i < num_jobs; i++) {
+            Submit submit;
+            submit.push(host1x_opcode_nonincr(0x2b, fill));
+            for (unsigned k = 0; k < fill; k++)
+                submit.push(0xdeadbeef);
+            submit.push(host1x_opcode_nonincr(0, 1));
+            submit.push(platform.incrementSyncpointOp(syncpt));
+
+            submit.add_incr(syncpt, 1);
+
+            auto result = submit.submit(ch, cmdbuf_bo);
+            wait_syncpoint(drm, syncpt, result.fence, DRM_TEGRA_NO_TIMEOUT);
         }
 
-        fprintf(stderr, "Platform: %s\n", name);
-    } else {
-        fprintf(stderr, "Failed to detect platform, defaulting to Tegra210\n");
-        platform.setSoc(Platform::Tegra210);
-    }
+        return double(thread_cpu_ns() - begin) / num_jobs;
+    };
 
-    struct TestCase {
-        const char *name;
-        void (*func)(std::string& message);
+    /* Start small to include spilling of the first job */
+    DirectSubmit direct(drm, 4096);
+
+    auto direct_batch = [&](bool warmup) {
+        uint64_t allocs = allocation_count();
+        uint64_t begin = thread_cpu_ns();
+
+        for (unsigned i = 0; i < num_jobs; i++) {
+            direct.reset();
+            direct.push(host1x_opcode_nonincr(0x2b, fill));
+            for (unsigned k = 0; k < fill; k++)
+                direct.push(0xdeadbeef);
+            direct.push(host1x_opcode_nonincr(0, 1));
+            direct.push(platform.incrementSyncpointOp(syncpt));
+
+            direct.add_incr(syncpt, 1);
+
+            auto result = direct.submit(ch);
+            wait_syncpoint(drm, syncpt, result.fence, DRM_TEGRA_NO_TIMEOUT);
+        }
+
+        double ns = double(thread_cpu_ns() - begin) / num_jobs;
+
+        /* Only the first job, in the warm-up, may spill into a new BO */
+        if (!warmup)
+            check_no_allocations("DirectSubmit", allocs);
+
+        return ns;
     };
-    std::vector<TestCase> tests;
 
-#define PUSH_TEST(name) tests.push_back({ #name, name })
-    PUSH_TEST(test_submit_wait);
-    PUSH_TEST(test_submit_timeout);
-    PUSH_TEST(test_invalid_cmdbuf);
-    PUSH_TEST(test_invalid_reloc);
-    PUSH_TEST(test_submit_performance);
+    Benchmark::Settings settings = benchmark_settings(5, 1);
+    Estimate vector_estimate = Benchmark::run(settings, vector_batch);
+    Estimate direct_estimate = Benchmark::run(settings, direct_batch);
 
-    for (const auto &test : tests) {
-        fprintf(stderr, "- %-40s ", test.name);
-        try {
-            std::string message;
-            (test.func)(message);
-            fprintf(stderr, "PASSED\n%s", message.c_str());
+    char buffer[512];
+
+    sprintf(buffer, "perf: %5u words per job, %u spills\n"
+                    "perf:   vector+memcpy per submit: %s\n"
+                    "perf:   direct per submit: %s\n",
+            num_words, direct.spills(),
+            vector_estimate.summary(1000, "us").c_str(),
+            direct_estimate.summary(1000, "us").c_str());
+
+    message += buffer;
+
+    Results::Params params = { { "words", num_words } };
+
+    results.addEstimate("vector_submit", params, vector_estimate, "ns",
+                        false);
+    results.addEstimate("direct_submit", params, direct_estimate, "ns",
+                        false);
+}
+
+void test_cmdbuf_builder_performance(std::string& message) {
+    for (unsigned words : Options::pick(options.words,
+                                        { 16, 64, 256, 1024, 4096, 16384 }))
+        cmdbuf_builder_performance_test(message, 200, words);
+}
+
+/*
+ * Cost of the convenience Submit::submit(Channel&) path, which allocates
+ * and maps a cmdbuf BO per job, against taking the BO from a BoCache.
+ * A repetition is a batch of submits, measuring CPU time per submit.
+ */
+void bo_cache_performance_test(std::string& message, unsigned num_batches,
+                               unsigned num_submits, bool cached)
+{
+    PooledChannel pooled = pool->acquire();
+    DrmDevice &drm = pooled.drm();
+    Channel &ch = *pooled;
+    BoCache cache(drm);
+    uint32_t syncpt = ch.syncpoint(0);
+
+    Submit submit;
+    submit.push(host1x_opcode_nonincr(0, 1));
+    submit.push(platform.incrementSyncpointOp(syncpt));
+
+    submit.add_incr(syncpt, 1);
+
+    auto batch = [&](bool) {
+        drm_tegra_submit result;
+        uint64_t begin = thread_cpu_ns();
+
+        for (unsigned k = 0; k < num_submits; k++) {
+            if (cached)
+                result = submit.submit(ch, cache);
+            else
+                result = submit.submit(ch);
         }
-        catch (ioctl_error e) {
-            fprintf(stderr, "FAILED\n");
-            fprintf(stderr, "  Reason: %s\n", e.what());
+
+        double ns = double(thread_cpu_ns() - begin) / num_submits;
+
+        wait_syncpoint(drm, syncpt, result.fence, DRM_TEGRA_NO_TIMEOUT);
+
+        return ns;
+    };
+
+    Estimate estimate = Benchmark::run(benchmark_settings(num_batches),
+                                       batch);
+
+    char buffer[512];
+
+    sprintf(buffer, "perf: batches of %3u submits %s BO cache "
+                    "(%u hits, %u misses), one submit takes %s\n",
+            num_submits, cached ? "with   " : "without",
+            cache.hits(), cache.misses(),
+            estimate.summary(1000, "us").c_str());
+
+    message += buffer;
+
+    results.addEstimate(cached ? "cached_submit" : "uncached_submit",
+                        { { "batches", num_batches },
+                          { "submits", num_submits } },
+                        estimate, "ns", false);
+}
+
+void test_bo_cache_performance(std::string& message) {
+    for (const auto &shape : options.shapes(DEFAULT_SHAPES)) {
+        bo_cache_performance_test(message, shape.batches, shape.submits,
+                                  false);
+        bo_cache_performance_test(message, shape.batches, shape.submits,
+                                  true);
+    }
+}
+
+/*
+ * Throughput of back-to-back submission through a cmdbuf ring of the
+ * given depth. Unlike the CPU time based tests, this includes the time
+ * spent waiting for ring slots to become free. A repetition submits
+ * num_submits jobs and drains the ring.
+ */
+void cmdbuf_ring_performance_test(std::string& message, unsigned num_submits,
+                                  unsigned depth, bool polling)
+{
+    PooledChannel pooled = pool->acquire();
+    Channel &ch = *pooled;
+    CmdbufRing ring(ch, depth);
+    uint32_t syncpt = ch.syncpoint(0);
+    unsigned submitted = 0;
+
+    ring.setPolling(polling);
+
+    Submit submit;
+    submit.push(host1x_opcode_nonincr(0, 1));
+    submit.push(platform.incrementSyncpointOp(syncpt));
+
+    submit.add_incr(syncpt, 1);
+
+    auto repetition = [&](bool warmup) {
+        uint64_t allocs = allocation_count();
+        uint64_t begin = monotonic_ns();
+
+        for (unsigned i = 0; i < num_submits; i++)
+            ring.submit(submit);
+
+        ring.drain();
+
+        uint64_t elapsed = monotonic_ns() - begin;
+
+        if (!warmup)
+            check_no_allocations("CmdbufRing", allocs);
+
+        submitted += num_submits;
+
+        return num_submits * 1e9 / elapsed;
+    };
+
+    Estimate estimate = Benchmark::run(benchmark_settings(4, 1), repetition);
+
+    char buffer[512];
+
+    sprintf(buffer, "perf: ring depth %3u (%s): %u of %u submits waited for "
+                    "a slot, %s\n",
+            ring.depth(), polling ? "poll " : "block", ring.waits(),
+            submitted, estimate.summary(1000, "k submits/s").c_str());
+
+    message += buffer;
+
+    results.addEstimate(polling ? "poll_rate" : "block_rate",
+                        { { "submits", num_submits }, { "depth", depth } },
+                        estimate, "submits/s", true);
+}
+
+void test_cmdbuf_ring_performance(std::string& message) {
+    for (unsigned depth = 1; depth <= 64; depth *= 2) {
+        cmdbuf_ring_performance_test(message, 500, depth, false);
+        cmdbuf_ring_performance_test(message, 500, depth, true);
+    }
+}
+
+enum ScalingMode {
+    SHARED_CHANNEL,
+    CHANNEL_PER_THREAD,
+    FD_PER_THREAD,
+};
+
+struct ScalingWorker {
+    std::thread thread;
+    std::exception_ptr error;
+    double submit_time;
+    unsigned submits;
+};
+
+static void submit_scaling_worker(ScalingWorker &worker, ScalingMode mode,
+                                  DrmDevice &shared_drm, Channel &shared_ch,
+                                  unsigned cpu, unsigned num_batches,
+                                  unsigned num_submits,
+                                  std::atomic<unsigned> &ready,
+                                  std::atomic<bool> &go)
+{
+    try {
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        CPU_SET(cpu, &mask);
+        sched_setaffinity(0, sizeof(mask), &mask);
+
+        std::unique_ptr<DrmDevice> own_drm;
+        std::unique_ptr<Channel> own_ch;
+        std::unique_ptr<PooledChannel> pooled;
+        DrmDevice *drm = &shared_drm;
+        Channel *ch = &shared_ch;
+
+        if (mode == CHANNEL_PER_THREAD) {
+            pooled.reset(new PooledChannel(pool->acquire()));
+            ch = &**pooled;
+        } else if (mode == FD_PER_THREAD) {
+            own_drm.reset(new DrmDevice);
+            own_ch.reset(new Channel(*own_drm));
+            drm = own_drm.get();
+            ch = own_ch.get();
+        }
+
+        uint32_t syncpt = ch->syncpoint(0);
+        std::vector<std::unique_ptr<GemBuffer>> cmdbufs(num_submits);
+
+        for (auto &bo : cmdbufs) {
+            bo.reset(new GemBuffer(*drm));
+
+            if (bo->allocate(4096))
+                throw std::runtime_error("Allocation failed");
+        }
+
+        Submit submit;
+        submit.push(host1x_opcode_nonincr(0, 1));
+        submit.push(platform.incrementSyncpointOp(syncpt));
+
+        submit.add_incr(syncpt, 1);
+
+        ready++;
+        while (!go)
+            std::this_thread::yield();
+
+        for (unsigned i = 0; i < num_batches; i++) {
+            drm_tegra_submit result;
+
+            for (unsigned k = 0; k < num_submits; k++) {
+                auto begin = std::chrono::steady_clock::now();
+
+                result = submit.submit(*ch, *cmdbufs[k]);
+
+                std::chrono::duration<double> elapsed =
+                    std::chrono::steady_clock::now() - begin;
+
+                worker.submit_time += elapsed.count();
+                worker.submits++;
+            }
+
+            wait_syncpoint(*drm, syncpt, result.fence, DRM_TEGRA_NO_TIMEOUT);
+        }
+    }
+    catch (...) {
+        worker.error = std::current_exception();
+        ready++;
+    }
+}
+
+/*
+ * Runs num_threads submitters concurrently, each pinned to its own CPU.
+ * Returns the aggregate number of submits per second.
+ */
+double submit_scaling_test(std::string& message, ScalingMode mode,
+                           unsigned num_threads, unsigned num_batches,
+                           unsigned num_submits, double single_rate)
+{
+    PooledChannel pooled = pool->acquire();
+    DrmDevice &drm = pooled.drm();
+    Channel &ch = *pooled;
+    std::vector<ScalingWorker> workers(num_threads);
+    std::atomic<unsigned> ready(0);
+    std::atomic<bool> go(false);
+    unsigned num_cpus = std::thread::hardware_concurrency() ?: 1;
+    unsigned i;
+
+    for (i = 0; i < num_threads; i++) {
+        workers[i].submit_time = 0;
+        workers[i].submits = 0;
+        workers[i].thread = std::thread(submit_scaling_worker,
+                                        std::ref(workers[i]), mode,
+                                        std::ref(drm), std::ref(ch),
+                                        i % num_cpus, num_batches,
+                                        num_submits, std::ref(ready),
+                                        std::ref(go));
+    }
+
+    while (ready != num_threads)
+        std::this_thread::yield();
+
+    auto begin = std::chrono::steady_clock::now();
+    go = true;
+
+    for (auto &worker : workers)
+        worker.thread.join();
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - begin;
+
+    for (auto &worker : workers)
+        if (worker.error)
+            std::rethrow_exception(worker.error);
+
+    double submit_time = 0, max_latency = 0;
+    unsigned submits = 0;
+
+    for (auto &worker : workers) {
+        double latency = worker.submit_time / worker.submits;
+
+        submit_time += worker.submit_time;
+        submits += worker.submits;
+        max_latency = std::max(max_latency, latency);
+    }
+
+    double rate = submits / elapsed.count();
+    double efficiency = single_rate ? rate / (single_rate * num_threads) : 1.0;
+    const char *mode_name =
+        mode == SHARED_CHANNEL ? "shared channel" :
+        mode == CHANNEL_PER_THREAD ? "channel/thread" : "fd/thread";
+    char buffer[256];
+
+    sprintf(buffer, "perf: %-14s %3u threads: %10.0f submits/sec, "
+                    "submit latency %f us avg %f us worst thread, "
+                    "scaling efficiency %3.0f%%\n",
+            mode_name, num_threads, rate,
+            submit_time / submits * 1000000, max_latency * 1000000,
+            efficiency * 100);
+
+    message += buffer;
+
+    const char *metric =
+        mode == SHARED_CHANNEL ? "shared_channel_rate" :
+        mode == CHANNEL_PER_THREAD ? "channel_per_thread_rate" :
+                                     "fd_per_thread_rate";
+
+    results.addValue(metric, { { "threads", num_threads },
+                               { "batches", num_batches },
+                               { "submits", num_submits } },
+                     rate, "submits/s", true);
+
+    return rate;
+}
+
+void test_submit_scaling(std::string& message) {
+    unsigned num_cpus = std::thread::hardware_concurrency() ?: 1;
+
+    for (auto mode : { SHARED_CHANNEL, CHANNEL_PER_THREAD, FD_PER_THREAD }) {
+        double single_rate = 0;
+
+        for (unsigned n = 1; ; n = std::min(n * 2, num_cpus)) {
+            double rate = submit_scaling_test(message, mode, n, 50, 50,
+                                              single_rate);
+            if (n == 1)
+                single_rate = rate;
+            if (n == num_cpus)
+                break;
+        }
+    }
+}
+
+/*
+ * Pipeline of jobs whose command stream is built on the CPU right before
+ * submission. With blocking waits the CPU idles while a job runs, with
+ * the fence engine it builds job N+1 while job N executes.
+ */
+void fence_engine_performance_test(std::string& message, unsigned num_jobs,
+                                   unsigned num_words)
+{
+    PooledChannel pooled = pool->acquire();
+    DrmDevice &drm = pooled.drm();
+    Channel &ch = *pooled;
+    FenceEngine engine(drm);
+    uint32_t syncpt = ch.syncpoint(0);
+    std::atomic<unsigned> completions(0);
+    unsigned fill = num_words - 3;
+    unsigned i, k;
+
+    if (num_words < 4)
+        throw std::runtime_error("Jobs need at least 4 words");
+
+    GemBuffer cmdbuf_a(drm), cmdbuf_b(drm);
+    GemBuffer *cmdbufs[2] = { &cmdbuf_a, &cmdbuf_b };
+
+    for (auto bo : cmdbufs)
+        if (bo->allocate(num_words * 4))
+            throw std::runtime_error("Allocation failed");
+
+    auto build_job = [&](Submit &submit) {
+        submit.push(host1x_opcode_nonincr(0x2b, fill));
+        for (k = 0; k < fill; k++)
+            submit.push(0xdeadbeef);
+        submit.push(host1x_opcode_nonincr(0, 1));
+        submit.push(platform.incrementSyncpointOp(syncpt));
+
+        submit.add_incr(syncpt, 1);
+    };
+
+    uint64_t begin = monotonic_ns();
+
+    for (i = 0; i < num_jobs; i++) {
+        Submit submit;
+        build_job(submit);
+
+        auto result = submit.submit(ch, *cmdbufs[i % 2]);
+        wait_syncpoint(drm, syncpt, result.fence, DRM_TEGRA_NO_TIMEOUT);
+    }
+
+    uint64_t blocking_ns = monotonic_ns() - begin;
+
+    std::shared_ptr<Fence> fences[2];
+
+    begin = monotonic_ns();
+
+    for (i = 0; i < num_jobs; i++) {
+        Submit submit;
+        build_job(submit);
+
+        /* The job before the previous one used the same cmdbuf */
+        if (fences[i % 2])
+            fences[i % 2]->wait();
+
+        auto result = submit.submit(ch, *cmdbufs[i % 2]);
+
+        fences[i % 2] = engine.track(syncpt, result.fence);
+        fences[i % 2]->then([&completions] { completions++; });
+    }
+
+    for (auto &fence : fences)
+        fence->wait();
+
+    /* wait() also covers the continuations, they're part of the cost */
+    uint64_t async_ns = monotonic_ns() - begin;
+
+    if (completions != num_jobs)
+        throw std::runtime_error("Fence continuations went missing");
+
+    char buffer[256];
+
+    sprintf(buffer, "perf: %5u words per job: blocking wait %9.0f jobs/sec, "
+                    "fence engine %9.0f jobs/sec (%u wakeups, %u waiters)\n",
+            num_words, num_jobs * 1e9 / blocking_ns,
+            num_jobs * 1e9 / async_ns, engine.wakeups(), engine.waiters());
+
+    message += buffer;
+
+    results.addValue("blocking_rate", { { "words", num_words } },
+                     num_jobs * 1e9 / blocking_ns, "jobs/s", true);
+    results.addValue("fence_engine_rate", { { "words", num_words } },
+                     num_jobs * 1e9 / async_ns, "jobs/s", true);
+}
+
+void test_fence_engine_performance(std::string& message) {
+    for (unsigned words : Options::pick(options.words, { 16, 64, 256, 1024, 4096 }))
+        fence_engine_performance_test(message, 2000, words);
+}
+
+/*
+ * CPU cost of assembling a typical fixed-shape job with the runtime
+ * opcode helpers against copying a compile-time template and patching
+ * its runtime slots. A repetition assembles num_jobs jobs.
+ */
+void test_cmdstream_template_performance(std::string& message) {
+    using namespace cmdstream;
+
+    typedef Stream<
+        SetClass<HOST1X_CLASS_GR2D, 0x09, 0x9, Value<0x0>, Value<0x1>>,
+        Incr<0x2b, Slot<1>, Value<0x40>, Value<0x100>, Value<0x100>>,
+        Nonincr<0x35, Slot<2>>,
+        Mask<0x40, 0x5, Value<0x11>, Value<0x22>>,
+        Imm<0x4c, 0x1234>,
+        SyncptIncr<0>> Job;
+
+    const unsigned num_jobs = 100000;
+    uint32_t words[Job::words];
+    uint32_t runtime_sum = 0, template_sum = 0;
+    uint32_t syncpt = 7;
+
+    auto runtime_jobs = [&](bool) {
+        uint64_t begin = monotonic_ns();
+        unsigned i, k;
+
+        runtime_sum = 0;
+
+        for (i = 0; i < num_jobs; i++) {
+            k = 0;
+            words[k++] = host1x_opcode_setclass(HOST1X_CLASS_GR2D, 0x09, 0x9);
+            words[k++] = 0x0;
+            words[k++] = 0x1;
+            words[k++] = host1x_opcode_incr(0x2b, 4);
+            words[k++] = i;
+            words[k++] = 0x40;
+            words[k++] = 0x100;
+            words[k++] = 0x100;
+            words[k++] = host1x_opcode_nonincr(0x35, 1);
+            words[k++] = i * 2;
+            words[k++] = (3 << 28) | (0x40 << 16) | 0x5;
+            words[k++] = 0x11;
+            words[k++] = 0x22;
+            words[k++] = (4 << 28) | (0x4c << 16) | 0x1234;
+            words[k++] = host1x_opcode_nonincr(0, 1);
+            words[k++] = platform.incrementSyncpointOp(syncpt);
+
+            runtime_sum += words[i % Job::words];
+        }
+
+        return double(monotonic_ns() - begin) / num_jobs;
+    };
+
+    Benchmark::Settings settings = benchmark_settings(5);
+    Estimate runtime_estimate = Benchmark::run(settings, runtime_jobs);
+    uint32_t runtime_words[Job::words];
+
+    memcpy(runtime_words, words, sizeof(words));
+
+    auto template_jobs = [&](bool) {
+        uint64_t begin = monotonic_ns();
+
+        template_sum = 0;
+
+        for (unsigned i = 0; i < num_jobs; i++) {
+            Job::emit(words);
+            Job::patch<0>(words, platform.incrementSyncpointOp(syncpt));
+            Job::patch<1>(words, i);
+            Job::patch<2>(words, i * 2);
+
+            template_sum += words[i % Job::words];
+        }
+
+        return double(monotonic_ns() - begin) / num_jobs;
+    };
+
+    Estimate template_estimate = Benchmark::run(settings, template_jobs);
+
+    if (memcmp(words, runtime_words, sizeof(words)) ||
+        runtime_sum != template_sum)
+        throw std::runtime_error("Template and runtime streams differ");
+
+    char buffer[512];
+
+    sprintf(buffer, "perf: %u word job, per job:\n"
+                    "perf:   runtime helpers: %s\n"
+                    "perf:   compile-time template: %s\n",
+            Job::words, runtime_estimate.summary(1, "ns").c_str(),
+            template_estimate.summary(1, "ns").c_str());
+
+    message += buffer;
+
+    Results::Params params = { { "words", double(Job::words) } };
+
+    results.addEstimate("runtime_build", params, runtime_estimate, "ns",
+                        false);
+    results.addEstimate("template_build", params, template_estimate, "ns",
+                        false);
+}
+
+/*
+ * Validation throughput on jobs shaped like the submit perf test ones.
+ * A repetition validates 8M words worth of jobs.
+ */
+void validator_performance_test(std::string& message, unsigned num_relocs,
+                                unsigned num_words)
+{
+    DrmDevice drm;
+    CmdbufValidator validator;
+    uint32_t syncpt = 1;
+    unsigned i;
+
+    GemBuffer target_bo(drm);
+    if (target_bo.allocate(4096))
+        throw std::runtime_error("Allocation failed");
+
+    validator.addBuffer(target_bo);
+
+    Submit submit;
+    for (i = 0; i < num_relocs; i++) {
+        submit.push(host1x_opcode_nonincr(0x2b, 1));
+        submit.push(0xdeadbeef);
+        submit.add_reloc(i * 8 + 4, target_bo.handle(), 0, 0);
+    }
+
+    unsigned fill = num_words - num_relocs * 2 - 3;
+
+    submit.push(host1x_opcode_incr(0x2b, fill));
+    for (i = 0; i < fill; i++)
+        submit.push(i);
+    submit.push(host1x_opcode_nonincr(0, 1));
+    submit.push(platform.incrementSyncpointOp(syncpt));
+
+    submit.add_incr(syncpt, 1);
+
+    unsigned num_jobs = (8 << 20) / num_words;
+
+    auto repetition = [&](bool) {
+        uint64_t begin = monotonic_ns();
+
+        for (unsigned k = 0; k < num_jobs; k++)
+            if (submit.validate(validator))
+                throw std::runtime_error("Valid job rejected");
+
+        return double(monotonic_ns() - begin) / num_jobs;
+    };
+
+    Estimate estimate = Benchmark::run(benchmark_settings(8), repetition);
+    char buffer[512];
+
+    sprintf(buffer, "perf: validating %5u words with %3u relocations, "
+                    "%.0f Mwords/sec, one job takes %s\n",
+            num_words, num_relocs, num_words * 1000 / estimate.mean,
+            estimate.summary(1000, "us").c_str());
+
+    message += buffer;
+
+    results.addEstimate("validate", { { "words", num_words },
+                                      { "relocs", num_relocs } },
+                        estimate, "ns", false);
+}
+
+void test_validator_performance(std::string& message) {
+    for (unsigned words : Options::pick(options.words,
+                                        { 64, 256, 1024, 4096, 16384 })) {
+        for (unsigned relocs : Options::pick(options.relocs, { 0, 21 })) {
+            /* The job must fit the relocs and a syncpoint increment */
+            if (relocs * 2 + 4 > words)
+                continue;
+
+            validator_performance_test(message, relocs, words);
+        }
+    }
+}
+
+/*
+ * Per-submit cost of resubmitting the same job with Submit::submit(),
+ * which recopies the stream and rebuilds the descriptors every time,
+ * against replaying a PreparedSubmit with one patched register value.
+ * With num_gathers > 1, both carry num_gathers - 1 gathers of a shared
+ * job incrementing the syncpoint, like in submit_performance_test().
+ */
+void prepared_submit_performance_test(std::string& message,
+                                      unsigned num_batches,
+                                      unsigned num_submits,
+                                      unsigned num_relocs,
+                                      unsigned num_gathers = 1)
+{
+    PooledChannel pooled = pool->acquire();
+    DrmDevice &drm = pooled.drm();
+    Channel &ch = *pooled;
+    uint32_t syncpt = ch.syncpoint(0);
+    unsigned i;
+
+    std::vector<std::unique_ptr<GemBuffer>> relocs(num_relocs);
+    std::vector<std::unique_ptr<GemBuffer>> cmdbufs(num_submits);
+    std::vector<std::unique_ptr<PreparedSubmit>> prepared(num_submits);
+    size_t cmdbuf_size = std::max<size_t>(4096, (num_relocs * 2 + 4) * 4);
+
+    for (auto &bo : relocs) {
+        bo.reset(new GemBuffer(drm));
+
+        if (bo->allocate(4096))
+            throw std::runtime_error("Allocation failed");
+    }
+
+    for (auto &bo : cmdbufs) {
+        bo.reset(new GemBuffer(drm));
+
+        if (bo->allocate(cmdbuf_size))
+            throw std::runtime_error("Allocation failed");
+    }
+
+    Submit submit;
+    for (i = 0; i < num_relocs; i++) {
+        submit.push(host1x_opcode_nonincr(0x2b, 1));
+        submit.push(0xdeadbeef);
+        submit.add_reloc(i * 8 + 4, relocs[i]->handle(), 0, 0);
+    }
+
+    size_t value_index = submit.words() + 1;
+
+    submit.push(host1x_opcode_nonincr(0x35, 1));
+    submit.push(0);
+    submit.push(host1x_opcode_nonincr(0, 1));
+    submit.push(platform.incrementSyncpointOp(syncpt));
+
+    submit.add_incr(syncpt, num_gathers);
+
+    GemBuffer job_bo(drm);
+    if (job_bo.allocate(4096))
+        throw std::runtime_error("Allocation failed");
+
+    uint32_t *job = static_cast<uint32_t *>(job_bo.map());
+    if (!job)
+        throw std::runtime_error("Mapping failed");
+
+    job[0] = host1x_opcode_nonincr(0, 1);
+    job[1] = platform.incrementSyncpointOp(syncpt);
+
+    for (i = 1; i < num_gathers; i++)
+        submit.add_gather(job_bo, 0, 2);
+
+    for (i = 0; i < num_submits; i++)
+        prepared[i].reset(new PreparedSubmit(ch, submit, *cmdbufs[i]));
+
+    LatencyHistogram submit_latency, prepared_latency;
+
+    /* One batch is a repetition, measuring ns per submit */
+    auto submit_batch = [&](bool warmup) {
+        drm_tegra_submit result;
+        uint64_t batch_ns = 0;
+
+        for (unsigned k = 0; k < num_submits; k++) {
+            uint64_t begin = monotonic_ns();
+
+            result = submit.submit(ch, *cmdbufs[k]);
+
+            uint64_t ns = monotonic_ns() - begin;
+
+            if (!warmup)
+                submit_latency.record(ns);
+
+            batch_ns += ns;
+        }
+
+        wait_syncpoint(drm, syncpt, result.fence, DRM_TEGRA_NO_TIMEOUT);
+
+        return double(batch_ns) / num_submits;
+    };
+
+    uint32_t value = 0;
+
+    auto prepared_batch = [&](bool warmup) {
+        drm_tegra_submit result;
+        uint64_t allocs = allocation_count();
+        uint64_t batch_ns = 0;
+
+        for (unsigned k = 0; k < num_submits; k++) {
+            uint64_t begin = monotonic_ns();
+
+            prepared[k]->patch(value_index, value++);
+            result = prepared[k]->submit();
+
+            uint64_t ns = monotonic_ns() - begin;
+
+            if (!warmup)
+                prepared_latency.record(ns);
+
+            batch_ns += ns;
+        }
+
+        wait_syncpoint(drm, syncpt, result.fence, DRM_TEGRA_NO_TIMEOUT);
+
+        /* The warm-up batch warms up the emulator */
+        if (!warmup)
+            check_no_allocations("PreparedSubmit replay", allocs);
+
+        return double(batch_ns) / num_submits;
+    };
+
+    Benchmark::Settings settings = benchmark_settings(num_batches, 1);
+    Estimate submit_estimate = Benchmark::run(settings, submit_batch);
+    Estimate prepared_estimate = Benchmark::run(settings, prepared_batch);
+
+    char buffer[256];
+
+    sprintf(buffer, "perf: %3u submits of %3u relocations, %2u gathers: "
+                    "Submit %f us, PreparedSubmit %f us per submit "
+                    "(p99 %f / %f us)\n",
+            unsigned(submit_latency.count()), num_relocs, num_gathers,
+            submit_latency.mean() / 1000, prepared_latency.mean() / 1000,
+            submit_latency.percentile(99) / 1000.0,
+            prepared_latency.percentile(99) / 1000.0);
+
+    message += buffer;
+
+    Results::Params params = { { "batches", num_batches },
+                               { "submits", num_submits },
+                               { "relocs", num_relocs },
+                               { "gathers", num_gathers } };
+
+    results.addLatency("submit", params, submit_latency);
+    results.addLatency("prepared_submit", params, prepared_latency);
+    results.addEstimate("submit_batch_mean", params, submit_estimate, "ns",
+                        false);
+    results.addEstimate("prepared_submit_batch_mean", params,
+                        prepared_estimate, "ns", false);
+}
+
+void test_prepared_submit_performance(std::string& message) {
+    for (unsigned i : Options::pick(options.relocs, DEFAULT_RELOCS))
+        for (const auto &shape : options.shapes({ { 30, 50 } }))
+            for (unsigned gathers : Options::pick(options.gathers, { 1, 4 }))
+                prepared_submit_performance_test(message, shape.batches,
+                                                 shape.submits, i, gathers);
+}
+
+/*
+ * Job rate with a freshly allocated cmdbuf BO and data BO per job against
+ * packing both into suballocated ranges of a few large BOs. A repetition
+ * submits num_jobs jobs and waits for the last one.
+ */
+void suballoc_performance_test(std::string& message, unsigned num_jobs,
+                               bool suballoc)
+{
+    PooledChannel pooled = pool->acquire();
+    DrmDevice &drm = pooled.drm();
+    Channel &ch = *pooled;
+    SubAllocator allocator(drm);
+    uint32_t syncpt = ch.syncpoint(0);
+    unsigned num_bos = 0, submitted = 0;
+
+    auto repetition = [&](bool) {
+        drm_tegra_submit result;
+        uint64_t begin = monotonic_ns();
+
+        for (unsigned i = 0; i < num_jobs; i++) {
+            Submit submit;
+            submit.push(host1x_opcode_nonincr(0x2b, 1));
+            submit.push(0xdeadbeef);
+            submit.push(host1x_opcode_nonincr(0, 1));
+            submit.push(platform.incrementSyncpointOp(syncpt));
+
+            submit.add_incr(syncpt, 1);
+
+            if (suballoc) {
+                auto data = allocator.allocate(256);
+                memset(data.ptr, 0, 256);
+
+                submit.add_reloc(4, data.bo->handle(), data.offset, 0);
+                result = submit.submit(ch, allocator);
+            } else {
+                GemBuffer data_bo(drm);
+                if (data_bo.allocate(256))
+                    throw std::runtime_error("Allocation failed");
+
+                void *ptr = data_bo.map();
+                if (!ptr)
+                    throw std::runtime_error("Mapping failed");
+
+                memset(ptr, 0, 256);
+
+                submit.add_reloc(4, data_bo.handle(), 0, 0);
+                result = submit.submit(ch);
+                num_bos += 2;
+            }
+        }
+
+        wait_syncpoint(drm, syncpt, result.fence, DRM_TEGRA_NO_TIMEOUT);
+
+        submitted += num_jobs;
+
+        return num_jobs * 1e9 / (monotonic_ns() - begin);
+    };
+
+    Estimate estimate = Benchmark::run(benchmark_settings(10), repetition);
+    char buffer[512];
+
+    if (suballoc)
+        num_bos = allocator.chunks();
+
+    sprintf(buffer, "perf: %u jobs with %s, %u GEM objects created, %s\n",
+            submitted, suballoc ? "suballocated ranges" : "BOs per job      ",
+            num_bos, estimate.summary(1000, "k jobs/s").c_str());
+
+    message += buffer;
+
+    results.addEstimate(suballoc ? "suballoc_rate" : "bo_per_job_rate",
+                        { { "jobs", num_jobs } },
+                        estimate, "jobs/s", true);
+}
+
+void test_suballoc_performance(std::string& message) {
+    suballoc_performance_test(message, 2000, false);
+    suballoc_performance_test(message, 2000, true);
+}
+
+/*
+ * Per-job cost of building and submitting a new job object with Submit,
+ * which allocates its vectors for every job, with InlineSubmit, and with
+ * one ArenaSubmit over caller buffers reset for every job. A batch is a
+ * repetition; the warm-up batches warm up the emulator and the C library,
+ * after them the latter two must not allocate at all.
+ */
+void arena_submit_performance_test(std::string& message, unsigned num_batches,
+                                   unsigned num_submits, unsigned num_relocs)
+{
+    PooledChannel pooled = pool->acquire();
+    DrmDevice &drm = pooled.drm();
+    Channel &ch = *pooled;
+    uint32_t syncpt = ch.syncpoint(0);
+
+    std::vector<std::unique_ptr<GemBuffer>> relocs(num_relocs);
+    std::vector<std::unique_ptr<GemBuffer>> cmdbufs(num_submits);
+
+    for (auto &bo : relocs) {
+        bo.reset(new GemBuffer(drm));
+
+        if (bo->allocate(4096))
+            throw std::runtime_error("Allocation failed");
+    }
+
+    for (auto &bo : cmdbufs) {
+        bo.reset(new GemBuffer(drm));
+
+        if (bo->allocate(4096))
+            throw std::runtime_error("Allocation failed");
+    }
+
+    auto build = [&](auto &submit) {
+        unsigned i = 0;
+
+        for (auto &bo : relocs) {
+            submit.push(host1x_opcode_nonincr(0x2b, 1));
+            submit.push(0xdeadbeef);
+            submit.add_reloc(i++ * 8 + 4, bo->handle(), 0, 0);
+        }
+        submit.push(host1x_opcode_nonincr(0, 1));
+        submit.push(platform.incrementSyncpointOp(syncpt));
+
+        submit.add_incr(syncpt, 1);
+    };
+
+    Benchmark::Settings settings = benchmark_settings(num_batches, 1);
+
+    /* Sums the allocations of the measured batches into allocs */
+    auto measure = [&](LatencyHistogram &latency, uint64_t &allocs,
+                       auto job) {
+        allocs = 0;
+
+        return Benchmark::run(settings, [&](bool warmup) {
+            drm_tegra_submit result;
+            uint64_t before = allocation_count();
+            uint64_t batch_ns = 0;
+
+            for (unsigned k = 0; k < num_submits; k++) {
+                uint64_t begin = monotonic_ns();
+
+                result = job(*cmdbufs[k]);
+
+                uint64_t ns = monotonic_ns() - begin;
+
+                if (!warmup)
+                    latency.record(ns);
+
+                batch_ns += ns;
+            }
+
+            wait_syncpoint(drm, syncpt, result.fence, DRM_TEGRA_NO_TIMEOUT);
+
+            if (!warmup)
+                allocs += allocation_count() - before;
+
+            return double(batch_ns) / num_submits;
+        });
+    };
+
+    LatencyHistogram vector_latency, inline_latency, arena_latency;
+    uint64_t vector_allocs, inline_allocs, arena_allocs;
+
+    Estimate vector_estimate = measure(vector_latency, vector_allocs,
+                                       [&](GemBuffer &bo) {
+        Submit submit;
+        build(submit);
+        return submit.submit(ch, bo);
+    });
+
+    Estimate inline_estimate = measure(inline_latency, inline_allocs,
+                                       [&](GemBuffer &bo) {
+        InlineSubmit<64, 32> submit;
+        build(submit);
+        return submit.submit(ch, bo);
+    });
+
+    std::vector<uint32_t> arena_words(num_relocs * 2 + 2);
+    std::vector<drm_tegra_reloc> arena_relocs(std::max(num_relocs, 1u));
+    ArenaSubmit arena(arena_words.data(), arena_words.size(),
+                      arena_relocs.data(), arena_relocs.size());
+
+    Estimate arena_estimate = measure(arena_latency, arena_allocs,
+                                      [&](GemBuffer &bo) {
+        arena.reset();
+        build(arena);
+        return arena.submit(ch, bo);
+    });
+
+    char buffer[1024];
+
+    sprintf(buffer, "perf: %u jobs of %3u relocations, Submit: %.1f "
+                    "allocations per job, one takes %s\n"
+                    "perf:   per batch: %s\n"
+                    "perf: %u jobs of %3u relocations, InlineSubmit: %.1f "
+                    "allocations per job, one takes %s\n"
+                    "perf:   per batch: %s\n"
+                    "perf: %u jobs of %3u relocations, ArenaSubmit: %.1f "
+                    "allocations per job, one takes %s\n"
+                    "perf:   per batch: %s\n",
+            unsigned(vector_latency.count()), num_relocs,
+            double(vector_allocs) / vector_latency.count(),
+            vector_latency.summary().c_str(),
+            vector_estimate.summary(1000, "us").c_str(),
+            unsigned(inline_latency.count()), num_relocs,
+            double(inline_allocs) / inline_latency.count(),
+            inline_latency.summary().c_str(),
+            inline_estimate.summary(1000, "us").c_str(),
+            unsigned(arena_latency.count()), num_relocs,
+            double(arena_allocs) / arena_latency.count(),
+            arena_latency.summary().c_str(),
+            arena_estimate.summary(1000, "us").c_str());
+
+    message += buffer;
+
+    Results::Params params = { { "batches", num_batches },
+                               { "submits", num_submits },
+                               { "relocs", num_relocs } };
+
+    results.addLatency("submit", params, vector_latency);
+    results.addLatency("inline_submit", params, inline_latency);
+    results.addLatency("arena_submit", params, arena_latency);
+    results.addEstimate("submit_batch_mean", params, vector_estimate, "ns",
+                        false);
+    results.addEstimate("inline_submit_batch_mean", params, inline_estimate,
+                        "ns", false);
+    results.addEstimate("arena_submit_batch_mean", params, arena_estimate,
+                        "ns", false);
+
+    if (inline_allocs)
+        throw std::runtime_error("InlineSubmit allocated in steady state");
+    if (arena_allocs)
+        throw std::runtime_error("ArenaSubmit allocated in steady state");
+}
+
+void test_arena_submit_performance(std::string& message) {
+    for (unsigned i : Options::pick(options.relocs, { 0, 9, 21 })) {
+        /* InlineSubmit<64, 32> holds up to 31 relocs and an increment */
+        if (i > 31) {
+            message += "perf: skipping " + std::to_string(i) +
+                       " relocations, more than an InlineSubmit holds\n";
+            continue;
+        }
+
+        for (const auto &shape : options.shapes({ { 20, 50 } }))
+            arena_submit_performance_test(message, shape.batches,
+                                          shape.submits, i);
+    }
+}
+
+/*
+ * Signal-to-wake latency of a waiter using the given strategy. Another
+ * thread, on another CPU where there is one, increments the syncpoint
+ * from the CPU delay_us after the waiter started waiting, standing in
+ * for a job of that length. The CPU time is what the waiter burned.
+ */
+void wait_latency_test(std::string& message, WaitStrategy strategy,
+                       unsigned spin_us, unsigned delay_us,
+                       unsigned num_waits)
+{
+    PooledChannel pooled = pool->acquire();
+    DrmDevice &drm = pooled.drm();
+    Channel &ch = *pooled;
+    uint32_t syncpt = ch.syncpoint(0);
+    std::atomic<unsigned> armed(0);
+    std::atomic<uint64_t> signal_time(0);
+    std::atomic<bool> abort(false);
+    std::exception_ptr error;
+    unsigned num_cpus = std::thread::hardware_concurrency() ?: 1;
+    int cpu = sched_getcpu();
+    int policy;
+    sched_param param;
+
+    /*
+     * Under --sched-fifo, the signaller gets a higher priority, so that
+     * it preempts a waiter spinning on the same CPU, as the hardware it
+     * stands in for would.
+     */
+    bool boosted = pthread_getschedparam(pthread_self(), &policy,
+                                         &param) == 0 &&
+                   policy == SCHED_FIFO &&
+                   param.sched_priority < sched_get_priority_max(SCHED_FIFO);
+
+    std::thread signaller([&] {
+        try {
+            if (num_cpus > 1 && cpu >= 0) {
+                cpu_set_t mask;
+                CPU_ZERO(&mask);
+                CPU_SET((cpu + 1) % num_cpus, &mask);
+                sched_setaffinity(0, sizeof(mask), &mask);
+            }
+
+            for (unsigned i = 1; i <= num_waits; i++) {
+                /* Boosted, yielding would never let the waiter run */
+                while (armed < i && !abort)
+                    if (boosted)
+                        std::this_thread::sleep_for(
+                            std::chrono::microseconds(10));
+                    else
+                        std::this_thread::yield();
+
+                if (abort)
+                    return;
+
+                std::this_thread::sleep_for(std::chrono::microseconds(delay_us));
+
+                signal_time = monotonic_ns();
+                increment_syncpoint(drm, syncpt);
+            }
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+    });
+
+    if (boosted) {
+        param.sched_priority++;
+        pthread_setschedparam(signaller.native_handle(), policy, &param);
+    }
+
+    LatencyHistogram latency;
+    uint64_t cpu_ns = 0, wall_ns = 0;
+
+    try {
+        uint32_t value = read_syncpoint(drm, syncpt);
+
+        for (unsigned i = 1; i <= num_waits; i++) {
+            uint64_t cpu_begin = thread_cpu_ns();
+            uint64_t begin = monotonic_ns();
+
+            armed = i;
+            value = wait_syncpoint(drm, syncpt, value + 1, 1000, strategy,
+                                   spin_us * 1000ull);
+
+            uint64_t end = monotonic_ns();
+
+            cpu_ns += thread_cpu_ns() - cpu_begin;
+            wall_ns += end - begin;
+            latency.record(end - signal_time);
+        }
+    }
+    catch (...) {
+        abort = true;
+        signaller.join();
+        throw;
+    }
+
+    signaller.join();
+
+    if (error)
+        std::rethrow_exception(error);
+
+    const char *name = strategy == WAIT_BLOCK ? "block" :
+                       strategy == WAIT_SPIN ? "spin" : "hybrid";
+    char buffer[512];
+
+    sprintf(buffer, "perf: %4u us jobs, %-6s %4s: CPU %7.2f us per wait "
+                    "(%3.0f%%), wake latency %s\n",
+            delay_us, name,
+            strategy == WAIT_HYBRID ? std::to_string(spin_us).c_str() : "",
+            cpu_ns / 1000.0 / num_waits, 100.0 * cpu_ns / wall_ns,
+            latency.summary().c_str());
+
+    message += buffer;
+
+    Results::Params params = { { "delay_us", delay_us },
+                               { "spin_us", spin_us } };
+
+    results.addLatency(std::string("wake_") + name, params, latency);
+    results.addValue(std::string("wait_cpu_") + name, params,
+                     double(cpu_ns) / num_waits, "ns", false);
+}
+
+void test_wait_strategy_performance(std::string& message) {
+    if (std::thread::hardware_concurrency() < 2)
+        message += "perf: single CPU, spinning competes with the signaller\n";
+
+    for (unsigned delay_us : { 20, 200 }) {
+        wait_latency_test(message, WAIT_BLOCK, 0, delay_us, 500);
+        wait_latency_test(message, WAIT_SPIN, 0, delay_us, 500);
+
+        for (unsigned spin_us : Options::pick(options.spin_budgets,
+                                              { 10, 50, 200 }))
+            wait_latency_test(message, WAIT_HYBRID, spin_us, delay_us, 500);
+    }
+}
+
+/*
+ * What a short-lived worker pays before its first submit: opening the
+ * device and a channel and looking up the channel syncpoint, against
+ * borrowing a channel from the pool and using its cached syncpoint ID.
+ */
+void test_channel_pool_performance(std::string& message) {
+    const unsigned iterations = 200;
+    LatencyHistogram device_open, channel_open, syncpt_query, syncpt_cached;
+    LatencyHistogram worker_setup, pool_acquire;
+    unsigned i;
+
+    for (i = 0; i < iterations; i++) {
+        uint64_t begin = monotonic_ns();
+        {
+            DrmDevice drm;
+        }
+        device_open.record(monotonic_ns() - begin);
+    }
+
+    for (i = 0; i < iterations; i++) {
+        uint64_t begin = monotonic_ns();
+        {
+            Channel ch(pool->drm());
+        }
+        channel_open.record(monotonic_ns() - begin);
+    }
+
+    {
+        PooledChannel ch = pool->acquire();
+
+        for (i = 0; i < iterations; i++) {
+            uint64_t begin = monotonic_ns();
+            ch->query_syncpoint(0);
+            syncpt_query.record(monotonic_ns() - begin);
+        }
+
+        for (i = 0; i < iterations; i++) {
+            uint64_t begin = monotonic_ns();
+            ch->syncpoint(0);
+            syncpt_cached.record(monotonic_ns() - begin);
+        }
+    }
+
+    for (i = 0; i < iterations; i++) {
+        uint64_t begin = monotonic_ns();
+        {
+            DrmDevice drm;
+            Channel ch(drm);
+            ch.syncpoint(0);
+        }
+        worker_setup.record(monotonic_ns() - begin);
+    }
+
+    for (i = 0; i < iterations; i++) {
+        uint64_t begin = monotonic_ns();
+        {
+            PooledChannel ch = pool->acquire();
+            ch->syncpoint(0);
+        }
+        pool_acquire.record(monotonic_ns() - begin);
+    }
+
+    const struct {
+        const char *metric;
+        const char *what;
+        const LatencyHistogram &latency;
+    } rows[] = {
+        { "device_open", "device open+close", device_open },
+        { "channel_open", "channel open+close", channel_open },
+        { "syncpt_query", "GET_SYNCPT", syncpt_query },
+        { "syncpt_cached", "cached syncpoint ID", syncpt_cached },
+        { "worker_setup", "device+channel+syncpoint", worker_setup },
+        { "pool_acquire", "pooled channel", pool_acquire },
+    };
+
+    for (const auto &row : rows) {
+        message += std::string("perf: ") + row.what + ": " +
+                   row.latency.summary() + "\n";
+
+        results.addLatency(row.metric, {}, row.latency);
+    }
+
+    message += "perf: " + std::to_string(pool->opened()) +
+               " channels opened by the pool so far\n";
+}
+
+enum PipelineMode {
+    PIPELINE_SERIAL,
+    PIPELINE_HOST_WAITS,
+    PIPELINE_HARDWARE_WAITS,
+};
+
+/*
+ * Frames going through a three stage pipeline, like decode, convert and
+ * composite, with the stages spread over the given engines. Serial
+ * submission completes every job before submitting the next one, the
+ * scheduler overlaps the stages of consecutive frames. A repetition runs
+ * num_frames frames through the same scheduler.
+ */
+void pipeline_performance_test(std::string& message, PipelineMode mode,
+                               const std::vector<uint32_t> &engines,
+                               unsigned num_frames)
+{
+    const unsigned num_stages = 3;
+    Scheduler scheduler(pool->drm());
+
+    unsigned frames = 0;
+
+    scheduler.setHardwareWaits(mode == PIPELINE_HARDWARE_WAITS);
+
+    auto repetition = [&](bool) {
+        uint64_t begin = monotonic_ns();
+
+        for (unsigned i = 0; i < num_frames; i++) {
+            Scheduler::JobId job = 0;
+
+            for (unsigned k = 0; k < num_stages; k++) {
+                uint32_t engine = engines[k % engines.size()];
+
+                /* Serial jobs have completed before the next one is added */
+                if (mode == PIPELINE_SERIAL) {
+                    scheduler.add(engine, {});
+                    scheduler.run();
+                } else if (k) {
+                    job = scheduler.add(engine, {}, { job });
+                } else {
+                    job = scheduler.add(engine, {});
+                }
+            }
+        }
+
+        scheduler.run();
+
+        frames += num_frames;
+
+        return num_frames * 1e9 / (monotonic_ns() - begin);
+    };
+
+    Estimate estimate = Benchmark::run(benchmark_settings(5), repetition);
+    const char *name = mode == PIPELINE_SERIAL ? "serial" :
+                       mode == PIPELINE_HOST_WAITS ? "host_waits" :
+                       "hardware_waits";
+    char buffer[512];
+
+    sprintf(buffer, "perf: %u frames, %u stages on %zu engines, %-14s: "
+                    "%u host waits%s, %s\n",
+            frames, num_stages, engines.size(), name,
+            scheduler.hostWaits(),
+            mode == PIPELINE_HARDWARE_WAITS && !scheduler.hardwareWaits() ?
+                " (hardware waits rejected)" : "",
+            estimate.summary(1000, "k frames/s").c_str());
+
+    message += buffer;
+
+    results.addEstimate(std::string("pipeline_") + name + "_rate",
+                        { { "frames", num_frames },
+                          { "engines", double(engines.size()) } },
+                        estimate, "frames/s", true);
+}
+
+void test_pipeline_performance(std::string& message) {
+    std::vector<uint32_t> engines;
+
+    for (uint32_t host1x_class : { HOST1X_CLASS_GR2D, HOST1X_CLASS_VIC,
+                                   HOST1X_CLASS_GR3D }) {
+        try {
+            Channel ch(pool->drm(), host1x_class);
+            engines.push_back(host1x_class);
+        }
+        catch (ioctl_error) {
+        }
+    }
+
+    if (engines.empty())
+        throw std::runtime_error("No engine available");
+
+    for (auto mode : { PIPELINE_SERIAL, PIPELINE_HOST_WAITS,
+                       PIPELINE_HARDWARE_WAITS })
+        pipeline_performance_test(message, mode, engines, 100);
+}
+
+/*
+ * Stand-in for the platform lookup the submit perf tests used to make
+ * for every job: an out-of-line call switching on the SoC.
+ */
+static __attribute__((noinline))
+uint32_t switch_increment_syncpoint_op(Platform::Soc soc, uint32_t syncpt)
+{
+    switch (soc) {
+    case Platform::Tegra20:
+    case Platform::Tegra30:
+    case Platform::Tegra114:
+    case Platform::Tegra124:
+    case Platform::Tegra210:
+        return syncpt | (1 << 8);
+    case Platform::Tegra186:
+    default:
+        return syncpt | (1 << 10);
+    }
+}
+
+/*
+ * Cost of emitting the job of the submit perf tests: word by word into
+ * a Submit reused across jobs, into an array with a switch on the SoC
+ * for the increment, as before the encodings were specialized, and with
+ * the emit_reloc_job() instantiation picked once for the SoC. The last
+ * has neither per-word capacity checks nor branches on the platform;
+ * both array variants must emit the same words. A repetition emits
+ * num_jobs jobs.
+ */
+void soc_emission_performance_test(std::string& message, unsigned num_relocs,
+                                   unsigned num_jobs)
+{
+    const size_t num_words = reloc_job_words(num_relocs);
+    std::vector<uint32_t> switch_words(num_words), template_words(num_words);
+    Platform::Soc soc = platform.soc();
+    uint32_t switch_sum = 0, template_sum = 0;
+    Submit submit;
+
+    auto push_jobs = [&](bool) {
+        uint64_t begin = thread_cpu_ns();
+        size_t pushed = 0;
+
+        for (unsigned i = 0; i < num_jobs; i++) {
+            submit.reset();
+
+            for (unsigned k = 0; k < num_relocs; k++) {
+                submit.push(host1x_opcode_nonincr(0x2b, 1));
+                submit.push(0xdeadbeef);
+            }
+            submit.push(host1x_opcode_nonincr(0, 1));
+            submit.push(switch_increment_syncpoint_op(soc, i & 0xff));
+
+            pushed += submit.words();
+        }
+
+        uint64_t elapsed = thread_cpu_ns() - begin;
+
+        if (pushed != num_jobs * num_words)
+            throw std::runtime_error("Submit emitted a wrong number of words");
+
+        return double(elapsed) / num_jobs;
+    };
+
+    auto switch_jobs = [&](bool) {
+        uint64_t begin = thread_cpu_ns();
+
+        switch_sum = 0;
+
+        for (unsigned i = 0; i < num_jobs; i++) {
+            uint32_t *words = switch_words.data();
+
+            for (unsigned k = 0; k < num_relocs; k++) {
+                *words++ = host1x_opcode_nonincr(0x2b, 1);
+                *words++ = 0xdeadbeef;
+            }
+            *words++ = host1x_opcode_nonincr(0, 1);
+            *words++ = switch_increment_syncpoint_op(soc, i & 0xff);
+
+            switch_sum += switch_words[i % num_words];
+        }
+
+        return double(thread_cpu_ns() - begin) / num_jobs;
+    };
+
+    Benchmark::Settings settings = benchmark_settings(5);
+    Estimate push_estimate = Benchmark::run(settings, push_jobs);
+    Estimate switch_estimate = Benchmark::run(settings, switch_jobs);
+    Estimate template_estimate;
+
+    with_soc(soc, [&](auto traits) {
+        template_estimate = Benchmark::run(settings, [&](bool) {
+            uint64_t begin = thread_cpu_ns();
+
+            template_sum = 0;
+
+            for (unsigned i = 0; i < num_jobs; i++) {
+                emit_reloc_job<decltype(traits)>(template_words.data(),
+                                                 num_relocs, i & 0xff);
+
+                template_sum += template_words[i % num_words];
+            }
+
+            return double(thread_cpu_ns() - begin) / num_jobs;
+        });
+    });
+
+    if (switch_sum != template_sum || switch_words != template_words)
+        throw std::runtime_error("SoC instantiation emitted other words");
+
+    char buffer[1024];
+
+    sprintf(buffer, "perf: %2u relocations, emitting a job takes %.2f ns "
+                    "per word specialized\n"
+                    "perf:   Submit::push: %s\n"
+                    "perf:   switching on the SoC: %s\n"
+                    "perf:   specialized: %s\n",
+            num_relocs, template_estimate.mean / num_words,
+            push_estimate.summary(1, "ns").c_str(),
+            switch_estimate.summary(1, "ns").c_str(),
+            template_estimate.summary(1, "ns").c_str());
+
+    message += buffer;
+
+    Results::Params params = { { "relocs", num_relocs } };
+
+    results.addEstimate("emit_push", params, push_estimate, "ns", false);
+    results.addEstimate("emit_switch", params, switch_estimate, "ns", false);
+    results.addEstimate("emit_specialized", params, template_estimate, "ns",
+                        false);
+}
+
+void test_soc_emission_performance(std::string& message) {
+    for (unsigned i : Options::pick(options.relocs, DEFAULT_RELOCS))
+        soc_emission_performance_test(message, i, 100000);
+}
+
+/* Tests timing the driver, as opposed to checking its behaviour */
+static bool is_benchmark(const std::string &name)
+{
+    const std::string suffix = "_performance";
+
+    if (name == "test_submit_scaling")
+        return true;
+
+    return name.size() > suffix.size() &&
+           !name.compare(name.size() - suffix.size(), suffix.size(), suffix);
+}
+
+/*
+ * Runs the soak requested on the command line as a test of its own, so
+ * that its windows end up in the results next to each other.
+ */
+static void run_soak()
+{
+    uint32_t seed = options.seed >= 0 ? options.seed : std::random_device()();
+
+    fprintf(stderr, "Soaking for %u sec in windows of %u sec, seed %u\n",
+            options.soak_seconds, options.soak_window_seconds, seed);
+
+    results.beginTest("soak");
+
+    try {
+        Soak soak(seed);
+
+        soak.run(options.soak_seconds, options.soak_window_seconds,
+                 [](const Soak::Window &window) {
+            Results::Params params = { { "window", window.index } };
+
+            fprintf(stderr, "%s", window.summary().c_str());
+
+            results.addValue("soak_rate", params, window.rate(),
+                             "jobs/s", true);
+            results.addLatency("soak_submit", params,
+                               window.submit_latency);
+            results.addLatency("soak_completion", params,
+                               window.completion_latency);
+            results.addValue("soak_recovery", params,
+                             window.recovery_seconds * 1000, "ms", false);
+            results.addValue("soak_gem_handles", params,
+                             window.gem_handles, "handles", false);
+            results.addValue("soak_rss", params, window.rss_kib,
+                             "KiB", false);
+        });
+
+        fprintf(stderr, "%s", soak.report().c_str());
+        results.endTest(!soak.failures(),
+                        soak.failures() ? "Unexpected outcomes" : "");
+    }
+    catch (std::runtime_error e) {
+        fprintf(stderr, "Soak failed: %s\n", e.what());
+        results.endTest(false, e.what());
+    }
+}
+
+int main(int argc, char **argv) {
+    fprintf(stderr, "host1x_test - Linux host1x driver test suite\n");
+
+    if (platform.initialize()) {
+        const char *name;
+        switch (platform.soc()) {
+            case Platform::Tegra20:
+                name = "Tegra20 [Tegra 2]";
+                break;
+            case Platform::Tegra30:
+                name = "Tegra30 [Tegra 3]";
+                break;
+            case Platform::Tegra114:
+                name = "Tegra114 [Tegra 4]";
+                break;
+            case Platform::Tegra124:
+                name = "Tegra124 [Tegra K1]";
+                break;
+            case Platform::Tegra210:
+                name = "Tegra210 [Tegra X1]";
+                break;
+            case Platform::Tegra186:
+                name = "Tegra186 [Tegra X2]";
+                break;
+        }
+
+        fprintf(stderr, "Platform: %s\n", name);
+        results.setSoc(name);
+    } else {
+        fprintf(stderr, "Failed to detect platform, defaulting to Tegra210\n");
+        platform.setSoc(Platform::Tegra210);
+        results.setSoc("unknown");
+    }
+
+    if (!parse_options(argc, argv, options))
+        return 1;
+
+    if (options.fake) {
+        fprintf(stderr, "Using software host1x emulator\n");
+        DrmDevice::setBackendFactory(FakeHost1x::create);
+    }
+
+    if (options.fake_job_time_us >= 0)
+        FakeHost1x::setJobTime(
+            std::chrono::microseconds(options.fake_job_time_us));
+
+    std::unique_ptr<TraceRecorder> recorder;
+
+    if (!options.record_path.empty()) {
+        try {
+            recorder.reset(new TraceRecorder(options.record_path));
+        }
+        catch (std::runtime_error e) {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+        DrmDevice::setTraceRecorder(recorder.get());
+    }
+
+    if (!options.replay_path.empty()) {
+        try {
+            TraceReplay replay(options.replay_path);
+
+            fprintf(stderr, "Replaying %s\n", options.replay_path.c_str());
+            replay.run(options.replay_original_speed);
+            fprintf(stderr, "%s", replay.report().c_str());
+        }
+        catch (std::runtime_error e) {
+            fprintf(stderr, "Replay failed: %s\n", e.what());
+            return 1;
+        }
+
+        return 0;
+    }
+
+    struct TestCase {
+        const char *name;
+        void (*func)(std::string& message);
+    };
+    std::vector<TestCase> tests;
+
+#define PUSH_TEST(name) tests.push_back({ #name, name })
+    PUSH_TEST(test_submit_wait);
+    PUSH_TEST(test_submit_timeout);
+    PUSH_TEST(test_invalid_cmdbuf);
+    PUSH_TEST(test_invalid_reloc);
+    PUSH_TEST(test_validator);
+    PUSH_TEST(test_submit_performance);
+    PUSH_TEST(test_channel_submit_performance);
+    PUSH_TEST(test_cmdbuf_builder_performance);
+    PUSH_TEST(test_bo_cache_performance);
+    PUSH_TEST(test_cmdbuf_ring_performance);
+    PUSH_TEST(test_submit_scaling);
+    PUSH_TEST(test_fence_engine_performance);
+    PUSH_TEST(test_cmdstream_template_performance);
+    PUSH_TEST(test_validator_performance);
+    PUSH_TEST(test_prepared_submit_performance);
+    PUSH_TEST(test_suballoc_performance);
+    PUSH_TEST(test_arena_submit_performance);
+    PUSH_TEST(test_wait_strategy_performance);
+    PUSH_TEST(test_channel_pool_performance);
+    PUSH_TEST(test_pipeline_performance);
+    PUSH_TEST(test_soc_emission_performance);
+
+    if (options.list) {
+        for (const auto &test : tests)
+            printf("%s\n", test.name);
+        return 0;
+    }
+
+    std::vector<TestCase> selected;
+    bool benchmarking = options.soak_seconds;
+
+    /* A soak runs instead of the tests */
+    for (unsigned i = 0; i < options.iterations && !options.soak_seconds; i++) {
+        for (const auto &test : tests) {
+            if (!options.selected(test.name))
+                continue;
+
+            selected.push_back(test);
+
+            if (is_benchmark(test.name))
+                benchmarking = true;
+        }
+    }
+
+    if (selected.empty() && !options.soak_seconds) {
+        fprintf(stderr, "No test matches the given names\n");
+        return 1;
+    }
+
+    /* Put back by the destructor when main() returns */
+    std::unique_ptr<BenchmarkEnvironment> environment;
+
+    /* Functional tests run on the machine as it is */
+    if (benchmarking) {
+        /* Keep the process, and the threads it creates, on a single CPU */
+        if (options.cpu >= 0) {
+            cpu_set_t mask;
+            CPU_ZERO(&mask);
+            CPU_SET(options.cpu, &mask);
+
+            if (sched_setaffinity(0, sizeof(mask), &mask) != 0)
+                fprintf(stderr, "Binding to CPU%d failed!\n", options.cpu);
+        }
+
+        environment.reset(new BenchmarkEnvironment(options.governor,
+                                                   options.fifo_priority,
+                                                   options.lock_memory));
+
+        environment->measureLoad(250);
+        environment->measureJitter(100);
+        environment->record(results);
+
+        fprintf(stderr, "%s", environment->report().c_str());
+    }
+
+    try {
+        pool.reset(new ChannelPool);
+    }
+    catch (std::runtime_error e) {
+        fprintf(stderr, "Opening the device failed: %s\n", e.what());
+        return 1;
+    }
+
+    if (options.soak_seconds)
+        run_soak();
+
+    for (const auto &test : selected) {
+        fprintf(stderr, "- %-40s ", test.name);
+        results.beginTest(test.name);
+        try {
+            std::string message;
+            (test.func)(message);
+            fprintf(stderr, "PASSED\n%s", message.c_str());
+            results.endTest(true, "");
+        }
+        catch (ioctl_error e) {
+            fprintf(stderr, "FAILED\n");
+            fprintf(stderr, "  Reason: %s\n", e.what());
             fprintf(stderr, "  IOCTL error: %d (%s)\n", e.error, strerror(e.error));
+            results.endTest(false, std::string(e.what()) + ": " +
+                                   strerror(e.error));
         }
         catch (std::runtime_error e) {
             fprintf(stderr, "FAILED\n");
             fprintf(stderr, "  Reason: %s\n", e.what());
+            results.endTest(false, e.what());
+        }
+    }
+
+    pool.reset();
+
+    if (recorder) {
+        DrmDevice::setTraceRecorder(nullptr);
+        fprintf(stderr, "Recorded %llu calls\n",
+                (unsigned long long)recorder->records());
+    }
+
+    unsigned regressions = 0;
+
+    try {
+        if (!options.json_path.empty())
+            results.writeJson(options.json_path);
+        if (!options.csv_path.empty())
+            results.writeCsv(options.csv_path);
+
+        if (!options.baseline_path.empty()) {
+            std::string report;
+
+            regressions = results.compare(options.baseline_path,
+                                          0.05, report);
+            fprintf(stderr, "%s", report.c_str());
         }
     }
+    catch (std::runtime_error e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
 
-    return 0;
+    return regressions ? 2 : 0;
 }
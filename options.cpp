@@ -0,0 +1,457 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "options.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include <fnmatch.h>
+#include <getopt.h>
+#include <sched.h>
+
+namespace {
+
+enum {
+    OPT_FAKE = 256,
+    OPT_FAKE_JOB_TIME,
+    OPT_RECORD,
+    OPT_REPLAY,
+    OPT_REPLAY_SPEED,
+    OPT_JSON,
+    OPT_CSV,
+    OPT_COMPARE,
+    OPT_LIST,
+    OPT_ITERATIONS,
+    OPT_CPU,
+    OPT_COUNTERS,
+    OPT_GOVERNOR,
+    OPT_SCHED_FIFO,
+    OPT_MLOCK,
+    OPT_RELOCS,
+    OPT_BATCHES,
+    OPT_SUBMITS,
+    OPT_GATHERS,
+    OPT_WORDS,
+    OPT_SPIN_BUDGET,
+    OPT_WARMUP,
+    OPT_MIN_REPS,
+    OPT_MAX_REPS,
+    OPT_TARGET_ERROR,
+    OPT_SOAK,
+    OPT_SOAK_WINDOW,
+    OPT_SEED,
+    OPT_HELP,
+};
+
+const struct option long_options[] = {
+    { "fake",          no_argument,       nullptr, OPT_FAKE },
+    { "fake-job-time", required_argument, nullptr, OPT_FAKE_JOB_TIME },
+    { "record",        required_argument, nullptr, OPT_RECORD },
+    { "replay",        required_argument, nullptr, OPT_REPLAY },
+    { "replay-speed",  required_argument, nullptr, OPT_REPLAY_SPEED },
+    { "json",          required_argument, nullptr, OPT_JSON },
+    { "csv",           required_argument, nullptr, OPT_CSV },
+    { "compare",       required_argument, nullptr, OPT_COMPARE },
+    { "list",          no_argument,       nullptr, OPT_LIST },
+    { "iterations",    required_argument, nullptr, OPT_ITERATIONS },
+    { "cpu",           required_argument, nullptr, OPT_CPU },
+    { "counters",      no_argument,       nullptr, OPT_COUNTERS },
+    { "governor",      required_argument, nullptr, OPT_GOVERNOR },
+    { "sched-fifo",    optional_argument, nullptr, OPT_SCHED_FIFO },
+    { "mlock",         no_argument,       nullptr, OPT_MLOCK },
+    { "relocs",        required_argument, nullptr, OPT_RELOCS },
+    { "batches",       required_argument, nullptr, OPT_BATCHES },
+    { "submits",       required_argument, nullptr, OPT_SUBMITS },
+    { "gathers",       required_argument, nullptr, OPT_GATHERS },
+    { "words",         required_argument, nullptr, OPT_WORDS },
+    { "spin-budget",   required_argument, nullptr, OPT_SPIN_BUDGET },
+    { "warmup",        required_argument, nullptr, OPT_WARMUP },
+    { "min-reps",      required_argument, nullptr, OPT_MIN_REPS },
+    { "max-reps",      required_argument, nullptr, OPT_MAX_REPS },
+    { "target-error",  required_argument, nullptr, OPT_TARGET_ERROR },
+    { "soak",          required_argument, nullptr, OPT_SOAK },
+    { "soak-window",   required_argument, nullptr, OPT_SOAK_WINDOW },
+    { "seed",          required_argument, nullptr, OPT_SEED },
+    { "help",          no_argument,       nullptr, OPT_HELP },
+    { nullptr,         0,                 nullptr, 0 },
+};
+
+bool parse_unsigned(const std::string &str, unsigned &value)
+{
+    char *end;
+
+    if (str.empty())
+        return false;
+
+    unsigned long v = strtoul(str.c_str(), &end, 0);
+    if (*end || v > 0xffffffffu)
+        return false;
+
+    value = v;
+
+    return true;
+}
+
+/* Caps a range, so that a typo can't make the sweep endless */
+const size_t MAX_RANGE_VALUES = 4096;
+
+/* Returns nullptr or the reason the range is invalid */
+const char *parse_range(const char *str, std::vector<unsigned> &values)
+{
+    std::stringstream items(str);
+    std::string item;
+
+    values.clear();
+
+    while (std::getline(items, item, ',')) {
+        std::stringstream parts(item);
+        std::string first, last, step;
+        unsigned a, b, s = 1;
+        bool geometric = false;
+
+        std::getline(parts, first, ':');
+        if (!parse_unsigned(first, a))
+            return "not a number";
+
+        if (!std::getline(parts, last, ':')) {
+            values.push_back(a);
+            continue;
+        }
+
+        if (!parse_unsigned(last, b))
+            return "not a number";
+        if (b < a)
+            return "range ends before it starts";
+
+        if (std::getline(parts, step, ':')) {
+            geometric = step[0] == '*';
+            if (!parse_unsigned(step.substr(geometric), s))
+                return "not a number";
+            if (s < (geometric ? 2u : 1u))
+                return geometric ? "factor must be at least 2" :
+                                   "step must be at least 1";
+            /* Multiplying would never leave 0 */
+            if (geometric && a == 0)
+                return "geometric range can't start at 0, list 0 separately";
+        }
+
+        for (uint64_t v = a; v <= b; v = geometric ? v * s : v + s) {
+            if (values.size() == MAX_RANGE_VALUES)
+                return "too many values";
+            values.push_back(v);
+        }
+    }
+
+    if (values.empty())
+        return "empty range";
+
+    return nullptr;
+}
+
+} // anonymous namespace
+
+Options::Options()
+: fake(false)
+, fake_job_time_us(-1)
+, replay_original_speed(false)
+, list(false)
+, iterations(1)
+, cpu(0)
+, counters(false)
+, governor("performance")
+, fifo_priority(0)
+, lock_memory(false)
+, warmup(2)
+, min_repetitions(0)
+, max_repetitions(200)
+, target_error(0.02)
+, soak_seconds(0)
+, soak_window_seconds(10)
+, seed(-1)
+{
+}
+
+bool Options::selected(const std::string &test) const
+{
+    if (tests.empty())
+        return true;
+
+    /* "submit_performance" matches test_submit_performance */
+    std::string short_name = test.compare(0, 5, "test_") ? test
+                                                          : test.substr(5);
+
+    for (const auto &glob : tests)
+        if (!fnmatch(glob.c_str(), test.c_str(), 0) ||
+            !fnmatch(glob.c_str(), short_name.c_str(), 0))
+            return true;
+
+    return false;
+}
+
+std::vector<Shape> Options::shapes(std::initializer_list<Shape> defaults) const
+{
+    if (batches.empty() && submits.empty())
+        return defaults;
+
+    std::vector<Shape> shapes;
+
+    for (unsigned b : pick(batches, { 30 }))
+        for (unsigned s : pick(submits, { 50 }))
+            shapes.push_back({ b, s });
+
+    return shapes;
+}
+
+std::vector<unsigned> Options::pick(const std::vector<unsigned> &values,
+                                    std::initializer_list<unsigned> defaults)
+{
+    if (values.empty())
+        return defaults;
+
+    return values;
+}
+
+void print_usage(const char *argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [OPTION]... [TEST_GLOB]...\n"
+            "Runs the tests matching any of the globs, e.g. '*perf*' or\n"
+            "submit_wait, or all of them.\n"
+            "\n"
+            "  --fake                  use the software host1x emulator\n"
+            "  --fake-job-time=US      emulated execution time of a job\n"
+            "  --list                  list the tests and exit\n"
+            "  --iterations=N          run every selected test N times\n"
+            "  --cpu=N|none            CPU to pin perf tests and soaks to (0)\n"
+            "  --counters              report perf counters per submit and\n"
+            "                          wait in the submit perf tests\n"
+            "  --governor=NAME|keep    cpufreq governor of all CPUs during\n"
+            "                          perf tests and soaks (performance)\n"
+            "  --sched-fifo[=PRIO]     run with SCHED_FIFO priority (50)\n"
+            "  --mlock                 lock and pre-fault memory\n"
+            "  --relocs=RANGE          relocations per job in submit sweeps\n"
+            "  --batches=RANGE         batches per submit sweep point\n"
+            "  --submits=RANGE         submits per batch\n"
+            "  --gathers=RANGE         gathers per submit\n"
+            "  --words=RANGE           command buffer words per job\n"
+            "  --spin-budget=RANGE     polling budgets of hybrid syncpoint\n"
+            "                          waits in microseconds\n"
+            "  --warmup=N              repetitions of a measurement thrown\n"
+            "                          away first (2)\n"
+            "  --min-reps=N            repetitions to run at least\n"
+            "  --max-reps=N            repetitions to run at most (200)\n"
+            "  --target-error=PERCENT  repeat until the 95%% confidence\n"
+            "                          interval of the mean is within\n"
+            "                          PERCENT of it (2)\n"
+            "  --soak=SEC              run randomized valid and invalid\n"
+            "                          jobs for SEC seconds instead of the\n"
+            "                          tests, reporting every window\n"
+            "  --soak-window=SEC       length of a soak window (10), each\n"
+            "                          includes a job that times out\n"
+            "  --seed=N                seed of the soak jobs\n"
+            "  --record=TRACE          record the ioctls of the run\n"
+            "  --replay=TRACE          replay a trace instead of testing\n"
+            "  --replay-speed=original|max\n"
+            "  --json=FILE             write the results as JSON\n"
+            "  --csv=FILE              write the results as CSV\n"
+            "  --compare=BASELINE_CSV  report changes against a baseline,\n"
+            "                          exit with 2 on regressions\n"
+            "\n"
+            "RANGE is a comma separated list of N, FIRST:LAST,\n"
+            "FIRST:LAST:STEP or FIRST:LAST:*FACTOR, e.g. 0:21:3,64,128.\n",
+            argv0);
+}
+
+bool parse_options(int argc, char **argv, Options &options)
+{
+    int opt, index;
+    unsigned value;
+
+    while ((opt = getopt_long(argc, argv, "", long_options,
+                              &index)) != -1) {
+        std::vector<unsigned> *range = nullptr;
+        bool nonzero = false;
+
+        switch (opt) {
+        case OPT_FAKE:
+            options.fake = true;
+            break;
+        case OPT_FAKE_JOB_TIME:
+            if (!parse_unsigned(optarg, value))
+                goto bad_value;
+            options.fake_job_time_us = value;
+            break;
+        case OPT_RECORD:
+            options.record_path = optarg;
+            break;
+        case OPT_REPLAY:
+            options.replay_path = optarg;
+            break;
+        case OPT_REPLAY_SPEED:
+            if (!strcmp(optarg, "original"))
+                options.replay_original_speed = true;
+            else if (!strcmp(optarg, "max"))
+                options.replay_original_speed = false;
+            else
+                goto bad_value;
+            break;
+        case OPT_JSON:
+            options.json_path = optarg;
+            break;
+        case OPT_CSV:
+            options.csv_path = optarg;
+            break;
+        case OPT_COMPARE:
+            options.baseline_path = optarg;
+            break;
+        case OPT_LIST:
+            options.list = true;
+            break;
+        case OPT_ITERATIONS:
+            if (!parse_unsigned(optarg, value) || !value)
+                goto bad_value;
+            options.iterations = value;
+            break;
+        case OPT_CPU:
+            if (!strcmp(optarg, "none"))
+                options.cpu = -1;
+            else if (parse_unsigned(optarg, value) && value < CPU_SETSIZE)
+                options.cpu = value;
+            else
+                goto bad_value;
+            break;
+        case OPT_COUNTERS:
+            options.counters = true;
+            break;
+        case OPT_GOVERNOR:
+            options.governor = strcmp(optarg, "keep") ? optarg : "";
+            break;
+        case OPT_SCHED_FIFO:
+            options.fifo_priority = 50;
+            if (optarg) {
+                if (!parse_unsigned(optarg, value) || value < 1 ||
+                    value > 99)
+                    goto bad_value;
+                options.fifo_priority = value;
+            }
+            break;
+        case OPT_MLOCK:
+            options.lock_memory = true;
+            break;
+        case OPT_RELOCS:
+            range = &options.relocs;
+            break;
+        case OPT_BATCHES:
+            range = &options.batches;
+            nonzero = true;
+            break;
+        case OPT_SUBMITS:
+            range = &options.submits;
+            nonzero = true;
+            break;
+        case OPT_GATHERS:
+            range = &options.gathers;
+            break;
+        case OPT_WORDS:
+            range = &options.words;
+            break;
+        case OPT_SPIN_BUDGET:
+            range = &options.spin_budgets;
+            break;
+        case OPT_WARMUP:
+            if (!parse_unsigned(optarg, value))
+                goto bad_value;
+            options.warmup = value;
+            break;
+        case OPT_MIN_REPS:
+            if (!parse_unsigned(optarg, value) || !value)
+                goto bad_value;
+            options.min_repetitions = value;
+            break;
+        case OPT_MAX_REPS:
+            if (!parse_unsigned(optarg, value) || !value)
+                goto bad_value;
+            options.max_repetitions = value;
+            break;
+        case OPT_TARGET_ERROR: {
+            char *end;
+            double percent = strtod(optarg, &end);
+
+            if (*end || !(percent > 0))
+                goto bad_value;
+            options.target_error = percent / 100;
+            break;
+        }
+        case OPT_SOAK:
+            if (!parse_unsigned(optarg, value) || !value)
+                goto bad_value;
+            options.soak_seconds = value;
+            break;
+        case OPT_SOAK_WINDOW:
+            if (!parse_unsigned(optarg, value) || !value)
+                goto bad_value;
+            options.soak_window_seconds = value;
+            break;
+        case OPT_SEED:
+            if (!parse_unsigned(optarg, value))
+                goto bad_value;
+            options.seed = value;
+            break;
+        default:
+            print_usage(argv[0]);
+            return false;
+        }
+
+        if (range) {
+            const char *err = parse_range(optarg, *range);
+
+            /* A batch needs a submit to wait for */
+            if (!err && nonzero &&
+                std::find(range->begin(), range->end(), 0u) != range->end())
+                err = "must be at least 1";
+
+            if (err) {
+                fprintf(stderr, "%s: invalid range '%s' for --%s: %s\n",
+                        argv[0], optarg, long_options[index].name, err);
+                return false;
+            }
+        }
+
+        continue;
+
+bad_value:
+        fprintf(stderr, "%s: invalid value '%s' for --%s\n", argv[0], optarg,
+                long_options[index].name);
+        return false;
+    }
+
+    for (int i = optind; i < argc; i++)
+        options.tests.push_back(argv[i]);
+
+    return true;
+}
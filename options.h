@@ -0,0 +1,110 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+/* Batch shape of the submit perf sweeps */
+struct Shape {
+    unsigned batches;
+    unsigned submits;
+};
+
+/*
+ * Command line of host1x_test. Empty sweep lists mean the defaults of
+ * each test, so a test only follows the dimensions it was asked to
+ * change.
+ */
+struct Options {
+    Options();
+
+    bool fake;
+    int fake_job_time_us;
+    std::string record_path;
+    std::string replay_path;
+    bool replay_original_speed;
+    std::string json_path;
+    std::string csv_path;
+    std::string baseline_path;
+
+    /* Globs of the tests to run; all of them if empty */
+    std::vector<std::string> tests;
+    bool list;
+    unsigned iterations;
+    /* CPU to pin the process to, -1 for no pinning */
+    int cpu;
+    /* Sample perf counters around submits and waits */
+    bool counters;
+    /* cpufreq governor of every CPU during the run, empty to keep */
+    std::string governor;
+    /* SCHED_FIFO priority, 0 to keep the scheduling policy */
+    int fifo_priority;
+    bool lock_memory;
+
+    std::vector<unsigned> relocs;
+    std::vector<unsigned> batches;
+    std::vector<unsigned> submits;
+    std::vector<unsigned> gathers;
+    std::vector<unsigned> words;
+    /* Polling budgets of hybrid syncpoint waits in microseconds */
+    std::vector<unsigned> spin_budgets;
+
+    /*
+     * Repetitions of the measurements made with Benchmark: the minimum
+     * is the test's own, e.g. its batches, unless given.
+     */
+    unsigned warmup;
+    unsigned min_repetitions;
+    unsigned max_repetitions;
+    /* Relative half-width of the 95% confidence interval to reach */
+    double target_error;
+
+    /* Run a randomized soak of that many seconds instead of the tests */
+    unsigned soak_seconds;
+    unsigned soak_window_seconds;
+    /* Seed of the soak jobs, -1 for a random one */
+    long seed;
+
+    bool selected(const std::string &test) const;
+
+    /* Batches x submits if either was given, the defaults otherwise */
+    std::vector<Shape> shapes(std::initializer_list<Shape> defaults) const;
+
+    static std::vector<unsigned> pick(const std::vector<unsigned> &values,
+                                      std::initializer_list<unsigned> defaults);
+};
+
+/*
+ * Returns false after printing the reason for a bad command line.
+ * Ranges are comma separated lists of N, FIRST:LAST (step 1),
+ * FIRST:LAST:STEP or FIRST:LAST:*FACTOR, e.g. "0:21:3,64,128".
+ */
+bool parse_options(int argc, char **argv, Options &options);
+
+void print_usage(const char *argv0);
+
+#endif // OPTIONS_H
@@ -0,0 +1,267 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "perf_counters.h"
+#include "gem.h"
+#include "util.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+const char *TRACEFS_PATHS[] = {
+    "/sys/kernel/tracing",
+    "/sys/kernel/debug/tracing",
+};
+
+int tracepoint_id(const char *event)
+{
+    for (const char *tracefs : TRACEFS_PATHS) {
+        try {
+            std::string path = std::string(tracefs) + "/events/" + event +
+                               "/id";
+
+            return std::stoi(read_file(path));
+        }
+        catch (...) {
+        }
+    }
+
+    return -1;
+}
+
+int perf_event_open(perf_event_attr *attr, int group_fd)
+{
+    return syscall(__NR_perf_event_open, attr, 0, -1, group_fd,
+                   PERF_FLAG_FD_CLOEXEC);
+}
+
+} // anonymous namespace
+
+PerfCounters::PerfCounters()
+: _group_size(0)
+, _leader(-1)
+, _calls(0)
+, _ioctls_begin(0)
+, _context_switches(0)
+, _page_faults(0)
+, _ioctls(0)
+{
+    for (unsigned i = 0; i < NUM_COUNTERS; i++) {
+        _sources[i] = UNAVAILABLE;
+        _fds[i] = -1;
+    }
+
+    if (open(CYCLES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES))
+        _sources[CYCLES] = HARDWARE;
+    else if (open(CYCLES, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK))
+        _sources[CYCLES] = SOFTWARE;
+
+    if (open(INSTRUCTIONS, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS))
+        _sources[INSTRUCTIONS] = HARDWARE;
+
+    if (open(CACHE_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES))
+        _sources[CACHE_MISSES] = HARDWARE;
+
+    if (open(CONTEXT_SWITCHES, PERF_TYPE_SOFTWARE,
+             PERF_COUNT_SW_CONTEXT_SWITCHES))
+        _sources[CONTEXT_SWITCHES] = SOFTWARE;
+    else
+        _sources[CONTEXT_SWITCHES] = FALLBACK;
+
+    if (open(PAGE_FAULTS, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS))
+        _sources[PAGE_FAULTS] = SOFTWARE;
+    else
+        _sources[PAGE_FAULTS] = FALLBACK;
+
+    int sys_enter = tracepoint_id("raw_syscalls/sys_enter");
+
+    if (sys_enter >= 0 && open(SYSCALLS, PERF_TYPE_TRACEPOINT, sys_enter))
+        _sources[SYSCALLS] = SOFTWARE;
+    else
+        _sources[SYSCALLS] = FALLBACK;
+}
+
+PerfCounters::~PerfCounters()
+{
+    for (int fd : _fds)
+        if (fd >= 0)
+            close(fd);
+}
+
+bool PerfCounters::open(Counter counter, uint32_t type, uint64_t config)
+{
+    perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = _leader < 0;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    int fd = perf_event_open(&attr, _leader);
+
+    /* perf_event_paranoid >= 2 only allows counting user space */
+    if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+        attr.exclude_kernel = 1;
+        fd = perf_event_open(&attr, _leader);
+    }
+
+    if (fd < 0)
+        return false;
+
+    if (_leader < 0)
+        _leader = fd;
+
+    _fds[counter] = fd;
+    _group_index[counter] = _group_size++;
+
+    return true;
+}
+
+void PerfCounters::start()
+{
+    getrusage(RUSAGE_THREAD, &_rusage_begin);
+    _ioctls_begin = DrmDevice::ioctlCount();
+
+    if (_leader >= 0)
+        ioctl(_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void PerfCounters::stop()
+{
+    if (_leader >= 0)
+        ioctl(_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    _ioctls += DrmDevice::ioctlCount() - _ioctls_begin;
+
+    struct rusage end;
+    getrusage(RUSAGE_THREAD, &end);
+
+    _context_switches += end.ru_nvcsw + end.ru_nivcsw -
+                         _rusage_begin.ru_nvcsw - _rusage_begin.ru_nivcsw;
+    _page_faults += end.ru_minflt + end.ru_majflt -
+                    _rusage_begin.ru_minflt - _rusage_begin.ru_majflt;
+
+    _calls++;
+}
+
+const char * PerfCounters::name(Counter counter) const
+{
+    switch (counter) {
+    case CYCLES:
+        return _sources[CYCLES] == SOFTWARE ? "task-clock-ns" : "cycles";
+    case INSTRUCTIONS:
+        return "instructions";
+    case CACHE_MISSES:
+        return "cache-misses";
+    case CONTEXT_SWITCHES:
+        return "context-switches";
+    case PAGE_FAULTS:
+        return "page-faults";
+    case SYSCALLS:
+        return _sources[SYSCALLS] == FALLBACK ? "drm-ioctls" : "syscalls";
+    default:
+        return "unknown";
+    }
+}
+
+uint64_t PerfCounters::fallbackValue(Counter counter) const
+{
+    switch (counter) {
+    case CONTEXT_SWITCHES:
+        return _context_switches;
+    case PAGE_FAULTS:
+        return _page_faults;
+    case SYSCALLS:
+        return _ioctls;
+    default:
+        return 0;
+    }
+}
+
+uint64_t PerfCounters::value(Counter counter) const
+{
+    if (_sources[counter] == UNAVAILABLE)
+        return 0;
+
+    if (_sources[counter] == FALLBACK)
+        return fallbackValue(counter);
+
+    /* nr, time_enabled, time_running, values[nr] */
+    std::vector<uint64_t> data(3 + _group_size);
+    size_t size = data.size() * sizeof(uint64_t);
+
+    if (read(_leader, data.data(), size) != ssize_t(size))
+        throw std::runtime_error("Reading perf counters failed");
+
+    uint64_t enabled = data[1], running = data[2];
+    uint64_t value = data[3 + _group_index[counter]];
+
+    /* Scale up if the group was multiplexed with other events */
+    if (running && running < enabled)
+        value = double(value) * enabled / running;
+
+    /* Each stop() enters the kernel once before the counters stop */
+    if (counter == SYSCALLS)
+        value = value > _calls ? value - _calls : 0;
+
+    return value;
+}
+
+double PerfCounters::perCall(Counter counter) const
+{
+    return _calls ? double(value(counter)) / _calls : 0;
+}
+
+std::string PerfCounters::summary() const
+{
+    std::string summary;
+    char buffer[64];
+
+    for (unsigned i = 0; i < NUM_COUNTERS; i++) {
+        Counter counter = Counter(i);
+
+        if (_sources[counter] == UNAVAILABLE)
+            sprintf(buffer, "%s%s n/a", i ? " " : "", name(counter));
+        else
+            sprintf(buffer, "%s%s %.1f", i ? " " : "", name(counter),
+                    perCall(counter));
+
+        summary += buffer;
+    }
+
+    return summary;
+}
@@ -0,0 +1,105 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <string>
+
+#include <sys/resource.h>
+
+/*
+ * perf_event_open counters of the calling thread, accumulated over
+ * start()/stop() pairs. All events are read as one group, so a pair
+ * costs two ioctls.
+ *
+ * Where the PMU is unavailable, as in VMs, cycles fall back to the
+ * task clock and the other hardware events are reported as missing.
+ * Where perf events are unavailable altogether, context switches and
+ * page faults come from getrusage() and syscalls are approximated with
+ * the DRM ioctls issued through DrmDevice, which also covers the fake
+ * backend.
+ */
+class PerfCounters {
+public:
+    enum Counter {
+        CYCLES,
+        INSTRUCTIONS,
+        CACHE_MISSES,
+        CONTEXT_SWITCHES,
+        PAGE_FAULTS,
+        SYSCALLS,
+        NUM_COUNTERS,
+    };
+
+    enum Source {
+        UNAVAILABLE,
+        HARDWARE,
+        SOFTWARE,
+        FALLBACK,
+    };
+
+    PerfCounters();
+    PerfCounters(const PerfCounters &) = delete;
+    ~PerfCounters();
+
+    void start();
+    void stop();
+
+    Source source(Counter counter) const { return _sources[counter]; }
+
+    /* Name of what is counted, which depends on the source */
+    const char * name(Counter counter) const;
+
+    /* Total over all start()/stop() pairs */
+    uint64_t value(Counter counter) const;
+
+    /* Average per start()/stop() pair */
+    double perCall(Counter counter) const;
+
+    uint64_t calls() const { return _calls; }
+
+    /* "cycles X instructions X ..." per call, n/a for missing ones */
+    std::string summary() const;
+
+private:
+    bool open(Counter counter, uint32_t type, uint64_t config);
+    uint64_t fallbackValue(Counter counter) const;
+
+    Source _sources[NUM_COUNTERS];
+    int _fds[NUM_COUNTERS];
+    /* Position of the counter in group reads */
+    unsigned _group_index[NUM_COUNTERS];
+    unsigned _group_size;
+    int _leader;
+
+    uint64_t _calls;
+    struct rusage _rusage_begin;
+    uint64_t _ioctls_begin;
+    uint64_t _context_switches;
+    uint64_t _page_faults;
+    uint64_t _ioctls;
+};
+
+#endif // PERF_COUNTERS_H
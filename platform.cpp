@@ -27,9 +27,11 @@
 #include <cstring>
 
 #include "host1x.h"
+#include "soc.h"
 
 Platform::Platform()
 {
+    setSoc(Tegra210);
 }
 
 bool Platform::initialize() {
@@ -46,57 +48,65 @@ bool Platform::initialize() {
     char *next = buf;
     while (next < buf+len) {
         if (!strcmp(next, "nvidia,tegra20")) {
-            _soc = Tegra20;
+            setSoc(Tegra20);
             return true;
         }
         if (!strcmp(next, "nvidia,tegra30")) {
-            _soc = Tegra30;
+            setSoc(Tegra30);
             return true;
         }
         if (!strcmp(next, "nvidia,tegra114")) {
-            _soc = Tegra114;
+            setSoc(Tegra114);
             return true;
         }
         if (!strcmp(next, "nvidia,tegra124")) {
-            _soc = Tegra124;
+            setSoc(Tegra124);
             return true;
         }
         if (!strcmp(next, "nvidia,tegra210")) {
-            _soc = Tegra210;
+            setSoc(Tegra210);
             return true;
         }
         if (!strcmp(next, "nvidia,tegra186")) {
-            _soc = Tegra186;
+            setSoc(Tegra186);
             return true;
         }
         next += strlen(next)+1;
     }
+
+    return false;
 }
 
-uint32_t Platform::incrementSyncpointOp(uint32_t syncpoint) const
+void Platform::setSoc(Soc soc)
 {
-    switch (_soc) {
-    case Tegra20:
-    case Tegra30:
-    case Tegra114:
-    case Tegra124:
-    case Tegra210:
-        return syncpoint | (1 << 8);
-    case Tegra186:
-        return syncpoint | (1 << 10);
-    }
+    _soc = soc;
+
+    with_soc(soc, [this](auto traits) {
+        typedef decltype(traits) Traits;
+
+        _syncpt_op_done = Traits::incrementSyncpointOp(0);
+        _default_class = Traits::default_class;
+        _syncpt_id_mask = Traits::syncpt_id_mask;
+    });
 }
 
-uint32_t Platform::defaultClass() const
+unsigned Platform::waitSyncpointOps(uint32_t syncpoint, uint32_t threshold,
+                                    uint32_t *words) const
 {
-    switch (_soc) {
-    case Tegra20:
-    case Tegra30:
-    case Tegra114:
-        return HOST1X_CLASS_GR2D;
-    case Tegra124:
-    case Tegra210:
-    case Tegra186:
-        return HOST1X_CLASS_VIC;
+    if (_soc == Tegra186) {
+        /* SETCLASS writes both registers, they are two apart */
+        words[0] = host1x_opcode_setclass(HOST1X_CLASS_HOST1X,
+                                          HOST1X_UCLASS_LOAD_SYNCPT_PAYLOAD_32,
+                                          0x5);
+        words[1] = threshold;
+        words[2] = syncpoint;
+
+        return 3;
     }
+
+    words[0] = host1x_opcode_setclass(HOST1X_CLASS_HOST1X,
+                                      HOST1X_UCLASS_WAIT_SYNCPT, 0x1);
+    words[1] = (syncpoint << 24) | (threshold & 0xffffff);
+
+    return 2;
 }
@@ -43,13 +43,36 @@ public:
     bool initialize();
 
     Soc soc() const { return _soc; }
-    void setSoc(Soc soc) { _soc = soc; }
+    void setSoc(Soc soc);
 
-    uint32_t incrementSyncpointOp(uint32_t syncpoint) const;
-    uint32_t defaultClass() const;
+    /*
+     * The encodings of the SoC are looked up once by setSoc(), from the
+     * SocTraits of its generation, so these don't branch.
+     */
+    uint32_t incrementSyncpointOp(uint32_t syncpoint) const {
+        return syncpoint | _syncpt_op_done;
+    }
+    uint32_t defaultClass() const { return _default_class; }
+    uint32_t syncpointIdMask() const { return _syncpt_id_mask; }
+
+    static const unsigned MAX_WAIT_SYNCPOINT_WORDS = 3;
+
+    /*
+     * Stores the words making the channel wait for the syncpoint to reach
+     * the threshold, returns their number. The stream is left in the
+     * host1x class.
+     */
+    unsigned waitSyncpointOps(uint32_t syncpoint, uint32_t threshold,
+                              uint32_t *words) const;
 
 private:
     Soc _soc;
+    uint32_t _syncpt_op_done;
+    uint32_t _default_class;
+    uint32_t _syncpt_id_mask;
 };
 
+/* Defined by main.cpp */
+extern Platform platform;
+
 #endif // PLATFORM_H
@@ -0,0 +1,574 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "replay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/ioctl.h>
+
+#include "platform.h"
+#include "validator.h"
+
+const uint32_t TraceReplay::MAX_WAIT_MS;
+
+TraceReplay::TraceReplay(const std::string &path)
+: _reader(path)
+, _calls(0)
+, _mismatches(0)
+, _skipped(0)
+, _elapsed(0)
+, _recorded_elapsed(0)
+{
+    _syncpt_id_mask = platform.syncpointIdMask();
+}
+
+TraceReplay::~TraceReplay()
+{
+    for (auto &it : _devices)
+        closeDevice(it.second);
+}
+
+void TraceReplay::run(bool original_speed)
+{
+    uint64_t first = 0, last = 0;
+    uint64_t start = monotonic_ns();
+
+    _reader.rewind();
+
+    while (const TraceRecord *record = _reader.next()) {
+        if (!first)
+            first = record->timestamp;
+
+        last = std::max(last, record->timestamp + record->duration);
+
+        if (original_speed && record->timestamp > first) {
+            uint64_t due = start + (record->timestamp - first);
+            uint64_t now = monotonic_ns();
+
+            if (due > now)
+                std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+        }
+
+        replay(record);
+    }
+
+    _elapsed = monotonic_ns() - start;
+    _recorded_elapsed = last - first;
+}
+
+std::string TraceReplay::report() const
+{
+    char buffer[1024];
+
+    sprintf(buffer, "replay: %llu calls in %f sec (recorded %f sec), "
+                    "%.0f calls/sec, %llu submits, %llu results differ, "
+                    "%llu records skipped\n"
+                    "replay: one submit takes %s\n"
+                    "replay: recorded submit took %s\n"
+                    "replay: one wait takes %s\n"
+                    "replay: recorded wait took %s\n",
+            (unsigned long long)_calls, _elapsed / 1e9,
+            _recorded_elapsed / 1e9,
+            _elapsed ? _calls * 1e9 / _elapsed : 0.0,
+            (unsigned long long)_submit_latency.count(),
+            (unsigned long long)_mismatches,
+            (unsigned long long)_skipped,
+            _submit_latency.summary().c_str(),
+            _recorded_submit_latency.summary().c_str(),
+            _wait_latency.summary().c_str(),
+            _recorded_wait_latency.summary().c_str());
+
+    return buffer;
+}
+
+void TraceReplay::closeDevice(Device &dev)
+{
+    for (auto &it : dev.bos) {
+        if (it.second.map)
+            dev.drm->munmap(it.second.map, it.second.size);
+    }
+
+    dev.bos.clear();
+}
+
+uint32_t TraceReplay::handle(Device &dev, uint32_t handle)
+{
+    auto it = dev.handles.find(handle);
+
+    return it == dev.handles.end() ? handle : it->second;
+}
+
+uint64_t TraceReplay::context(Device &dev, uint64_t context)
+{
+    auto it = dev.contexts.find(context);
+
+    return it == dev.contexts.end() ? context : it->second;
+}
+
+uint32_t TraceReplay::syncpoint(uint32_t id)
+{
+    auto it = _syncpts.find(id);
+
+    return it == _syncpts.end() ? id : it->second;
+}
+
+/* Translates a threshold of recorded syncpoint id */
+uint32_t TraceReplay::fence(uint32_t id, uint32_t threshold)
+{
+    auto it = _fence_offsets.find(id);
+
+    return it == _fence_offsets.end() ? threshold : threshold + it->second;
+}
+
+void TraceReplay::updateFence(uint32_t id, uint32_t recorded,
+                              uint32_t replayed)
+{
+    _fence_offsets[id] = replayed - recorded;
+}
+
+void *TraceReplay::map(Device &dev, uint32_t handle)
+{
+    auto bo = dev.bos.find(handle);
+    if (bo == dev.bos.end())
+        return nullptr;
+
+    if (bo->second.map)
+        return bo->second.map;
+
+    drm_tegra_gem_mmap gem_mmap_args;
+    memset(&gem_mmap_args, 0, sizeof(gem_mmap_args));
+    gem_mmap_args.handle = handle;
+
+    if (dev.drm->ioctl(DRM_IOCTL_TEGRA_GEM_MMAP, &gem_mmap_args))
+        return nullptr;
+
+    bo->second.map = dev.drm->mmap(bo->second.size, gem_mmap_args.offset);
+
+    return bo->second.map;
+}
+
+/* Rewrites the IDs of INCR_SYNCPT writes, register 0 of every class */
+void TraceReplay::patchSyncpoints(uint32_t *words, size_t count)
+{
+    struct {
+        uint32_t *words;
+        uint32_t id_mask;
+        TraceReplay &replay;
+
+        void opcode(size_t) { }
+
+        const char *setClass(uint32_t) { return nullptr; }
+
+        const char *write(uint32_t reg, uint32_t value, size_t index) {
+            if (reg == 0)
+                words[index] = (value & ~id_mask) |
+                               replay.syncpoint(value & id_mask);
+
+            return nullptr;
+        }
+    } visitor = { words, _syncpt_id_mask, *this };
+
+    host1x_decode(words, count, visitor);
+}
+
+int TraceReplay::issue(Device &dev, const TraceRecord *record, void *args)
+{
+    uint64_t begin = monotonic_ns();
+    int ret = dev.drm->ioctl(record->request, args);
+    uint64_t duration = monotonic_ns() - begin;
+
+    switch (record->request) {
+    case DRM_IOCTL_TEGRA_SUBMIT:
+#ifdef DRM_IOCTL_TEGRA_CHANNEL_OPEN
+    case DRM_IOCTL_TEGRA_CHANNEL_SUBMIT:
+#endif
+        _submit_latency.record(duration);
+        _recorded_submit_latency.record(record->duration);
+        break;
+    case DRM_IOCTL_TEGRA_SYNCPT_WAIT:
+#ifdef DRM_IOCTL_TEGRA_CHANNEL_OPEN
+    case DRM_IOCTL_TEGRA_SYNCPOINT_WAIT:
+#endif
+        _wait_latency.record(duration);
+        _recorded_wait_latency.record(record->duration);
+        break;
+    default:
+        break;
+    }
+
+    _calls++;
+
+    if ((ret == 0) != (record->result == 0))
+        _mismatches++;
+
+    return ret;
+}
+
+void TraceReplay::replay(const TraceRecord *record)
+{
+    if (record->request == TRACE_OPEN) {
+        _devices[record->device].drm.reset(new DrmDevice());
+        return;
+    }
+
+    auto it = _devices.find(record->device);
+    if (it == _devices.end()) {
+        _skipped++;
+        return;
+    }
+
+    Device &dev = it->second;
+
+    if (record->request == TRACE_CLOSE) {
+        closeDevice(dev);
+        _devices.erase(it);
+        return;
+    }
+
+    /* Large enough for the argument of any Tegra DRM ioctl */
+    union {
+        uint8_t bytes[256];
+        uint64_t align;
+    } buf;
+
+    size_t size = _IOC_SIZE(record->request);
+    if (size > sizeof(buf.bytes) || size > TraceReader::payloadSize(record)) {
+        _skipped++;
+        return;
+    }
+
+    memcpy(buf.bytes, TraceReader::payload(record), size);
+
+    /* Successful calls return the IDs to translate to */
+    bool ok = record->result == 0;
+
+    switch (record->request) {
+    case DRM_IOCTL_TEGRA_GEM_CREATE: {
+        auto args = reinterpret_cast<drm_tegra_gem_create *>(buf.bytes);
+        uint32_t recorded = args->handle;
+
+        args->handle = 0;
+        if (issue(dev, record, args) == 0 && ok) {
+            dev.handles[recorded] = args->handle;
+            dev.bos[args->handle] = { args->size, nullptr };
+        }
+        break;
+    }
+    case DRM_IOCTL_TEGRA_GEM_MMAP: {
+        auto args = reinterpret_cast<drm_tegra_gem_mmap *>(buf.bytes);
+
+        args->handle = handle(dev, args->handle);
+        issue(dev, record, args);
+        break;
+    }
+    case DRM_IOCTL_GEM_CLOSE: {
+        auto args = reinterpret_cast<drm_gem_close *>(buf.bytes);
+        uint32_t recorded = args->handle;
+
+        args->handle = handle(dev, recorded);
+
+        auto bo = dev.bos.find(args->handle);
+        if (bo != dev.bos.end()) {
+            if (bo->second.map)
+                dev.drm->munmap(bo->second.map, bo->second.size);
+            dev.bos.erase(bo);
+        }
+
+        issue(dev, record, args);
+        dev.handles.erase(recorded);
+        break;
+    }
+    case DRM_IOCTL_TEGRA_OPEN_CHANNEL: {
+        auto args = reinterpret_cast<drm_tegra_open_channel *>(buf.bytes);
+        uint64_t recorded = args->context;
+
+        if (issue(dev, record, args) == 0 && ok)
+            dev.contexts[recorded] = args->context;
+        break;
+    }
+    case DRM_IOCTL_TEGRA_CLOSE_CHANNEL: {
+        auto args = reinterpret_cast<drm_tegra_close_channel *>(buf.bytes);
+        uint64_t recorded = args->context;
+
+        args->context = context(dev, recorded);
+        issue(dev, record, args);
+        dev.contexts.erase(recorded);
+        break;
+    }
+    case DRM_IOCTL_TEGRA_GET_SYNCPT: {
+        auto args = reinterpret_cast<drm_tegra_get_syncpt *>(buf.bytes);
+        uint32_t recorded = args->id;
+
+        args->context = context(dev, args->context);
+        if (issue(dev, record, args) == 0 && ok)
+            _syncpts[recorded] = args->id;
+        break;
+    }
+    case DRM_IOCTL_TEGRA_SYNCPT_READ: {
+        auto args = reinterpret_cast<drm_tegra_syncpt_read *>(buf.bytes);
+
+        args->id = syncpoint(args->id);
+        issue(dev, record, args);
+        break;
+    }
+    case DRM_IOCTL_TEGRA_SYNCPT_INCR: {
+        auto args = reinterpret_cast<drm_tegra_syncpt_incr *>(buf.bytes);
+
+        args->id = syncpoint(args->id);
+        issue(dev, record, args);
+        break;
+    }
+    case DRM_IOCTL_TEGRA_SYNCPT_WAIT: {
+        auto args = reinterpret_cast<drm_tegra_syncpt_wait *>(buf.bytes);
+
+        args->thresh = fence(args->id, args->thresh);
+        args->id = syncpoint(args->id);
+        args->timeout = std::min(args->timeout, MAX_WAIT_MS);
+        issue(dev, record, args);
+        break;
+    }
+    case DRM_IOCTL_TEGRA_SUBMIT:
+        replaySubmit(dev, record);
+        break;
+#ifdef DRM_IOCTL_TEGRA_CHANNEL_OPEN
+    case DRM_IOCTL_TEGRA_CHANNEL_OPEN: {
+        auto args = reinterpret_cast<drm_tegra_channel_open *>(buf.bytes);
+        uint32_t recorded = args->context;
+
+        if (issue(dev, record, args) == 0 && ok)
+            dev.contexts[recorded] = args->context;
+        break;
+    }
+    case DRM_IOCTL_TEGRA_CHANNEL_CLOSE: {
+        auto args = reinterpret_cast<drm_tegra_channel_close *>(buf.bytes);
+        uint32_t recorded = args->context;
+
+        args->context = context(dev, recorded);
+        issue(dev, record, args);
+        dev.contexts.erase(recorded);
+        break;
+    }
+    case DRM_IOCTL_TEGRA_CHANNEL_MAP: {
+        auto args = reinterpret_cast<drm_tegra_channel_map *>(buf.bytes);
+        uint64_t key = uint64_t(args->context) << 32 | args->mapping;
+
+        args->context = context(dev, args->context);
+        args->handle = handle(dev, args->handle);
+        if (issue(dev, record, args) == 0 && ok)
+            dev.mappings[key] = args->mapping;
+        break;
+    }
+    case DRM_IOCTL_TEGRA_CHANNEL_UNMAP: {
+        auto args = reinterpret_cast<drm_tegra_channel_unmap *>(buf.bytes);
+        uint64_t key = uint64_t(args->context) << 32 | args->mapping;
+        auto mapping = dev.mappings.find(key);
+
+        args->context = context(dev, args->context);
+        if (mapping != dev.mappings.end())
+            args->mapping = mapping->second;
+        issue(dev, record, args);
+        dev.mappings.erase(key);
+        break;
+    }
+    case DRM_IOCTL_TEGRA_SYNCPOINT_ALLOCATE: {
+        auto args = reinterpret_cast<drm_tegra_syncpoint_allocate *>(
+                        buf.bytes);
+        uint32_t recorded = args->id;
+
+        if (issue(dev, record, args) == 0 && ok)
+            _syncpts[recorded] = args->id;
+        break;
+    }
+    case DRM_IOCTL_TEGRA_SYNCPOINT_FREE: {
+        auto args = reinterpret_cast<drm_tegra_syncpoint_free *>(buf.bytes);
+        uint32_t recorded = args->id;
+
+        args->id = syncpoint(recorded);
+        issue(dev, record, args);
+        _syncpts.erase(recorded);
+        _fence_offsets.erase(recorded);
+        break;
+    }
+    case DRM_IOCTL_TEGRA_SYNCPOINT_WAIT: {
+        auto args = reinterpret_cast<drm_tegra_syncpoint_wait *>(buf.bytes);
+
+        /* Rebase the absolute deadline on the replay clock */
+        int64_t timeout = args->timeout_ns - int64_t(record->timestamp);
+        timeout = std::max<int64_t>(0, std::min<int64_t>(
+                      timeout, MAX_WAIT_MS * 1000000ll));
+
+        args->threshold = fence(args->id, args->threshold);
+        args->id = syncpoint(args->id);
+        args->timeout_ns = monotonic_ns() + timeout;
+        issue(dev, record, args);
+        break;
+    }
+    case DRM_IOCTL_TEGRA_CHANNEL_SUBMIT:
+        replayChannelSubmit(dev, record);
+        break;
+#endif
+    default:
+        _skipped++;
+        break;
+    }
+}
+
+template <typename T>
+static bool take(std::vector<T> &vec, const uint8_t *&pos, const uint8_t *end,
+                 size_t count)
+{
+    if (size_t(end - pos) / sizeof(T) < count)
+        return false;
+
+    vec.resize(count);
+    memcpy(vec.data(), pos, count * sizeof(T));
+    pos += count * sizeof(T);
+
+    return true;
+}
+
+void TraceReplay::replaySubmit(Device &dev, const TraceRecord *record)
+{
+    auto pos = static_cast<const uint8_t *>(TraceReader::payload(record));
+    auto end = pos + TraceReader::payloadSize(record);
+
+    drm_tegra_submit args;
+    memcpy(&args, pos, sizeof(args));
+    pos += sizeof(args);
+
+    if (!take(_incrs, pos, end, args.num_syncpts) ||
+        !take(_cmdbufs, pos, end, args.num_cmdbufs) ||
+        !take(_relocs, pos, end, args.num_relocs)) {
+        _skipped++;
+        return;
+    }
+
+    /* Restore the command buffers, with syncpoints of the replay */
+    for (auto &cmdbuf : _cmdbufs) {
+        uint32_t words;
+
+        if (!take(_words, pos, end, 1) ||
+            !take(_words, pos, end, words = _words[0])) {
+            _skipped++;
+            return;
+        }
+
+        cmdbuf.handle = handle(dev, cmdbuf.handle);
+
+        auto ptr = static_cast<uint8_t *>(map(dev, cmdbuf.handle));
+        auto bo = dev.bos.find(cmdbuf.handle);
+
+        if (!words || !ptr ||
+            cmdbuf.offset + words * 4ull > bo->second.size)
+            continue;
+
+        auto dst = reinterpret_cast<uint32_t *>(ptr + cmdbuf.offset);
+
+        memcpy(dst, _words.data(), words * 4);
+        patchSyncpoints(dst, words);
+    }
+
+    for (auto &reloc : _relocs) {
+        reloc.cmdbuf.handle = handle(dev, reloc.cmdbuf.handle);
+        reloc.target.handle = handle(dev, reloc.target.handle);
+    }
+
+    uint32_t recorded_id = _incrs.empty() ? 0 : _incrs[0].id;
+    uint32_t recorded_fence = args.fence;
+
+    for (auto &incr : _incrs)
+        incr.id = syncpoint(incr.id);
+
+    args.context = context(dev, args.context);
+    args.syncpts = (uintptr_t)_incrs.data();
+    args.cmdbufs = (uintptr_t)_cmdbufs.data();
+    args.relocs = (uintptr_t)_relocs.data();
+    args.num_waitchks = 0;
+    args.waitchks = 0;
+    args.fence = 0;
+
+    if (issue(dev, record, &args) == 0 && record->result == 0 &&
+        !_incrs.empty())
+        updateFence(recorded_id, recorded_fence, args.fence);
+}
+
+#ifdef DRM_IOCTL_TEGRA_CHANNEL_OPEN
+void TraceReplay::replayChannelSubmit(Device &dev, const TraceRecord *record)
+{
+    auto pos = static_cast<const uint8_t *>(TraceReader::payload(record));
+    auto end = pos + TraceReader::payloadSize(record);
+    std::vector<drm_tegra_submit_buf> bufs;
+    std::vector<drm_tegra_submit_cmd> cmds;
+
+    drm_tegra_channel_submit args;
+    memcpy(&args, pos, sizeof(args));
+    pos += sizeof(args);
+
+    if (!take(bufs, pos, end, args.num_bufs) ||
+        !take(cmds, pos, end, args.num_cmds) ||
+        !take(_words, pos, end, args.gather_data_words)) {
+        _skipped++;
+        return;
+    }
+
+    for (auto &buf : bufs) {
+        uint64_t key = uint64_t(args.context) << 32 | buf.mapping;
+        auto mapping = dev.mappings.find(key);
+
+        if (mapping != dev.mappings.end())
+            buf.mapping = mapping->second;
+    }
+
+    size_t gathered = 0;
+
+    for (auto &cmd : cmds) {
+        if (cmd.type == DRM_TEGRA_SUBMIT_CMD_GATHER_UPTR &&
+            cmd.gather_uptr.words <= _words.size() - gathered) {
+            patchSyncpoints(&_words[gathered], cmd.gather_uptr.words);
+            gathered += cmd.gather_uptr.words;
+        } else if (cmd.type == DRM_TEGRA_SUBMIT_CMD_WAIT_SYNCPT) {
+            cmd.wait_syncpt.value = fence(cmd.wait_syncpt.id,
+                                          cmd.wait_syncpt.value);
+            cmd.wait_syncpt.id = syncpoint(cmd.wait_syncpt.id);
+        }
+    }
+
+    uint32_t recorded_id = args.syncpt.id;
+    uint32_t recorded_fence = args.syncpt.value;
+
+    args.context = context(dev, args.context);
+    args.bufs_ptr = (uintptr_t)bufs.data();
+    args.cmds_ptr = (uintptr_t)cmds.data();
+    args.gather_data_ptr = (uintptr_t)_words.data();
+    args.syncpt.id = syncpoint(args.syncpt.id);
+    args.syncpt.value = 0;
+
+    if (issue(dev, record, &args) == 0 && record->result == 0)
+        updateFence(recorded_id, recorded_fence, args.syncpt.value);
+}
+#endif
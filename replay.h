@@ -0,0 +1,116 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <libdrm/tegra_drm.h>
+
+#include "gem.h"
+#include "stats.h"
+#include "trace.h"
+
+/*
+ * Re-issues the calls of a trace recorded by TraceRecorder, as fast as
+ * possible or paced like the recorded run. GEM handles, channels,
+ * mappings and syncpoints are translated to the ones obtained while
+ * replaying, and so are syncpoint IDs in command buffers and fences in
+ * waits. Waits are bounded to MAX_WAIT_MS, so a wait that was recorded
+ * before the submit signalling it can't hang the replay.
+ */
+class TraceReplay {
+public:
+    /* Throws std::runtime_error if the trace can't be read */
+    TraceReplay(const std::string &path);
+    TraceReplay(const TraceReplay &) = delete;
+    ~TraceReplay();
+
+    void run(bool original_speed);
+
+    /* Throughput and latency of the last run, next to the recorded ones */
+    std::string report() const;
+
+    static const uint32_t MAX_WAIT_MS = 10000;
+
+private:
+    struct Bo {
+        uint64_t size;
+        void *map;
+    };
+
+    struct Device {
+        std::unique_ptr<DrmDevice> drm;
+        /* From recorded to replayed handles, contexts and mappings */
+        std::unordered_map<uint32_t, uint32_t> handles;
+        std::unordered_map<uint64_t, uint64_t> contexts;
+        std::unordered_map<uint64_t, uint32_t> mappings;
+        /* By replayed handle */
+        std::unordered_map<uint32_t, Bo> bos;
+    };
+
+    void replay(const TraceRecord *record);
+    void replaySubmit(Device &dev, const TraceRecord *record);
+#ifdef DRM_IOCTL_TEGRA_CHANNEL_OPEN
+    void replayChannelSubmit(Device &dev, const TraceRecord *record);
+#endif
+    int issue(Device &dev, const TraceRecord *record, void *args);
+    void closeDevice(Device &dev);
+
+    uint32_t handle(Device &dev, uint32_t handle);
+    uint64_t context(Device &dev, uint64_t context);
+    uint32_t syncpoint(uint32_t id);
+    uint32_t fence(uint32_t id, uint32_t threshold);
+    void updateFence(uint32_t id, uint32_t recorded, uint32_t replayed);
+    void *map(Device &dev, uint32_t handle);
+    void patchSyncpoints(uint32_t *words, size_t count);
+
+    TraceReader _reader;
+    std::unordered_map<uint32_t, Device> _devices;
+    /* Syncpoints are global, like in host1x */
+    std::unordered_map<uint32_t, uint32_t> _syncpts;
+    std::unordered_map<uint32_t, uint32_t> _fence_offsets;
+    uint32_t _syncpt_id_mask;
+
+    uint64_t _calls;
+    uint64_t _mismatches;
+    uint64_t _skipped;
+    uint64_t _elapsed;
+    uint64_t _recorded_elapsed;
+    LatencyHistogram _submit_latency;
+    LatencyHistogram _wait_latency;
+    LatencyHistogram _recorded_submit_latency;
+    LatencyHistogram _recorded_wait_latency;
+
+    std::vector<drm_tegra_syncpt> _incrs;
+    std::vector<drm_tegra_cmdbuf> _cmdbufs;
+    std::vector<drm_tegra_reloc> _relocs;
+    std::vector<uint32_t> _words;
+};
+
+#endif // REPLAY_H
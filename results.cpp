@@ -0,0 +1,415 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "results.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <sys/utsname.h>
+
+namespace {
+
+/* Welch's t beyond which a difference of means is significant */
+const double T_CRITICAL = 3.29;
+
+const char *CSV_COLUMNS =
+    "soc,kernel,test,metric,config,batches,submits,relocs,unit,"
+    "higher_is_better,count,mean,stddev,p50,p90,p99,p99.9,max,"
+    "median,ci95_low,ci95_high,outliers";
+
+std::string json_string(const std::string &str)
+{
+    std::string out = "\"";
+
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (uint8_t(c) < 0x20) {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+            out += buffer;
+        } else {
+            out += c;
+        }
+    }
+
+    return out + "\"";
+}
+
+/* Free-form fields lose their commas, so that no quoting is needed */
+std::string csv_field(std::string str)
+{
+    for (char &c : str)
+        if (c == ',' || c == '\n')
+            c = ';';
+
+    return str;
+}
+
+std::string number(double value)
+{
+    char buffer[32];
+
+    if (std::isnan(value))
+        return "";
+
+    snprintf(buffer, sizeof(buffer), "%.10g", value);
+
+    return buffer;
+}
+
+std::vector<std::string> split(const std::string &line, char separator)
+{
+    std::vector<std::string> fields;
+    std::stringstream stream(line);
+    std::string field;
+
+    while (std::getline(stream, field, separator))
+        fields.push_back(field);
+
+    return fields;
+}
+
+} // anonymous namespace
+
+Results::Results()
+{
+    struct utsname name;
+
+    if (uname(&name) == 0)
+        _kernel = name.release;
+}
+
+void Results::addEnvironment(const std::string &key, const std::string &value)
+{
+    _environment.push_back({ key, json_string(value) });
+}
+
+void Results::addEnvironment(const std::string &key, double value)
+{
+    _environment.push_back({ key, number(value) });
+}
+
+std::string Results::Measurement::config() const
+{
+    std::string config;
+
+    for (const auto &param : params) {
+        if (!config.empty())
+            config += ' ';
+        config += param.first + "=" + number(param.second);
+    }
+
+    return config;
+}
+
+std::string Results::Measurement::key() const
+{
+    return test + "/" + metric + "/" + config();
+}
+
+double Results::Measurement::param(const char *name) const
+{
+    for (const auto &param : params)
+        if (param.first == name)
+            return param.second;
+
+    return NAN;
+}
+
+void Results::beginTest(const std::string &name)
+{
+    _current = name;
+}
+
+void Results::endTest(bool passed, const std::string &reason)
+{
+    _tests.push_back({ _current, passed, reason });
+}
+
+void Results::addLatency(const std::string &metric, const Params &params,
+                         const LatencyHistogram &latency)
+{
+    Measurement m;
+    m.test = _current;
+    m.metric = metric;
+    m.params = params;
+    m.unit = "ns";
+    m.higher_is_better = false;
+    m.count = latency.count();
+    m.mean = latency.mean();
+    m.stddev = latency.stddev();
+    m.p50 = latency.percentile(50);
+    m.p90 = latency.percentile(90);
+    m.p99 = latency.percentile(99);
+    m.p999 = latency.percentile(99.9);
+    m.max = latency.max();
+    m.estimate = false;
+
+    _measurements.push_back(m);
+}
+
+void Results::addValue(const std::string &metric, const Params &params,
+                       double value, const std::string &unit,
+                       bool higher_is_better)
+{
+    Measurement m;
+    m.test = _current;
+    m.metric = metric;
+    m.params = params;
+    m.unit = unit;
+    m.higher_is_better = higher_is_better;
+    m.count = 0;
+    m.mean = value;
+    m.stddev = 0;
+    m.p50 = m.p90 = m.p99 = m.p999 = m.max = 0;
+    m.estimate = false;
+
+    _measurements.push_back(m);
+}
+
+void Results::addEstimate(const std::string &metric, const Params &params,
+                          const Estimate &estimate, const std::string &unit,
+                          bool higher_is_better)
+{
+    Measurement m;
+    m.test = _current;
+    m.metric = metric;
+    m.params = params;
+    m.unit = unit;
+    m.higher_is_better = higher_is_better;
+    m.count = estimate.samples;
+    m.mean = estimate.mean;
+    m.stddev = estimate.stddev;
+    m.p50 = m.p90 = m.p99 = m.p999 = m.max = 0;
+    m.estimate = true;
+    m.stats = estimate;
+
+    _measurements.push_back(m);
+}
+
+void Results::writeJson(const std::string &path) const
+{
+    std::ofstream out(path);
+    if (!out)
+        throw std::runtime_error("Failed to create " + path);
+
+    out << "{\n  \"soc\": " << json_string(_soc)
+        << ",\n  \"kernel\": " << json_string(_kernel)
+        << ",\n  \"environment\": {";
+
+    for (size_t i = 0; i < _environment.size(); i++)
+        out << (i ? ",\n" : "\n") << "    "
+            << json_string(_environment[i].first) << ": "
+            << _environment[i].second;
+
+    out << (_environment.empty() ? "}" : "\n  }")
+        << ",\n  \"tests\": [";
+
+    for (size_t i = 0; i < _tests.size(); i++) {
+        out << (i ? ",\n" : "\n") << "    { \"name\": "
+            << json_string(_tests[i].name) << ", \"passed\": "
+            << (_tests[i].passed ? "true" : "false");
+        if (!_tests[i].passed)
+            out << ", \"reason\": " << json_string(_tests[i].reason);
+        out << " }";
+    }
+
+    out << "\n  ],\n  \"results\": [";
+
+    for (size_t i = 0; i < _measurements.size(); i++) {
+        const Measurement &m = _measurements[i];
+
+        out << (i ? ",\n" : "\n") << "    { \"test\": " << json_string(m.test)
+            << ", \"metric\": " << json_string(m.metric)
+            << ", \"params\": {";
+        for (size_t k = 0; k < m.params.size(); k++)
+            out << (k ? ", " : " ") << json_string(m.params[k].first) << ": "
+                << number(m.params[k].second);
+        out << " }, \"unit\": " << json_string(m.unit)
+            << ", \"higher_is_better\": "
+            << (m.higher_is_better ? "true" : "false")
+            << ", \"mean\": " << number(m.mean);
+        if (m.estimate)
+            out << ", \"count\": " << m.count
+                << ", \"stddev\": " << number(m.stddev)
+                << ", \"ci95\": [" << number(m.stats.mean_low) << ", "
+                << number(m.stats.mean_high) << "]"
+                << ", \"median\": " << number(m.stats.median)
+                << ", \"median_ci95\": [" << number(m.stats.median_low)
+                << ", " << number(m.stats.median_high) << "]"
+                << ", \"outliers\": " << m.stats.outliers
+                << ", \"warmup\": " << m.stats.warmup
+                << ", \"converged\": "
+                << (m.stats.converged ? "true" : "false");
+        else if (m.count)
+            out << ", \"count\": " << m.count
+                << ", \"stddev\": " << number(m.stddev)
+                << ", \"p50\": " << m.p50 << ", \"p90\": " << m.p90
+                << ", \"p99\": " << m.p99 << ", \"p99.9\": " << m.p999
+                << ", \"max\": " << m.max;
+        out << " }";
+    }
+
+    out << "\n  ]\n}\n";
+}
+
+void Results::writeCsv(const std::string &path) const
+{
+    std::ofstream out(path);
+    if (!out)
+        throw std::runtime_error("Failed to create " + path);
+
+    out << CSV_COLUMNS << "\n";
+
+    for (const Measurement &m : _measurements) {
+        out << csv_field(_soc) << ',' << csv_field(_kernel) << ','
+            << m.test << ',' << m.metric << ',' << m.config() << ','
+            << number(m.param("batches")) << ','
+            << number(m.param("submits")) << ','
+            << number(m.param("relocs")) << ','
+            << m.unit << ',' << (m.higher_is_better ? 1 : 0) << ','
+            << m.count << ',' << number(m.mean) << ',';
+        if (m.estimate)
+            out << number(m.stddev) << ",,,,,," << number(m.stats.median)
+                << ',' << number(m.stats.mean_low) << ','
+                << number(m.stats.mean_high) << ',' << m.stats.outliers;
+        else if (m.count)
+            out << number(m.stddev) << ',' << m.p50 << ',' << m.p90 << ','
+                << m.p99 << ',' << m.p999 << ',' << m.max << ",,,,";
+        else
+            out << ",,,,,,,,,";
+        out << "\n";
+    }
+}
+
+unsigned Results::compare(const std::string &baseline_path, double min_change,
+                          std::string &report) const
+{
+    struct Baseline {
+        double mean;
+        double stddev;
+        uint64_t count;
+    };
+
+    std::ifstream in(baseline_path);
+    if (!in)
+        throw std::runtime_error("Failed to open baseline " + baseline_path);
+
+    std::string line;
+    std::getline(in, line);
+
+    std::unordered_map<std::string, size_t> columns;
+    auto header = split(line, ',');
+
+    for (size_t i = 0; i < header.size(); i++)
+        columns[header[i]] = i;
+
+    for (const char *name : { "test", "metric", "config", "count", "mean",
+                              "stddev" })
+        if (!columns.count(name))
+            throw std::runtime_error("Baseline lacks column " +
+                                     std::string(name));
+
+    std::unordered_map<std::string, Baseline> baseline;
+
+    while (std::getline(in, line)) {
+        auto fields = split(line, ',');
+        fields.resize(header.size());
+
+        std::string key = fields[columns["test"]] + "/" +
+                          fields[columns["metric"]] + "/" +
+                          fields[columns["config"]];
+
+        baseline[key] = { atof(fields[columns["mean"]].c_str()),
+                          atof(fields[columns["stddev"]].c_str()),
+                          strtoull(fields[columns["count"]].c_str(),
+                                   nullptr, 0) };
+    }
+
+    unsigned matched = 0, regressions = 0, improvements = 0;
+
+    for (const Measurement &m : _measurements) {
+        auto it = baseline.find(m.key());
+        if (it == baseline.end() || it->second.mean == 0)
+            continue;
+
+        const Baseline &b = it->second;
+        double change = (m.mean - b.mean) / b.mean;
+        double t = 0;
+        bool significant;
+
+        matched++;
+
+        if (m.count > 1 && b.count > 1) {
+            double se = sqrt(m.stddev * m.stddev / m.count +
+                             b.stddev * b.stddev / b.count);
+
+            t = se > 0 ? (m.mean - b.mean) / se : INFINITY;
+            significant = fabs(t) > T_CRITICAL && fabs(change) > min_change;
+        } else {
+            significant = fabs(change) > 2 * min_change;
+        }
+
+        if (!significant)
+            continue;
+
+        bool worse = m.higher_is_better ? change < 0 : change > 0;
+        char buffer[512];
+
+        snprintf(buffer, sizeof(buffer),
+                 "compare: %-11s %s %s %s: %.3f -> %.3f %s (%+.1f%%)",
+                 worse ? "REGRESSION" : "improvement", m.test.c_str(),
+                 m.metric.c_str(), m.config().c_str(), b.mean, m.mean,
+                 m.unit.c_str(), change * 100);
+
+        report += buffer;
+        if (t) {
+            snprintf(buffer, sizeof(buffer), ", t %.1f", t);
+            report += buffer;
+        }
+        report += "\n";
+
+        if (worse)
+            regressions++;
+        else
+            improvements++;
+    }
+
+    char buffer[256];
+
+    snprintf(buffer, sizeof(buffer),
+             "compare: %u of %zu results found in the baseline, "
+             "%u regressions, %u improvements\n",
+             matched, _measurements.size(), regressions, improvements);
+
+    report += buffer;
+
+    return regressions;
+}
@@ -0,0 +1,121 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark.h"
+#include "stats.h"
+
+/*
+ * Machine-readable results of a run, next to the messages printed for
+ * humans: the status of every test and the measurements of every perf
+ * configuration. A measurement is identified by its test, metric name
+ * and parameters (e.g. batches=50 submits=10 relocs=3); it is either a
+ * latency distribution in ns, the estimate of a repeated measurement
+ * made by Benchmark or a single value, such as a rate. For estimates,
+ * batches is the minimum of repetitions asked for, count the number
+ * actually kept.
+ *
+ * Results are written as JSON or CSV. A CSV file of an earlier run can
+ * serve as the baseline to compare a run against.
+ */
+class Results {
+public:
+    typedef std::vector<std::pair<std::string, double>> Params;
+
+    Results();
+
+    void setSoc(const std::string &soc) { _soc = soc; }
+
+    /* Conditions of the run, such as governors and load; JSON only */
+    void addEnvironment(const std::string &key, const std::string &value);
+    void addEnvironment(const std::string &key, double value);
+
+    void beginTest(const std::string &name);
+    void endTest(bool passed, const std::string &reason);
+
+    void addLatency(const std::string &metric, const Params &params,
+                    const LatencyHistogram &latency);
+    void addValue(const std::string &metric, const Params &params,
+                  double value, const std::string &unit,
+                  bool higher_is_better);
+    void addEstimate(const std::string &metric, const Params &params,
+                     const Estimate &estimate, const std::string &unit,
+                     bool higher_is_better);
+
+    /* Throw std::runtime_error if the file can't be written */
+    void writeJson(const std::string &path) const;
+    void writeCsv(const std::string &path) const;
+
+    /*
+     * Compares with the results of a CSV baseline; appends a line per
+     * change to report and returns the number of regressions. Latencies
+     * regress when the mean grew by more than min_change with Welch's
+     * t above 3.29 (p < 0.001); single values, lacking a variance, when
+     * they got worse by more than twice min_change.
+     */
+    unsigned compare(const std::string &baseline_path, double min_change,
+                     std::string &report) const;
+
+private:
+    struct Test {
+        std::string name;
+        bool passed;
+        std::string reason;
+    };
+
+    struct Measurement {
+        std::string test;
+        std::string metric;
+        Params params;
+        std::string unit;
+        bool higher_is_better;
+        uint64_t count;         /* 0 for a single value */
+        double mean;
+        double stddev;
+        uint64_t p50, p90, p99, p999, max;
+        /* Repeated measurement, count being the samples kept */
+        bool estimate;
+        Estimate stats;
+
+        std::string config() const;
+        std::string key() const;
+        double param(const char *name) const;
+    };
+
+    std::string _soc;
+    std::string _kernel;
+    /* Keys with their values as JSON */
+    std::vector<std::pair<std::string, std::string>> _environment;
+    std::string _current;
+    std::vector<Test> _tests;
+    std::vector<Measurement> _measurements;
+};
+
+#endif // RESULTS_H
@@ -0,0 +1,271 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "scheduler.h"
+
+#include <cerrno>
+#include <functional>
+#include <queue>
+
+#include "host1x.h"
+#include "platform.h"
+
+namespace {
+
+const uint32_t WAIT_TIMEOUT_MS = 10000;
+
+} // anonymous namespace
+
+Scheduler::Scheduler(DrmDevice &drm)
+: _drm(drm)
+, _cache(drm)
+, _hardware_waits(true)
+, _host_waits(0)
+, _submissions(0)
+{
+}
+
+Scheduler::Engine & Scheduler::engine(uint32_t host1x_class)
+{
+    auto it = _engines.find(host1x_class);
+    if (it != _engines.end())
+        return it->second;
+
+    Engine &engine = _engines[host1x_class];
+
+    try {
+        engine.channel.reset(new Channel(_drm, host1x_class));
+    }
+    catch (...) {
+        _engines.erase(host1x_class);
+        throw;
+    }
+
+    engine.syncpt = engine.channel->syncpoint(0);
+    engine.fence = 0;
+    engine.busy = false;
+
+    /* Fences compare against the cache, which can't start out at 0 */
+    _syncpt_values[engine.syncpt] = read_syncpoint(_drm, engine.syncpt);
+
+    return engine;
+}
+
+Scheduler::JobId Scheduler::add(uint32_t host1x_class,
+                                const std::vector<uint32_t> &words,
+                                const std::vector<JobId> &deps)
+{
+    JobId id = _jobs.size();
+
+    for (JobId dep : deps)
+        if (dep >= id)
+            throw std::runtime_error("Job depends on a later job");
+
+    _jobs.push_back({ &engine(host1x_class), words, deps, false, 0, 0, 0 });
+
+    return id;
+}
+
+/* Only knows about completions seen by an earlier wait */
+bool Scheduler::signalled(uint32_t syncpt, uint32_t fence)
+{
+    return int32_t(_syncpt_values[syncpt] - fence) >= 0;
+}
+
+/*
+ * The first input on another engine that isn't known to have completed,
+ * or nullptr. All inputs must have been submitted. Completion is final,
+ * so the inputs seen completing are skipped on later calls.
+ */
+const Scheduler::Job *Scheduler::blockingInput(Job &job)
+{
+    for (; job.next_dep < job.deps.size(); job.next_dep++) {
+        const Job &input = _jobs[job.deps[job.next_dep]];
+
+        /* The channel runs its jobs in order */
+        if (input.engine == job.engine)
+            continue;
+
+        if (!signalled(input.engine->syncpt, input.fence))
+            return &input;
+    }
+
+    return nullptr;
+}
+
+void Scheduler::submit(Job &job, bool hardware_waits, unsigned *num_waits)
+{
+    Submit submit;
+
+    if (hardware_waits) {
+        /* The latest input fence of every other engine */
+        std::map<Engine *, uint32_t> fences;
+
+        for (JobId dep : job.deps) {
+            const Job &input = _jobs[dep];
+
+            if (input.engine == job.engine ||
+                signalled(input.engine->syncpt, input.fence))
+                continue;
+
+            auto it = fences.find(input.engine);
+
+            if (it == fences.end())
+                fences[input.engine] = input.fence;
+            else if (int32_t(input.fence - it->second) > 0)
+                it->second = input.fence;
+        }
+
+        for (const auto &fence : fences) {
+            uint32_t words[Platform::MAX_WAIT_SYNCPOINT_WORDS];
+            unsigned count = platform.waitSyncpointOps(fence.first->syncpt,
+                                                       fence.second, words);
+
+            submit.push(words, count);
+        }
+
+        if (!fences.empty())
+            submit.push(host1x_opcode_setclass(job.engine->channel->_class,
+                                               0, 0));
+
+        if (num_waits)
+            *num_waits = fences.size();
+    }
+
+    submit.push(job.words.data(), job.words.size());
+    submit.push(host1x_opcode_nonincr(HOST1X_UCLASS_INCR_SYNCPT, 1));
+    submit.push(platform.incrementSyncpointOp(job.engine->syncpt));
+
+    submit.add_incr(job.engine->syncpt, 1);
+
+    job.fence = submit.submit(*job.engine->channel, _cache).fence;
+    job.submitted = true;
+    job.order = _submissions++;
+    job.engine->fence = job.fence;
+    job.engine->busy = true;
+}
+
+/*
+ * Only the frontier, the jobs whose inputs have all been submitted, is
+ * looked at. Jobs are checked against the syncpoint values seen by
+ * earlier waits, so a pass doesn't go to the kernel; when no job is
+ * ready, the CPU blocks on the earliest submitted outstanding input.
+ */
+void Scheduler::runHostWaits()
+{
+    std::vector<std::vector<JobId>> dependents(_jobs.size());
+    std::vector<unsigned> unsubmitted(_jobs.size(), 0);
+    /* Smallest ID first, to submit in the order the jobs were added */
+    std::priority_queue<JobId, std::vector<JobId>,
+                        std::greater<JobId>> frontier;
+    std::vector<JobId> blocked;
+
+    for (JobId id = 0; id < _jobs.size(); id++) {
+        if (_jobs[id].submitted)
+            continue;
+
+        for (JobId dep : _jobs[id].deps) {
+            if (!_jobs[dep].submitted) {
+                dependents[dep].push_back(id);
+                unsubmitted[id]++;
+            }
+        }
+
+        if (!unsubmitted[id])
+            frontier.push(id);
+    }
+
+    while (!frontier.empty()) {
+        const Job *earliest = nullptr;
+
+        while (!frontier.empty()) {
+            JobId id = frontier.top();
+            Job &job = _jobs[id];
+            const Job *input = blockingInput(job);
+
+            frontier.pop();
+
+            if (input) {
+                if (!earliest || input->order < earliest->order)
+                    earliest = input;
+
+                blocked.push_back(id);
+                continue;
+            }
+
+            submit(job, false);
+
+            for (JobId dependent : dependents[id])
+                if (!--unsubmitted[dependent])
+                    frontier.push(dependent);
+        }
+
+        if (earliest) {
+            _syncpt_values[earliest->engine->syncpt] =
+                wait_syncpoint(_drm, earliest->engine->syncpt,
+                               earliest->fence, WAIT_TIMEOUT_MS);
+            _host_waits++;
+        }
+
+        for (JobId id : blocked)
+            frontier.push(id);
+
+        blocked.clear();
+    }
+}
+
+void Scheduler::run()
+{
+    if (_hardware_waits) {
+        for (auto &job : _jobs) {
+            unsigned num_waits = 0;
+
+            try {
+                submit(job, true, &num_waits);
+            }
+            catch (ioctl_error &e) {
+                if (e.error != EINVAL || !num_waits)
+                    throw;
+
+                _hardware_waits = false;
+                break;
+            }
+        }
+    }
+
+    runHostWaits();
+
+    for (auto &it : _engines) {
+        Engine &engine = it.second;
+
+        if (!engine.busy)
+            continue;
+
+        _syncpt_values[engine.syncpt] =
+            wait_syncpoint(_drm, engine.syncpt, engine.fence,
+                           WAIT_TIMEOUT_MS);
+        engine.busy = false;
+    }
+
+    _jobs.clear();
+}
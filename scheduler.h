@@ -0,0 +1,112 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "bo_cache.h"
+#include "gem.h"
+#include "util.h"
+
+/*
+ * Runs a graph of jobs over several host1x engines, GR2D, VIC, GR3D and
+ * so on, with a channel of its own for each. Jobs are added in
+ * dependency order, only depending on jobs added before them, and run()
+ * submits all of them and waits for their completion. Job IDs are only
+ * valid until then.
+ *
+ * With hardware waits, every job is submitted right away, prefixed with
+ * host1x class waits for the fences of its inputs on other engines; the
+ * channel already orders jobs of the same engine. The engines then start
+ * jobs as soon as their inputs are ready, without host round trips.
+ *
+ * With host waits, a job is only submitted once its inputs on other
+ * engines have completed, and the CPU blocks on the oldest outstanding
+ * input whenever no job is ready. The scheduler switches to host waits
+ * for good if a stream with waits is rejected, as the kernel firewall
+ * only allows the class of the channel.
+ */
+class Scheduler {
+public:
+    typedef unsigned JobId;
+
+    Scheduler(DrmDevice &drm);
+    Scheduler(const Scheduler &) = delete;
+
+    /*
+     * Adds a job executing the words on the engine of the host1x class
+     * once all the deps have completed. The scheduler appends the
+     * syncpoint increment signalling its completion.
+     */
+    JobId add(uint32_t host1x_class, const std::vector<uint32_t> &words,
+              const std::vector<JobId> &deps = {});
+
+    void run();
+
+    void setHardwareWaits(bool enabled) { _hardware_waits = enabled; }
+    bool hardwareWaits() const { return _hardware_waits; }
+
+    /* Number of times the CPU blocked on an input of a job */
+    unsigned hostWaits() const { return _host_waits; }
+
+private:
+    struct Engine {
+        std::unique_ptr<Channel> channel;
+        uint32_t syncpt;
+        uint32_t fence;
+        bool busy;
+    };
+
+    struct Job {
+        Engine *engine;
+        std::vector<uint32_t> words;
+        std::vector<JobId> deps;
+        bool submitted;
+        uint32_t fence;
+        /* Submission order, and the first input not seen completing */
+        unsigned order;
+        size_t next_dep;
+    };
+
+    Engine &engine(uint32_t host1x_class);
+    bool signalled(uint32_t syncpt, uint32_t fence);
+    const Job *blockingInput(Job &job);
+    void submit(Job &job, bool hardware_waits, unsigned *num_waits = nullptr);
+    void runHostWaits();
+
+    DrmDevice &_drm;
+    BoCache _cache;
+    std::map<uint32_t, Engine> _engines;
+    std::vector<Job> _jobs;
+    std::map<uint32_t, uint32_t> _syncpt_values;
+    bool _hardware_waits;
+    unsigned _host_waits;
+    unsigned _submissions;
+};
+
+#endif // SCHEDULER_H
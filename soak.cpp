@@ -0,0 +1,451 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "soak.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#include <libdrm/tegra_drm.h>
+
+#include "host1x.h"
+#include "platform.h"
+
+const unsigned Soak::MAX_BATCH;
+const unsigned Soak::MAX_WRITES;
+const unsigned Soak::MAX_RELOCS;
+const unsigned Soak::NUM_TARGETS;
+const unsigned Soak::CMDBUF_WORDS;
+const uint32_t Soak::HANG_WAIT_MS;
+const uint32_t Soak::MAX_WAIT_MS;
+
+Soak::Window::Window()
+: index(0), end_seconds(0), seconds(0), recovery_seconds(0), jobs(0), rejected(0), timeouts(0),
+  failures(0), gem_handles(0), rss_kib(0), syncpoint_drift(0)
+{
+}
+
+std::string Soak::Window::summary() const
+{
+    char buffer[512];
+
+    sprintf(buffer, "soak: window %3u at %6.0f sec: %8.0f jobs/sec, "
+                    "%llu rejected, %llu timeouts, %llu failures, "
+                    "submit p50 %.1f p99 %.1f us, completion p50 %.1f "
+                    "p99 %.1f us, recovery %.0f ms, %ld GEM handles, "
+                    "RSS %ld KiB, syncpoint drift %d\n",
+            index, end_seconds, rate(), (unsigned long long)rejected,
+            (unsigned long long)timeouts, (unsigned long long)failures,
+            submit_latency.percentile(50) / 1000.0,
+            submit_latency.percentile(99) / 1000.0,
+            completion_latency.percentile(50) / 1000.0,
+            completion_latency.percentile(99) / 1000.0,
+            recovery_seconds * 1000, gem_handles, rss_kib, syncpoint_drift);
+
+    return buffer;
+}
+
+Soak::Soak(uint32_t seed)
+: _ch(_drm)
+, _syncpt(_ch.syncpoint(0))
+, _rng(seed)
+, _prologue_words(CMDBUF_WORDS)
+, _failures(0)
+, _submitted()
+, _rejected()
+, _timeouts(0)
+, _num_windows(0)
+{
+    for (unsigned i = 0; i < NUM_TARGETS; i++) {
+        _targets.emplace_back(new GemBuffer(_drm));
+
+        if (_targets.back()->allocate(4096 << random(0, 4)))
+            throw std::runtime_error("Allocation failed");
+    }
+
+    for (unsigned i = 0; i < MAX_BATCH; i++) {
+        _cmdbufs.emplace_back(new GemBuffer(_drm));
+
+        if (_cmdbufs.back()->allocate(CMDBUF_WORDS * 4))
+            throw std::runtime_error("Allocation failed");
+    }
+
+    /* Register writes only, gathered in front of some jobs */
+    _prologue.reset(new GemBuffer(_drm));
+
+    if (_prologue->allocate(_prologue_words * 4))
+        throw std::runtime_error("Allocation failed");
+
+    uint32_t *words = static_cast<uint32_t *>(_prologue->map());
+    if (!words)
+        throw std::runtime_error("Mapping failed");
+
+    for (unsigned i = 0; i < _prologue_words; i += 2) {
+        words[i] = host1x_opcode_nonincr(0x2b, 1);
+        words[i + 1] = i;
+    }
+
+    _fence = read_syncpoint(_drm, _syncpt);
+    _base_handles = GemBuffer::openHandles();
+}
+
+unsigned Soak::random(unsigned min, unsigned max)
+{
+    return std::uniform_int_distribution<unsigned>(min, max)(_rng);
+}
+
+Soak::JobKind Soak::pickKind()
+{
+    /* One job in ten is invalid */
+    if (random(0, 9))
+        return JOB_VALID;
+
+    return JobKind(random(JOB_VALID + 1, NUM_JOB_KINDS - 1));
+}
+
+const char *Soak::kindName(JobKind kind)
+{
+    switch (kind) {
+    case JOB_VALID:
+        return "valid job";
+    case JOB_CMDBUF_PAST_BO:
+        return "command buffer larger than its BO";
+    case JOB_CMDBUF_UNALIGNED:
+        return "command buffer with unaligned offset";
+    case JOB_RELOC_PAST_CMDBUF:
+        return "reloc with offset past the command buffer";
+    case JOB_RELOC_UNALIGNED:
+        return "reloc with unaligned offset";
+    case JOB_RELOC_PAST_TARGET:
+        return "reloc with target offset past the target BO";
+    default:
+        return "unknown job";
+    }
+}
+
+void Soak::build(Submit &submit, JobKind kind)
+{
+    /* Invalid relocs patch a register value, so they need a write */
+    unsigned writes = random(kind == JOB_VALID ? 0 : 1, MAX_WRITES);
+    unsigned relocs = random(0, std::min(writes, MAX_RELOCS));
+
+    if (!random(0, 3))
+        submit.add_gather(*_prologue, 0,
+                          2 * random(1, _prologue_words / 2));
+
+    for (unsigned i = 0; i < writes; i++) {
+        submit.push(host1x_opcode_nonincr(0x2b, 1));
+        submit.push(_rng());
+    }
+    submit.push(host1x_opcode_nonincr(0, 1));
+    submit.push(platform.incrementSyncpointOp(_syncpt));
+
+    submit.add_incr(_syncpt, 1);
+
+    /* Relocations patch the values of the first writes */
+    for (unsigned i = 0; i < relocs; i++) {
+        GemBuffer &target = *_targets[random(0, NUM_TARGETS - 1)];
+
+        submit.add_reloc(i * 8 + 4, target.handle(),
+                         4 * random(0, target.size() / 4 - 1), 0);
+    }
+
+    if (kind == JOB_VALID)
+        return;
+
+    GemBuffer &target = *_targets[random(0, NUM_TARGETS - 1)];
+    uint32_t value_offset = 8 * random(0, writes - 1) + 4;
+
+    switch (kind) {
+    case JOB_VALID:
+    case NUM_JOB_KINDS:
+        break;
+    case JOB_CMDBUF_PAST_BO:
+        submit.quirks.force_cmdbuf_words = CMDBUF_WORDS + random(1, 10000);
+        break;
+    case JOB_CMDBUF_UNALIGNED:
+        submit.quirks.force_cmdbuf_offset = 4 * random(0, 3) + random(1, 3);
+        break;
+    case JOB_RELOC_PAST_CMDBUF:
+        submit.add_reloc(CMDBUF_WORDS * 4 + 4 * random(0, 1023),
+                         target.handle(), 0, 0);
+        break;
+    case JOB_RELOC_UNALIGNED:
+        submit.add_reloc(value_offset + random(1, 3), target.handle(), 0, 0);
+        break;
+    case JOB_RELOC_PAST_TARGET:
+        submit.add_reloc(value_offset, target.handle(),
+                         target.size() + 4 * random(0, 1023), 0);
+        break;
+    }
+}
+
+void Soak::fail(Window &window, const std::string &what)
+{
+    window.failures++;
+    _failures++;
+
+    if (_errors.size() < 10)
+        _errors.push_back("window " + std::to_string(window.index) + ": " +
+                          what);
+}
+
+void Soak::wait(Window &window, uint32_t fence, bool may_time_out)
+{
+    /* Polls first, as a client checking whether a job is done does */
+    if (may_time_out) {
+        try {
+            wait_syncpoint(_drm, _syncpt, fence, 0);
+            return;
+        }
+        catch (ioctl_error e) {
+            if (e.error != EAGAIN && e.error != ETIMEDOUT)
+                fail(window, std::string("Polling a fence failed: ") +
+                             strerror(e.error));
+
+            window.timeouts++;
+            _timeouts++;
+        }
+    }
+
+    try {
+        wait_syncpoint(_drm, _syncpt, fence, MAX_WAIT_MS);
+    }
+    catch (ioctl_error e) {
+        fail(window, std::string("Waiting for a fence failed: ") +
+                     strerror(e.error));
+    }
+}
+
+void Soak::runBatch(Window &window)
+{
+    unsigned count = random(1, MAX_BATCH);
+    uint64_t last_submit = 0;
+    uint64_t jobs = 0;
+
+    for (unsigned i = 0; i < count; i++) {
+        JobKind kind = pickKind();
+        drm_tegra_submit result;
+        Submit submit;
+
+        build(submit, kind);
+        _submitted[kind]++;
+
+        uint64_t begin = monotonic_ns();
+
+        /* Some jobs get a new command buffer BO, to churn GEM handles */
+        try {
+            if (random(0, 3))
+                result = submit.submit(_ch, *_cmdbufs[i]);
+            else
+                result = submit.submit(_ch);
+        }
+        catch (ioctl_error e) {
+            if (kind == JOB_VALID) {
+                fail(window, std::string("Valid job rejected: ") +
+                             e.what() + ": " + strerror(e.error));
+            } else {
+                window.rejected++;
+                _rejected[kind]++;
+            }
+            continue;
+        }
+
+        last_submit = monotonic_ns();
+        _fence = result.fence;
+
+        if (kind != JOB_VALID) {
+            fail(window, std::string("Accepted a ") + kindName(kind));
+            continue;
+        }
+
+        window.submit_latency.record(last_submit - begin);
+        jobs++;
+    }
+
+    if (!last_submit)
+        return;
+
+    wait(window, _fence, !random(0, 3));
+
+    window.completion_latency.record(monotonic_ns() - last_submit);
+    window.jobs += jobs;
+}
+
+void Soak::runHang(Window &window)
+{
+    /* Waits for two increments of which the job makes one */
+    Submit submit;
+    submit.push(host1x_opcode_nonincr(0, 1));
+    submit.push(platform.incrementSyncpointOp(_syncpt));
+
+    submit.add_incr(_syncpt, 2);
+
+    try {
+        _fence = submit.submit(_ch, *_cmdbufs[0]).fence;
+    }
+    catch (ioctl_error e) {
+        fail(window, std::string("Hanging job rejected: ") +
+                     strerror(e.error));
+        return;
+    }
+
+    try {
+        wait_syncpoint(_drm, _syncpt, _fence, HANG_WAIT_MS);
+        fail(window, "Hanging job completed");
+    }
+    catch (ioctl_error e) {
+        window.timeouts++;
+        _timeouts++;
+    }
+
+    /* Until the kernel times the job out and completes its fence */
+    wait(window, _fence, false);
+}
+
+long Soak::residentKib()
+{
+    long size, resident;
+
+    try {
+        if (sscanf(read_file("/proc/self/statm").c_str(), "%ld %ld",
+                   &size, &resident) != 2)
+            return -1;
+    }
+    catch (std::runtime_error) {
+        return -1;
+    }
+
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void Soak::endWindow(Window &window)
+{
+    window.gem_handles = GemBuffer::openHandles();
+    window.rss_kib = residentKib();
+    window.syncpoint_drift = read_syncpoint(_drm, _syncpt) - _fence;
+
+    if (window.syncpoint_drift)
+        fail(window, "Syncpoint drifted by " +
+                     std::to_string(window.syncpoint_drift));
+
+    /* Every BO of the jobs is closed in between batches */
+    if (window.gem_handles != _base_handles)
+        fail(window, std::to_string(window.gem_handles) +
+                     " GEM handles open instead of " +
+                     std::to_string(_base_handles));
+
+    if (!_num_windows++)
+        _first = window;
+    _last = window;
+}
+
+void Soak::run(unsigned seconds, unsigned window_seconds,
+               const WindowCallback &callback)
+{
+    uint64_t start = monotonic_ns();
+    uint64_t end = start + seconds * 1000000000ull;
+    uint64_t now = start;
+
+    while (now < end) {
+        Window window;
+        window.index = _num_windows;
+
+        uint64_t window_start = now;
+        uint64_t window_end = window_start +
+                              window_seconds * 1000000000ull;
+        uint64_t hang_at = window_start +
+                           random(0, window_seconds * 1000) * 1000000ull;
+        bool hung = false;
+
+        while ((now = monotonic_ns()) < window_end) {
+            if (!hung && now >= hang_at) {
+                runHang(window);
+                hung = true;
+
+                /* The window gets its full time of load besides */
+                uint64_t recovery = monotonic_ns() - now;
+                window.recovery_seconds = recovery / 1e9;
+                window_end += recovery;
+            } else {
+                runBatch(window);
+            }
+        }
+
+        now = monotonic_ns();
+        window.seconds = (now - window_start) / 1e9 -
+                         window.recovery_seconds;
+        window.end_seconds = (now - start) / 1e9;
+
+        endWindow(window);
+        callback(window);
+    }
+}
+
+std::string Soak::report() const
+{
+    uint64_t submitted = 0, invalid = 0, rejected = 0;
+    char buffer[512];
+    std::string report;
+
+    for (unsigned i = 0; i < NUM_JOB_KINDS; i++) {
+        submitted += _submitted[i];
+        rejected += _rejected[i];
+        if (i != JOB_VALID)
+            invalid += _submitted[i];
+    }
+
+    sprintf(buffer, "soak: %u windows, %llu jobs of which %llu invalid, "
+                    "%llu rejected, %llu timeouts, %llu failures\n",
+            _num_windows, (unsigned long long)submitted,
+            (unsigned long long)invalid, (unsigned long long)rejected,
+            (unsigned long long)_timeouts, (unsigned long long)_failures);
+    report += buffer;
+
+    if (_num_windows > 1) {
+        double change = _first.rate() ?
+                        (_last.rate() / _first.rate() - 1) * 100 : 0;
+
+        sprintf(buffer, "soak: first vs last window: %.0f vs %.0f jobs/sec "
+                        "(%+.1f%%), submit p99 %.1f vs %.1f us, RSS %ld vs "
+                        "%ld KiB\n",
+                _first.rate(), _last.rate(), change,
+                _first.submit_latency.percentile(99) / 1000.0,
+                _last.submit_latency.percentile(99) / 1000.0,
+                _first.rss_kib, _last.rss_kib);
+        report += buffer;
+    }
+
+    for (const auto &error : _errors)
+        report += "  " + error + "\n";
+
+    if (_failures > _errors.size())
+        report += "  ...\n";
+
+    return report;
+}
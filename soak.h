@@ -0,0 +1,150 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SOAK_H
+#define SOAK_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gem.h"
+#include "stats.h"
+#include "util.h"
+
+/*
+ * Long-running mix of randomized jobs on one channel: valid jobs of
+ * varied size, relocations and gathers, jobs the kernel must reject
+ * (the cases of test_invalid_cmdbuf and test_invalid_reloc, with random
+ * offsets), waits with short timeouts and, once per window, a job that
+ * never completes and has to time out.
+ *
+ * Every window reports throughput and latencies, and what must not
+ * change under sustained load: the GEM handles left open, the resident
+ * set and the syncpoint value against the last fence. The same seed
+ * generates the same jobs.
+ */
+class Soak {
+public:
+    struct Window {
+        Window();
+
+        unsigned index;
+        /* Since the start of the soak */
+        double end_seconds;
+        /* Without the job that timed out and the recovery from it */
+        double seconds;
+        double recovery_seconds;
+
+        uint64_t jobs;
+        uint64_t rejected;
+        uint64_t timeouts;
+        uint64_t failures;
+        /* Submit ioctl of a valid job */
+        LatencyHistogram submit_latency;
+        /* Last submit of a batch until the wait for it returned */
+        LatencyHistogram completion_latency;
+
+        long gem_handles;
+        long rss_kib;
+        /* Syncpoint value minus the fence of the last job */
+        int32_t syncpoint_drift;
+
+        double rate() const { return seconds ? jobs / seconds : 0; }
+        std::string summary() const;
+    };
+
+    typedef std::function<void(const Window &)> WindowCallback;
+
+    Soak(uint32_t seed);
+    Soak(const Soak &) = delete;
+
+    /* Rounded up to whole windows */
+    void run(unsigned seconds, unsigned window_seconds,
+             const WindowCallback &callback);
+
+    uint64_t failures() const { return _failures; }
+
+    /* Totals, unexpected outcomes and drift of the first vs last window */
+    std::string report() const;
+
+    static const unsigned MAX_BATCH = 16;
+    static const unsigned MAX_WRITES = 255;
+    static const unsigned MAX_RELOCS = 16;
+    static const unsigned NUM_TARGETS = 8;
+    static const unsigned CMDBUF_WORDS = 1024;
+    static const uint32_t HANG_WAIT_MS = 100;
+    /* Longer than the job timeout, after which the kernel recovers */
+    static const uint32_t MAX_WAIT_MS = 10000;
+
+private:
+    enum JobKind {
+        JOB_VALID,
+        JOB_CMDBUF_PAST_BO,
+        JOB_CMDBUF_UNALIGNED,
+        JOB_RELOC_PAST_CMDBUF,
+        JOB_RELOC_UNALIGNED,
+        JOB_RELOC_PAST_TARGET,
+        NUM_JOB_KINDS
+    };
+
+    unsigned random(unsigned min, unsigned max);
+    JobKind pickKind();
+    void build(Submit &submit, JobKind kind);
+    void runBatch(Window &window);
+    void runHang(Window &window);
+    void wait(Window &window, uint32_t fence, bool may_time_out);
+    void fail(Window &window, const std::string &what);
+    void endWindow(Window &window);
+
+    static const char *kindName(JobKind kind);
+    static long residentKib();
+
+    DrmDevice _drm;
+    Channel _ch;
+    uint32_t _syncpt;
+    std::mt19937 _rng;
+
+    std::vector<std::unique_ptr<GemBuffer>> _targets;
+    std::vector<std::unique_ptr<GemBuffer>> _cmdbufs;
+    std::unique_ptr<GemBuffer> _prologue;
+    unsigned _prologue_words;
+    long _base_handles;
+
+    uint32_t _fence;
+    uint64_t _failures;
+    std::vector<std::string> _errors;
+    uint64_t _submitted[NUM_JOB_KINDS];
+    uint64_t _rejected[NUM_JOB_KINDS];
+    uint64_t _timeouts;
+
+    /* Only the first and last windows are kept, the soak may run for days */
+    unsigned _num_windows;
+    Window _first;
+    Window _last;
+};
+
+#endif // SOAK_H
@@ -0,0 +1,83 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SOC_H
+#define SOC_H
+
+#include <cstdint>
+
+#include "host1x.h"
+#include "platform.h"
+
+/*
+ * Encodings that differ between SoC generations as compile-time
+ * constants. Command emission instantiated for a generation has them
+ * folded into the emitted words instead of asking the platform.
+ */
+template <unsigned SyncptCondShift, uint32_t DefaultClass,
+          uint32_t SyncptIdMask>
+struct SocTraits {
+    static constexpr uint32_t default_class = DefaultClass;
+    static constexpr uint32_t syncpt_id_mask = SyncptIdMask;
+
+    /* INCR_SYNCPT value incrementing once the engine is done (OP_DONE) */
+    static constexpr uint32_t incrementSyncpointOp(uint32_t syncpoint) {
+        return syncpoint | (1u << SyncptCondShift);
+    }
+};
+
+/* Tegra20, Tegra30 and Tegra114 */
+typedef SocTraits<8, HOST1X_CLASS_GR2D, 0xff> Tegra20Soc;
+/* Tegra124 and Tegra210 */
+typedef SocTraits<8, HOST1X_CLASS_VIC, 0xff> Tegra124Soc;
+typedef SocTraits<10, HOST1X_CLASS_VIC, 0x3ff> Tegra186Soc;
+
+static_assert(Tegra186Soc::incrementSyncpointOp(5) == (5 | 1 << 10),
+              "Syncpoint increment isn't a compile-time constant");
+
+/*
+ * Calls f with the traits of the SoC generation, so that the choice of
+ * instantiation is made once, outside of the code emitting commands:
+ *
+ *   with_soc(platform.soc(), [&](auto soc) {
+ *       emit<decltype(soc)>(words);
+ *   });
+ */
+template <typename F>
+auto with_soc(Platform::Soc soc, F &&f) -> decltype(f(Tegra20Soc()))
+{
+    switch (soc) {
+    case Platform::Tegra20:
+    case Platform::Tegra30:
+    case Platform::Tegra114:
+        return f(Tegra20Soc());
+    case Platform::Tegra124:
+    case Platform::Tegra210:
+        return f(Tegra124Soc());
+    case Platform::Tegra186:
+    default:
+        return f(Tegra186Soc());
+    }
+}
+
+#endif // SOC_H
@@ -0,0 +1,157 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+
+uint64_t monotonic_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t thread_cpu_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+LatencyHistogram::LatencyHistogram()
+: _buckets((64 - SUB_BITS + 1) << SUB_BITS)
+, _count(0)
+, _sum(0)
+, _sum_squares(0)
+, _min(UINT64_MAX)
+, _max(0)
+{
+}
+
+unsigned LatencyHistogram::bucketIndex(uint64_t ns)
+{
+    if (ns < (1u << SUB_BITS))
+        return ns;
+
+    unsigned msb = 63 - __builtin_clzll(ns);
+    unsigned shift = msb - SUB_BITS;
+    unsigned sub = (ns >> shift) & ((1u << SUB_BITS) - 1);
+
+    return ((shift + 1) << SUB_BITS) | sub;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(unsigned index)
+{
+    if (index < (1u << SUB_BITS))
+        return index;
+
+    unsigned shift = (index >> SUB_BITS) - 1;
+    uint64_t sub = index & ((1u << SUB_BITS) - 1);
+    uint64_t lower = ((1ull << SUB_BITS) | sub) << shift;
+
+    return lower + (1ull << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+    _buckets[bucketIndex(ns)]++;
+    _count++;
+    _sum += ns;
+    _sum_squares += double(ns) * ns;
+    _min = std::min(_min, ns);
+    _max = std::max(_max, ns);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for (unsigned i = 0; i < _buckets.size(); i++)
+        _buckets[i] += other._buckets[i];
+
+    _count += other._count;
+    _sum += other._sum;
+    _sum_squares += other._sum_squares;
+    _min = std::min(_min, other._min);
+    _max = std::max(_max, other._max);
+}
+
+void LatencyHistogram::clear()
+{
+    std::fill(_buckets.begin(), _buckets.end(), 0);
+    _count = 0;
+    _sum = 0;
+    _sum_squares = 0;
+    _min = UINT64_MAX;
+    _max = 0;
+}
+
+double LatencyHistogram::stddev() const
+{
+    if (_count < 2)
+        return 0;
+
+    double mean = this->mean();
+    double variance = (_sum_squares - mean * mean * _count) / (_count - 1);
+
+    return variance > 0 ? sqrt(variance) : 0;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    if (!_count)
+        return 0;
+
+    /* Rank of the sample, rounded up so that p100 is the last sample */
+    uint64_t rank = uint64_t(p / 100 * _count + 0.999999);
+    uint64_t seen = 0;
+
+    rank = std::max<uint64_t>(rank, 1);
+
+    for (unsigned i = 0; i < _buckets.size(); i++) {
+        seen += _buckets[i];
+        if (seen >= rank)
+            return std::min(bucketUpperBound(i), _max);
+    }
+
+    return _max;
+}
+
+std::string LatencyHistogram::summary() const
+{
+    char buffer[256];
+
+    snprintf(buffer, sizeof(buffer),
+             "mean %.3f p50 %.3f p90 %.3f p99 %.3f p99.9 %.3f max %.3f us",
+             mean() / 1000, percentile(50) / 1000.0, percentile(90) / 1000.0,
+             percentile(99) / 1000.0, percentile(99.9) / 1000.0,
+             max() / 1000.0);
+
+    return buffer;
+}
@@ -0,0 +1,76 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* CLOCK_MONOTONIC timestamp in nanoseconds */
+uint64_t monotonic_ns();
+
+/* CPU time consumed by the calling thread in nanoseconds */
+uint64_t thread_cpu_ns();
+
+/*
+ * Log-bucketed histogram of nanosecond latencies. Every power of two is
+ * split into 16 linear sub-buckets, so a percentile is reported with at
+ * most 1/16 relative error, whatever the range of the samples.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void record(uint64_t ns);
+    void merge(const LatencyHistogram &other);
+    void clear();
+
+    uint64_t count() const { return _count; }
+    uint64_t min() const { return _count ? _min : 0; }
+    uint64_t max() const { return _max; }
+    double mean() const { return _count ? double(_sum) / _count : 0; }
+    double stddev() const;
+
+    /* Upper bound of the bucket holding the given percentile (0-100) */
+    uint64_t percentile(double p) const;
+
+    /* "mean X p50 X p90 X p99 X p99.9 X max X" in microseconds */
+    std::string summary() const;
+
+private:
+    static const unsigned SUB_BITS = 4;
+
+    static unsigned bucketIndex(uint64_t ns);
+    static uint64_t bucketUpperBound(unsigned index);
+
+    std::vector<uint64_t> _buckets;
+    uint64_t _count;
+    uint64_t _sum;
+    double _sum_squares;
+    uint64_t _min;
+    uint64_t _max;
+};
+
+#endif // STATS_H
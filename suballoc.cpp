@@ -0,0 +1,163 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "suballoc.h"
+
+#include <stdexcept>
+
+#include <libdrm/tegra_drm.h>
+
+#include "util.h"
+
+SubAllocator::SubAllocator(DrmDevice &drm, size_t chunk_bytes,
+                           unsigned max_chunks)
+: _drm(drm)
+, _chunk_bytes(chunk_bytes)
+, _max_chunks(max_chunks)
+, _waits(0)
+, _current(0)
+, _used(0)
+{
+    _chunks.reserve(max_chunks);
+    nextChunk();
+}
+
+bool SubAllocator::idle(Chunk &chunk)
+{
+    for (const auto &fence : chunk.fences) {
+        uint32_t value = read_syncpoint(_drm, fence.first);
+
+        if (int32_t(value - fence.second) < 0)
+            return false;
+    }
+
+    return true;
+}
+
+void SubAllocator::wait(Chunk &chunk)
+{
+    for (const auto &fence : chunk.fences)
+        wait_syncpoint(_drm, fence.first, fence.second, DRM_TEGRA_NO_TIMEOUT);
+}
+
+void SubAllocator::nextChunk()
+{
+    /*
+     * Chunks are filled round-robin, so the next one is the oldest. The
+     * ones allocated from since the last fence() can't be reused yet.
+     */
+    for (unsigned i = 1; i < _chunks.size(); i++) {
+        unsigned index = (_current + i) % _chunks.size();
+
+        if (unfenced(index))
+            continue;
+
+        if (idle(_chunks[index])) {
+            _current = index;
+            _used = 0;
+            _chunks[index].fences.clear();
+            return;
+        }
+    }
+
+    if (_chunks.size() == _max_chunks) {
+        unsigned index = (_current + 1) % _chunks.size();
+
+        if (unfenced(index))
+            throw std::runtime_error("Suballocations of a job exceed all chunks");
+
+        _waits++;
+        wait(_chunks[index]);
+
+        _current = index;
+        _used = 0;
+        _chunks[index].fences.clear();
+        return;
+    }
+
+    Chunk chunk;
+    chunk.bo.reset(new GemBuffer(_drm));
+
+    if (chunk.bo->allocate(_chunk_bytes))
+        throw ioctl_error("GEM allocation failed");
+
+    chunk.ptr = chunk.bo->map();
+    if (!chunk.ptr)
+        throw std::runtime_error("GEM mapping failed");
+
+    _chunks.push_back(std::move(chunk));
+    _current = _chunks.size() - 1;
+    _used = 0;
+}
+
+SubAllocation SubAllocator::allocate(size_t bytes, size_t alignment)
+{
+    if (bytes > _chunk_bytes)
+        throw std::runtime_error("Suballocation larger than a chunk");
+
+    size_t offset = (_used + alignment - 1) & ~(alignment - 1);
+
+    if (offset + bytes > _chunk_bytes) {
+        nextChunk();
+        offset = 0;
+    }
+
+    Chunk &chunk = _chunks[_current];
+    _used = offset + bytes;
+
+    if (!unfenced(_current))
+        _unfenced.push_back(_current);
+
+    return { chunk.bo.get(), uint32_t(offset),
+             static_cast<uint8_t *>(chunk.ptr) + offset };
+}
+
+bool SubAllocator::unfenced(unsigned index) const
+{
+    for (unsigned chunk : _unfenced)
+        if (chunk == index)
+            return true;
+
+    return false;
+}
+
+void SubAllocator::fence(uint32_t syncpt, uint32_t threshold)
+{
+    for (unsigned index : _unfenced) {
+        auto &fences = _chunks[index].fences;
+        bool found = false;
+
+        /* Fences of a syncpoint signal in order, keep only the latest */
+        for (auto &fence : fences) {
+            if (fence.first == syncpt) {
+                fence.second = threshold;
+                found = true;
+            }
+        }
+
+        if (!found)
+            fences.emplace_back(syncpt, threshold);
+    }
+
+    _unfenced.clear();
+}
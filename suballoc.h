@@ -0,0 +1,84 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SUBALLOC_H
+#define SUBALLOC_H
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "gem.h"
+
+/* Range of a larger BO handed out by a SubAllocator */
+struct SubAllocation {
+    GemBuffer *bo;
+    uint32_t offset;
+    void *ptr;
+};
+
+/*
+ * Linear suballocator packing command buffers and small data buffers
+ * into a few large mapped BOs ("chunks"), so that jobs can share GEM
+ * handles and mappings. Allocations are bumped out of the current chunk,
+ * fence() attaches a fence to everything allocated since the previous
+ * call. A full chunk is reused once all its fences have signalled; if
+ * none is idle and max_chunks are in use, the oldest one is waited for.
+ */
+class SubAllocator {
+public:
+    SubAllocator(DrmDevice &drm, size_t chunk_bytes = 1 << 20,
+                 unsigned max_chunks = 8);
+    SubAllocator(const SubAllocator &) = delete;
+
+    SubAllocation allocate(size_t bytes, size_t alignment = 64);
+    void fence(uint32_t syncpt, uint32_t threshold);
+
+    unsigned chunks() const { return _chunks.size(); }
+    unsigned waits() const { return _waits; }
+
+private:
+    struct Chunk {
+        std::unique_ptr<GemBuffer> bo;
+        void *ptr;
+        std::vector<std::pair<uint32_t, uint32_t>> fences;
+    };
+
+    bool idle(Chunk &chunk);
+    bool unfenced(unsigned index) const;
+    void wait(Chunk &chunk);
+    void nextChunk();
+
+    DrmDevice &_drm;
+    size_t _chunk_bytes;
+    unsigned _max_chunks;
+    unsigned _waits;
+
+    std::vector<Chunk> _chunks;
+    std::vector<unsigned> _unfenced;
+    unsigned _current;
+    size_t _used;
+};
+
+#endif // SUBALLOC_H
@@ -0,0 +1,329 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "trace.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libdrm/tegra_drm.h>
+
+#include "stats.h"
+
+const char TRACE_MAGIC[8] = { 'H', '1', 'X', 'T', 'R', 'A', 'C', 'E' };
+
+namespace {
+
+/* State of the call in progress on this thread, between begin and end */
+struct PendingCall {
+    uint64_t start;
+    std::vector<uint8_t> tail;
+};
+
+thread_local PendingCall pending;
+thread_local std::vector<uint8_t> scratch;
+
+void append(std::vector<uint8_t> &buf, const void *data, size_t size)
+{
+    auto bytes = static_cast<const uint8_t *>(data);
+
+    buf.insert(buf.end(), bytes, bytes + size);
+}
+
+template <typename T>
+void append_array(std::vector<uint8_t> &buf, uint64_t ptr, uint32_t count)
+{
+    append(buf, reinterpret_cast<const void *>(uintptr_t(ptr)),
+           count * sizeof(T));
+}
+
+} // anonymous namespace
+
+TraceRecorder::TraceRecorder(const std::string &path)
+: _next_device(0)
+, _records(0)
+{
+    _file = fopen(path.c_str(), "wb");
+    if (!_file)
+        throw std::runtime_error("Failed to create trace " + path);
+
+    setvbuf(_file, nullptr, _IOFBF, 1 << 20);
+
+    TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+
+    fwrite(&header, sizeof(header), 1, _file);
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    fclose(_file);
+}
+
+uint32_t TraceRecorder::openDevice()
+{
+    uint32_t device;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        device = _next_device++;
+        _devices[device];
+    }
+
+    TraceRecord record;
+    memset(&record, 0, sizeof(record));
+    record.request = TRACE_OPEN;
+    record.device = device;
+    record.timestamp = monotonic_ns();
+
+    write(record, nullptr, 0);
+
+    return device;
+}
+
+void TraceRecorder::closeDevice(uint32_t device)
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        _devices.erase(device);
+    }
+
+    TraceRecord record;
+    memset(&record, 0, sizeof(record));
+    record.request = TRACE_CLOSE;
+    record.device = device;
+    record.timestamp = monotonic_ns();
+
+    write(record, nullptr, 0);
+}
+
+/* Returns the mapping of the range of the BO, nullptr if there's none */
+const uint8_t *TraceRecorder::lookup(uint32_t device, uint32_t handle,
+                                     uint64_t offset, uint64_t bytes)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    auto &maps = _devices[device].maps;
+    auto it = maps.find(handle);
+
+    if (it == maps.end() || offset + bytes > it->second.size)
+        return nullptr;
+
+    return it->second.ptr + offset;
+}
+
+void TraceRecorder::beginIoctl(uint32_t device, int request, const void *ptr)
+{
+    pending.tail.clear();
+
+    switch ((unsigned int)request) {
+    case DRM_IOCTL_TEGRA_SUBMIT: {
+        auto args = static_cast<const drm_tegra_submit *>(ptr);
+        auto cmdbufs = reinterpret_cast<const drm_tegra_cmdbuf *>(
+                            uintptr_t(args->cmdbufs));
+
+        append_array<drm_tegra_syncpt>(pending.tail, args->syncpts,
+                                       args->num_syncpts);
+        append_array<drm_tegra_cmdbuf>(pending.tail, args->cmdbufs,
+                                       args->num_cmdbufs);
+        append_array<drm_tegra_reloc>(pending.tail, args->relocs,
+                                      args->num_relocs);
+
+        /* Words as submitted, before the kernel patches relocations */
+        for (uint32_t i = 0; i < args->num_cmdbufs; i++) {
+            auto map = lookup(device, cmdbufs[i].handle, cmdbufs[i].offset,
+                              cmdbufs[i].words * 4ull);
+            uint32_t words = map ? cmdbufs[i].words : 0;
+
+            append(pending.tail, &words, sizeof(words));
+            if (words)
+                append(pending.tail, map, words * 4);
+        }
+        break;
+    }
+#ifdef DRM_IOCTL_TEGRA_CHANNEL_OPEN
+    case DRM_IOCTL_TEGRA_CHANNEL_SUBMIT: {
+        auto args = static_cast<const drm_tegra_channel_submit *>(ptr);
+
+        append_array<drm_tegra_submit_buf>(pending.tail, args->bufs_ptr,
+                                           args->num_bufs);
+        append_array<drm_tegra_submit_cmd>(pending.tail, args->cmds_ptr,
+                                           args->num_cmds);
+        append_array<uint32_t>(pending.tail, args->gather_data_ptr,
+                               args->gather_data_words);
+        break;
+    }
+#endif
+    default:
+        break;
+    }
+
+    pending.start = monotonic_ns();
+}
+
+void TraceRecorder::endIoctl(uint32_t device, int request, const void *ptr,
+                             int ret, int err)
+{
+    uint64_t end = monotonic_ns();
+
+    TraceRecord record;
+    memset(&record, 0, sizeof(record));
+    record.request = request;
+    record.device = device;
+    record.result = ret ? -err : 0;
+    record.timestamp = pending.start;
+    record.duration = end - pending.start;
+
+    scratch.clear();
+    append(scratch, ptr, _IOC_SIZE(request));
+    scratch.insert(scratch.end(), pending.tail.begin(), pending.tail.end());
+
+    if (ret == 0) {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        if ((unsigned int)request == DRM_IOCTL_TEGRA_GEM_MMAP) {
+            auto args = static_cast<const drm_tegra_gem_mmap *>(ptr);
+
+            _devices[device].offset_handles[args->offset] = args->handle;
+        } else if ((unsigned int)request == DRM_IOCTL_GEM_CLOSE) {
+            auto args = static_cast<const drm_gem_close *>(ptr);
+
+            _devices[device].maps.erase(args->handle);
+        }
+    }
+
+    write(record, scratch.data(), scratch.size());
+}
+
+void TraceRecorder::mapped(uint32_t device, uint64_t offset, void *ptr,
+                           size_t size)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    auto &dev = _devices[device];
+    auto it = dev.offset_handles.find(offset);
+
+    if (it != dev.offset_handles.end())
+        dev.maps[it->second] = { static_cast<const uint8_t *>(ptr), size };
+}
+
+void TraceRecorder::unmapped(uint32_t device, void *ptr)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    auto &maps = _devices[device].maps;
+
+    for (auto it = maps.begin(); it != maps.end(); ++it) {
+        if (it->second.ptr == ptr) {
+            maps.erase(it);
+            break;
+        }
+    }
+}
+
+void TraceRecorder::write(const TraceRecord &record, const void *payload,
+                          size_t size)
+{
+    static const uint8_t padding[8] = { };
+    size_t pad = -(sizeof(record) + size) & 7;
+
+    TraceRecord header = record;
+    header.size = sizeof(record) + size + pad;
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    fwrite(&header, sizeof(header), 1, _file);
+    if (size)
+        fwrite(payload, size, 1, _file);
+    if (pad)
+        fwrite(padding, pad, 1, _file);
+
+    _records++;
+}
+
+TraceReader::TraceReader(const std::string &path)
+: _data(nullptr)
+, _size(0)
+, _pos(sizeof(TraceHeader))
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw std::runtime_error("Failed to open trace " + path);
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(TraceHeader)) {
+        void *ptr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr != MAP_FAILED) {
+            _data = static_cast<const uint8_t *>(ptr);
+            _size = st.st_size;
+        }
+    }
+
+    close(fd);
+
+    if (!_data)
+        throw std::runtime_error("Failed to map trace " + path);
+
+    auto header = reinterpret_cast<const TraceHeader *>(_data);
+    if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) ||
+        header->version != TRACE_VERSION) {
+        munmap(const_cast<uint8_t *>(_data), _size);
+        throw std::runtime_error("Unsupported trace format in " + path);
+    }
+}
+
+TraceReader::~TraceReader()
+{
+    munmap(const_cast<uint8_t *>(_data), _size);
+}
+
+const TraceRecord *TraceReader::next()
+{
+    if (_size - _pos < sizeof(TraceRecord))
+        return nullptr;
+
+    auto record = reinterpret_cast<const TraceRecord *>(_data + _pos);
+
+    /* A trace cut short, e.g. by a crash, ends at the last full record */
+    if (record->size < sizeof(TraceRecord) || record->size > _size - _pos)
+        return nullptr;
+
+    _pos += record->size;
+
+    return record;
+}
+
+void TraceReader::rewind()
+{
+    _pos = sizeof(TraceHeader);
+}
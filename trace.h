@@ -0,0 +1,147 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * ioctl trace file: a TraceHeader followed by TraceRecords, each one
+ * followed by its payload. Records are 8-byte aligned and written in the
+ * order the calls completed, so that the file can be memory-mapped and
+ * walked in place.
+ *
+ * The payload is the ioctl argument as returned by the call. Submits are
+ * followed by the arrays they point to, in UAPI order, and by the words
+ * of every command buffer as they were when the job was submitted:
+ *
+ *  - DRM_IOCTL_TEGRA_SUBMIT: syncpts, cmdbufs, relocs, then for each
+ *    cmdbuf a uint32_t word count and words; the count is 0 if the
+ *    range isn't within a mapped BO
+ *  - DRM_IOCTL_TEGRA_CHANNEL_SUBMIT: bufs, cmds, gather data
+ */
+struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct TraceRecord {
+    uint32_t size;          /* Of the record and its payload */
+    uint32_t request;       /* ioctl request, or TRACE_OPEN/TRACE_CLOSE */
+    uint32_t device;        /* DrmDevice index within the trace */
+    int32_t result;         /* 0, or -errno */
+    uint64_t timestamp;     /* CLOCK_MONOTONIC ns at the start of the call */
+    uint64_t duration;      /* ns spent in the call */
+};
+
+/* Pseudo requests, real ioctl requests always encode a size */
+enum {
+    TRACE_OPEN = 0,
+    TRACE_CLOSE = 1,
+};
+
+extern const char TRACE_MAGIC[8];
+const uint32_t TRACE_VERSION = 1;
+
+/*
+ * Records the calls made through every DrmDevice created while it is
+ * installed with DrmDevice::setTraceRecorder(). Command buffer words are
+ * read from the mappings of the process, so the BOs a job executes must
+ * be mapped through the same DrmDevice.
+ */
+class TraceRecorder {
+public:
+    /* Throws std::runtime_error if the file can't be created */
+    TraceRecorder(const std::string &path);
+    TraceRecorder(const TraceRecorder &) = delete;
+    ~TraceRecorder();
+
+    uint32_t openDevice();
+    void closeDevice(uint32_t device);
+
+    /* Called around the ioctl, with its return value and errno */
+    void beginIoctl(uint32_t device, int request, const void *ptr);
+    void endIoctl(uint32_t device, int request, const void *ptr, int ret,
+                  int err);
+
+    void mapped(uint32_t device, uint64_t offset, void *ptr, size_t size);
+    void unmapped(uint32_t device, void *ptr);
+
+    uint64_t records() const { return _records; }
+
+private:
+    struct Mapping {
+        const uint8_t *ptr;
+        size_t size;
+    };
+
+    struct Device {
+        std::unordered_map<uint64_t, uint32_t> offset_handles;
+        std::unordered_map<uint32_t, Mapping> maps;
+    };
+
+    void write(const TraceRecord &record, const void *payload, size_t size);
+    const uint8_t *lookup(uint32_t device, uint32_t handle, uint64_t offset,
+                          uint64_t bytes);
+
+    std::mutex _lock;
+    FILE *_file;
+    uint32_t _next_device;
+    uint64_t _records;
+    std::unordered_map<uint32_t, Device> _devices;
+};
+
+/* Read-only memory mapping of a trace file */
+class TraceReader {
+public:
+    /* Throws std::runtime_error if the file isn't a valid trace */
+    TraceReader(const std::string &path);
+    TraceReader(const TraceReader &) = delete;
+    ~TraceReader();
+
+    /* Returns nullptr at the end of the trace */
+    const TraceRecord *next();
+    void rewind();
+
+    static const void *payload(const TraceRecord *record) {
+        return record + 1;
+    }
+    static size_t payloadSize(const TraceRecord *record) {
+        return record->size - sizeof(*record);
+    }
+
+private:
+    const uint8_t *_data;
+    size_t _size;
+    size_t _pos;
+};
+
+#endif // TRACE_H
@@ -23,24 +23,33 @@
 
 #include "util.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
 #include <fstream>
 #include <sstream>
 
+#include "bo_cache.h"
 #include "host1x.h"
 #include "platform.h"
-
-extern Platform platform;
+#include "stats.h"
+#include "suballoc.h"
+#include "validator.h"
 
 ioctl_error::ioctl_error(const char *message) : std::runtime_error(message) {
     error = errno;
 }
 
-Channel::Channel(DrmDevice &drm) : _drm(drm) {
+const uint32_t Channel::NO_SYNCPT;
+
+Channel::Channel(DrmDevice &drm) : Channel(drm, platform.defaultClass()) {
+}
+
+Channel::Channel(DrmDevice &drm, uint32_t host1x_class)
+    : _class(host1x_class), _drm(drm) {
     drm_tegra_open_channel open_channel_args;
     memset(&open_channel_args, 0, sizeof(open_channel_args));
-    open_channel_args.client = platform.defaultClass();
+    open_channel_args.client = host1x_class;
 
     int err = drm.ioctl(DRM_IOCTL_TEGRA_OPEN_CHANNEL, &open_channel_args);
     if (err)
@@ -58,6 +67,18 @@ Channel::~Channel() {
 }
 
 uint32_t Channel::syncpoint(uint32_t index) {
+    std::lock_guard<std::mutex> lock(_syncpts_lock);
+
+    if (index >= _syncpts.size())
+        _syncpts.resize(index + 1, NO_SYNCPT);
+
+    if (_syncpts[index] == NO_SYNCPT)
+        _syncpts[index] = query_syncpoint(index);
+
+    return _syncpts[index];
+}
+
+uint32_t Channel::query_syncpoint(uint32_t index) {
     drm_tegra_get_syncpt get_syncpt_args;
     memset(&get_syncpt_args, 0, sizeof(get_syncpt_args));
     get_syncpt_args.context = _context;
@@ -73,6 +94,15 @@ uint32_t Channel::syncpoint(uint32_t index) {
 Submit::Submit() : _flags(0) {
 }
 
+void Submit::reset() {
+    _cmdbuf.clear();
+    _incrs.clear();
+    _relocs.clear();
+    _gathers.clear();
+    _gather_bos.clear();
+    _flags = 0;
+}
+
 void Submit::set_flags(uint32_t flags) {
     _flags = flags;
 }
@@ -81,6 +111,21 @@ void Submit::push(uint32_t cmd) {
     _cmdbuf.push_back(cmd);
 }
 
+void Submit::push(const uint32_t *cmds, size_t count) {
+    _cmdbuf.insert(_cmdbuf.end(), cmds, cmds + count);
+}
+
+void Submit::add_gather(GemBuffer &bo, uint32_t offset, uint32_t words) {
+    drm_tegra_cmdbuf gather;
+    gather.handle = bo.handle();
+    gather.offset = offset;
+    gather.words = words;
+    gather.pad = 0;
+
+    _gathers.push_back(gather);
+    _gather_bos.push_back(&bo);
+}
+
 void Submit::add_incr(uint32_t syncpt, int count) {
     drm_tegra_syncpt spt;
     spt.id = syncpt;
@@ -103,6 +148,40 @@ void Submit::add_reloc(uint32_t cmdbuf_offset, uint32_t target,
     _relocs.push_back(reloc);
 }
 
+static drm_tegra_submit submit_job(Channel &ch, const drm_tegra_cmdbuf *cmdbufs,
+                                   uint32_t num_cmdbufs,
+                                   const drm_tegra_syncpt *incrs,
+                                   uint32_t num_incrs,
+                                   const drm_tegra_reloc *relocs,
+                                   uint32_t num_relocs)
+{
+    drm_tegra_submit submit_desc;
+    memset(&submit_desc, 0, sizeof(submit_desc));
+    submit_desc.context = ch._context;
+    submit_desc.num_syncpts = num_incrs;
+    submit_desc.num_cmdbufs = num_cmdbufs;
+    submit_desc.num_relocs = num_relocs;
+    submit_desc.syncpts = (uintptr_t)incrs;
+    submit_desc.cmdbufs = (uintptr_t)cmdbufs;
+    submit_desc.relocs = (uintptr_t)relocs;
+    submit_desc.timeout = 2000;
+
+    int err = ch._drm.ioctl(DRM_IOCTL_TEGRA_SUBMIT, &submit_desc);
+    if (err)
+        throw ioctl_error("Submit failed");
+
+    return submit_desc;
+}
+
+static drm_tegra_submit submit_job(Channel &ch, const drm_tegra_cmdbuf *cmdbufs,
+                                   uint32_t num_cmdbufs,
+                                   std::vector<drm_tegra_syncpt> &incrs,
+                                   std::vector<drm_tegra_reloc> &relocs)
+{
+    return submit_job(ch, cmdbufs, num_cmdbufs, incrs.data(), incrs.size(),
+                      relocs.data(), relocs.size());
+}
+
 drm_tegra_submit Submit::submit(Channel &ch, GemBuffer &cmdbuf_bo) {
     for (auto &reloc : _relocs)
         reloc.cmdbuf.handle = cmdbuf_bo.handle();
@@ -118,22 +197,28 @@ drm_tegra_submit Submit::submit(Channel &ch, GemBuffer &cmdbuf_bo) {
     cmdbuf_desc.offset = quirks.force_cmdbuf_offset ?: 0;
     cmdbuf_desc.words = quirks.force_cmdbuf_words ?: _cmdbuf.size();
 
-    drm_tegra_submit submit_desc;
-    memset(&submit_desc, 0, sizeof(submit_desc));
-    submit_desc.context = ch._context;
-    submit_desc.num_syncpts = _incrs.size();
-    submit_desc.num_cmdbufs = 1;
-    submit_desc.num_relocs = _relocs.size();
-    submit_desc.syncpts = (uintptr_t)&_incrs[0];
-    submit_desc.cmdbufs = (uintptr_t)&cmdbuf_desc;
-    submit_desc.relocs = (uintptr_t)&_relocs[0];
-    submit_desc.timeout = 2000;
-
-    int err = ch._drm.ioctl(DRM_IOCTL_TEGRA_SUBMIT, &submit_desc);
-    if (err)
-        throw ioctl_error("Submit failed");
+    return submit_gathers(ch, cmdbuf_desc);
+}
 
-    return submit_desc;
+drm_tegra_submit Submit::submit_gathers(Channel &ch,
+                                        const drm_tegra_cmdbuf &cmdbuf_desc) {
+    if (_gathers.empty())
+        return submit_job(ch, &cmdbuf_desc, 1, _incrs, _relocs);
+
+    /* The job's own stream executes after the referenced gathers */
+    _gathers.push_back(cmdbuf_desc);
+
+    try {
+        auto result = submit_job(ch, &_gathers[0], _gathers.size(),
+                                 _incrs, _relocs);
+        _gathers.pop_back();
+
+        return result;
+    }
+    catch (...) {
+        _gathers.pop_back();
+        throw;
+    }
 }
 
 drm_tegra_submit Submit::submit(Channel &ch) {
@@ -145,7 +230,255 @@ drm_tegra_submit Submit::submit(Channel &ch) {
     return submit(ch, cmdbuf_bo);
 }
 
-void wait_syncpoint(DrmDevice &drm, uint32_t id, uint32_t threshold, uint32_t timeout) {
+drm_tegra_submit Submit::submit(Channel &ch, BoCache &cache) {
+    /* Without a fence, the cache couldn't tell when the BO is idle */
+    if (_incrs.empty())
+        throw std::runtime_error("Job without syncpoint increments");
+
+    auto cmdbuf_bo = cache.get(_cmdbuf.size() * sizeof(uint32_t));
+    auto result = submit(ch, *cmdbuf_bo);
+
+    cache.put(std::move(cmdbuf_bo), _incrs[0].id, result.fence);
+
+    return result;
+}
+
+const char *Submit::validate(CmdbufValidator &validator) const {
+    if (quirks.force_cmdbuf_offset % 4)
+        return "Unaligned command buffer offset";
+
+    if (quirks.force_cmdbuf_words > _cmdbuf.size())
+        return "Command buffer words exceed the stream";
+
+    if (_gathers.empty())
+        return validator.validate(_cmdbuf.data(), _cmdbuf.size(),
+                                  _incrs.data(), _incrs.size(),
+                                  _relocs.data(), _relocs.size());
+
+    std::vector<CmdbufValidator::Gather> gathers;
+
+    for (size_t i = 0; i < _gathers.size(); i++) {
+        const drm_tegra_cmdbuf &gather = _gathers[i];
+        auto ptr = static_cast<const uint32_t *>(_gather_bos[i]->map());
+
+        if (gather.offset % 4)
+            return "Unaligned gather offset";
+        if (!ptr || gather.offset + gather.words * 4ull > _gather_bos[i]->size())
+            return "Gather outside of its BO";
+
+        gathers.push_back({ ptr + gather.offset / 4, gather.words });
+    }
+
+    gathers.push_back({ _cmdbuf.data(), _cmdbuf.size() });
+
+    return validator.validate(gathers.data(), gathers.size(),
+                              _incrs.data(), _incrs.size(),
+                              _relocs.data(), _relocs.size());
+}
+
+PreparedSubmit::PreparedSubmit(Channel &ch, const Submit &submit,
+                               GemBuffer &cmdbuf_bo)
+: _ch(ch), _num_words(submit._cmdbuf.size()),
+  _incrs(submit._incrs), _relocs(submit._relocs)
+{
+    if (_num_words * sizeof(uint32_t) > cmdbuf_bo.size())
+        throw std::runtime_error("Job doesn't fit into cmdbuf BO");
+
+    _words = static_cast<uint32_t *>(cmdbuf_bo.map());
+    if (!_words)
+        throw std::runtime_error("Cmdbuf GEM mapping failed");
+
+    memcpy(_words, &submit._cmdbuf[0], _num_words * sizeof(uint32_t));
+
+    for (auto &reloc : _relocs)
+        reloc.cmdbuf.handle = cmdbuf_bo.handle();
+
+    /* The job's own stream executes after the referenced gathers */
+    drm_tegra_cmdbuf cmdbuf_desc;
+    cmdbuf_desc.handle = cmdbuf_bo.handle();
+    cmdbuf_desc.offset = submit.quirks.force_cmdbuf_offset ?: 0;
+    cmdbuf_desc.words = submit.quirks.force_cmdbuf_words ?: _num_words;
+    cmdbuf_desc.pad = 0;
+
+    _cmdbufs = submit._gathers;
+    _cmdbufs.push_back(cmdbuf_desc);
+
+    memset(&_submit_desc, 0, sizeof(_submit_desc));
+    _submit_desc.context = ch._context;
+    _submit_desc.num_syncpts = _incrs.size();
+    _submit_desc.num_cmdbufs = _cmdbufs.size();
+    _submit_desc.num_relocs = _relocs.size();
+    _submit_desc.syncpts = (uintptr_t)&_incrs[0];
+    _submit_desc.cmdbufs = (uintptr_t)&_cmdbufs[0];
+    _submit_desc.relocs = (uintptr_t)&_relocs[0];
+    _submit_desc.timeout = 2000;
+}
+
+drm_tegra_submit PreparedSubmit::submit() {
+    /* Only the fence is written back by the kernel */
+    int err = _ch._drm.ioctl(DRM_IOCTL_TEGRA_SUBMIT, &_submit_desc);
+    if (err)
+        throw ioctl_error("Submit failed");
+
+    return _submit_desc;
+}
+
+DirectSubmit::DirectSubmit(DrmDevice &drm, size_t bytes)
+: _drm(drm), _bo(new GemBuffer(drm)), _spills(0)
+{
+    if (_bo->allocate(bytes))
+        throw ioctl_error("Cmdbuf GEM allocation failed");
+
+    _begin = static_cast<uint32_t *>(_bo->map());
+    if (!_begin)
+        throw std::runtime_error("Cmdbuf GEM mapping failed");
+
+    _cur = _begin;
+    _end = _begin + bytes / sizeof(uint32_t);
+}
+
+void DirectSubmit::reset() {
+    _cur = _begin;
+    _incrs.clear();
+    _relocs.clear();
+}
+
+void DirectSubmit::spill() {
+    size_t words = _cur - _begin;
+    size_t bytes = _bo->size() * 2;
+    std::unique_ptr<GemBuffer> bo(new GemBuffer(_drm));
+
+    if (bo->allocate(bytes))
+        throw ioctl_error("Cmdbuf GEM allocation failed");
+
+    uint32_t *ptr = static_cast<uint32_t *>(bo->map());
+    if (!ptr)
+        throw std::runtime_error("Cmdbuf GEM mapping failed");
+
+    memcpy(ptr, _begin, words * sizeof(uint32_t));
+
+    _bo = std::move(bo);
+    _begin = ptr;
+    _cur = ptr + words;
+    _end = ptr + bytes / sizeof(uint32_t);
+    _spills++;
+}
+
+void DirectSubmit::push(const uint32_t *cmds, size_t count) {
+    while (size_t(_end - _cur) < count)
+        spill();
+
+    memcpy(_cur, cmds, count * sizeof(uint32_t));
+    _cur += count;
+}
+
+void DirectSubmit::add_incr(uint32_t syncpt, int count) {
+    drm_tegra_syncpt spt;
+    spt.id = syncpt;
+    spt.incrs = count;
+
+    _incrs.push_back(spt);
+}
+
+void DirectSubmit::add_reloc(uint32_t cmdbuf_offset, uint32_t target,
+                             uint32_t target_offset, uint32_t shift)
+{
+    drm_tegra_reloc reloc;
+    memset(&reloc, 0, sizeof(reloc));
+    reloc.cmdbuf.offset = cmdbuf_offset;
+    reloc.target.handle = target;
+    reloc.target.offset = target_offset;
+    reloc.shift = shift;
+
+    _relocs.push_back(reloc);
+}
+
+drm_tegra_submit DirectSubmit::submit(Channel &ch) {
+    for (auto &reloc : _relocs)
+        reloc.cmdbuf.handle = _bo->handle();
+
+    drm_tegra_cmdbuf cmdbuf_desc;
+    cmdbuf_desc.handle = _bo->handle();
+    cmdbuf_desc.offset = 0;
+    cmdbuf_desc.words = words();
+
+    return submit_job(ch, &cmdbuf_desc, 1, _incrs, _relocs);
+}
+
+ArenaSubmit::ArenaSubmit(uint32_t *words, size_t max_words,
+                         drm_tegra_reloc *relocs, size_t max_relocs)
+: _words(words)
+, _max_words(max_words)
+, _num_words(0)
+, _relocs(relocs)
+, _max_relocs(max_relocs)
+, _num_relocs(0)
+, _num_incrs(0)
+{
+}
+
+void ArenaSubmit::overflow() {
+    throw std::runtime_error("Submit arena exhausted");
+}
+
+void ArenaSubmit::reset() {
+    _num_words = 0;
+    _num_relocs = 0;
+    _num_incrs = 0;
+}
+
+void ArenaSubmit::push(const uint32_t *cmds, size_t count) {
+    if (_max_words - _num_words < count)
+        overflow();
+
+    memcpy(_words + _num_words, cmds, count * sizeof(uint32_t));
+    _num_words += count;
+}
+
+void ArenaSubmit::add_incr(uint32_t syncpt, int count) {
+    if (_num_incrs == MAX_INCRS)
+        overflow();
+
+    _incrs[_num_incrs].id = syncpt;
+    _incrs[_num_incrs].incrs = count;
+    _num_incrs++;
+}
+
+void ArenaSubmit::add_reloc(uint32_t cmdbuf_offset, uint32_t target,
+                            uint32_t target_offset, uint32_t shift)
+{
+    if (_num_relocs == _max_relocs)
+        overflow();
+
+    drm_tegra_reloc &reloc = _relocs[_num_relocs++];
+    memset(&reloc, 0, sizeof(reloc));
+    reloc.cmdbuf.offset = cmdbuf_offset;
+    reloc.target.handle = target;
+    reloc.target.offset = target_offset;
+    reloc.shift = shift;
+}
+
+drm_tegra_submit ArenaSubmit::submit(Channel &ch, GemBuffer &cmdbuf_bo) {
+    for (size_t i = 0; i < _num_relocs; i++)
+        _relocs[i].cmdbuf.handle = cmdbuf_bo.handle();
+
+    void *cmdbuf_ptr = cmdbuf_bo.map();
+    if (!cmdbuf_ptr)
+        throw std::runtime_error("Cmdbuf GEM mapping failed");
+
+    memcpy(cmdbuf_ptr, _words, _num_words * sizeof(uint32_t));
+
+    drm_tegra_cmdbuf cmdbuf_desc;
+    cmdbuf_desc.handle = cmdbuf_bo.handle();
+    cmdbuf_desc.offset = 0;
+    cmdbuf_desc.words = _num_words;
+    cmdbuf_desc.pad = 0;
+
+    return submit_job(ch, &cmdbuf_desc, 1, _incrs, _num_incrs,
+                      _relocs, _num_relocs);
+}
+
+uint32_t wait_syncpoint(DrmDevice &drm, uint32_t id, uint32_t threshold, uint32_t timeout) {
     drm_tegra_syncpt_wait syncpt_wait_args;
     memset(&syncpt_wait_args, 0, sizeof(syncpt_wait_args));
     syncpt_wait_args.id = id;
@@ -155,6 +488,102 @@ void wait_syncpoint(DrmDevice &drm, uint32_t id, uint32_t threshold, uint32_t ti
     int err = drm.ioctl(DRM_IOCTL_TEGRA_SYNCPT_WAIT, &syncpt_wait_args);
     if (err)
         throw ioctl_error("Syncpoint wait failed");
+
+    return syncpt_wait_args.value;
+}
+
+drm_tegra_submit Submit::submit(Channel &ch, SubAllocator &allocator) {
+    /* Without a fence, the range could never be reused */
+    if (_incrs.empty())
+        throw std::runtime_error("Job without syncpoint increments");
+
+    auto range = allocator.allocate(_cmdbuf.size() * sizeof(uint32_t));
+
+    memcpy(range.ptr, &_cmdbuf[0], _cmdbuf.size() * sizeof(uint32_t));
+
+    /* Reloc offsets are relative to the start of the cmdbuf BO */
+    for (auto &reloc : _relocs) {
+        reloc.cmdbuf.handle = range.bo->handle();
+        reloc.cmdbuf.offset += range.offset;
+    }
+
+    drm_tegra_cmdbuf cmdbuf_desc;
+    cmdbuf_desc.handle = range.bo->handle();
+    cmdbuf_desc.offset = range.offset;
+    cmdbuf_desc.words = _cmdbuf.size();
+
+    drm_tegra_submit result;
+
+    try {
+        result = submit_gathers(ch, cmdbuf_desc);
+    }
+    catch (...) {
+        for (auto &reloc : _relocs)
+            reloc.cmdbuf.offset -= range.offset;
+        throw;
+    }
+
+    for (auto &reloc : _relocs)
+        reloc.cmdbuf.offset -= range.offset;
+
+    allocator.fence(_incrs[0].id, result.fence);
+
+    return result;
+}
+
+uint32_t read_syncpoint(DrmDevice &drm, uint32_t id) {
+    drm_tegra_syncpt_read syncpt_read_args;
+    memset(&syncpt_read_args, 0, sizeof(syncpt_read_args));
+    syncpt_read_args.id = id;
+
+    int err = drm.ioctl(DRM_IOCTL_TEGRA_SYNCPT_READ, &syncpt_read_args);
+    if (err)
+        throw ioctl_error("Syncpoint read failed");
+
+    return syncpt_read_args.value;
+}
+
+void increment_syncpoint(DrmDevice &drm, uint32_t id) {
+    drm_tegra_syncpt_incr syncpt_incr_args;
+    memset(&syncpt_incr_args, 0, sizeof(syncpt_incr_args));
+    syncpt_incr_args.id = id;
+
+    int err = drm.ioctl(DRM_IOCTL_TEGRA_SYNCPT_INCR, &syncpt_incr_args);
+    if (err)
+        throw ioctl_error("Syncpoint increment failed");
+}
+
+uint32_t wait_syncpoint(DrmDevice &drm, uint32_t id, uint32_t threshold,
+                        uint32_t timeout, WaitStrategy strategy,
+                        uint64_t spin_ns) {
+    if (strategy == WAIT_BLOCK)
+        return wait_syncpoint(drm, id, threshold, timeout);
+
+    uint64_t timeout_ns = timeout == DRM_TEGRA_NO_TIMEOUT ? UINT64_MAX :
+                          timeout * 1000000ull;
+    uint64_t budget = strategy == WAIT_SPIN ? timeout_ns :
+                      std::min(spin_ns, timeout_ns);
+    uint64_t begin = monotonic_ns();
+    uint64_t elapsed;
+
+    do {
+        uint32_t value = read_syncpoint(drm, id);
+
+        if (int32_t(value - threshold) >= 0)
+            return value;
+
+        elapsed = monotonic_ns() - begin;
+    } while (elapsed < budget);
+
+    if (strategy == WAIT_SPIN || elapsed >= timeout_ns) {
+        errno = EAGAIN;
+        throw ioctl_error("Syncpoint wait failed");
+    }
+
+    if (timeout != DRM_TEGRA_NO_TIMEOUT)
+        timeout -= elapsed / 1000000;
+
+    return wait_syncpoint(drm, id, threshold, timeout);
 }
 
 SubmitQuirks::SubmitQuirks()
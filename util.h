@@ -25,11 +25,17 @@
 #define UTIL_H
 
 #include "gem.h"
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <vector>
 
 #include <libdrm/tegra_drm.h>
 
+class BoCache;
+class CmdbufValidator;
+class SubAllocator;
+
 class ioctl_error : public std::runtime_error {
 public:
     ioctl_error(const char *message);
@@ -40,11 +46,23 @@ public:
 class Channel {
 public:
     Channel(DrmDevice &drm);
+    Channel(DrmDevice &drm, uint32_t host1x_class);
     ~Channel();
+
+    /* Syncpoint IDs are fixed for the lifetime of a channel, so cached */
     uint32_t syncpoint(uint32_t index);
+    /* Always asks the kernel with GET_SYNCPT */
+    uint32_t query_syncpoint(uint32_t index);
 
     uint64_t _context;
+    uint32_t _class;
     DrmDevice &_drm;
+
+private:
+    static const uint32_t NO_SYNCPT = ~0u;
+
+    std::mutex _syncpts_lock;
+    std::vector<uint32_t> _syncpts;
 };
 
 struct SubmitQuirks {
@@ -59,24 +77,197 @@ private:
     std::vector<uint32_t> _cmdbuf;
     std::vector<drm_tegra_syncpt> _incrs;
     std::vector<drm_tegra_reloc> _relocs;
+    std::vector<drm_tegra_cmdbuf> _gathers;
+    std::vector<GemBuffer *> _gather_bos;
     uint32_t _flags;
 
+    drm_tegra_submit submit_gathers(Channel &ch,
+                                    const drm_tegra_cmdbuf &cmdbuf_desc);
+
 public:
     Submit();
 
+    /* Empties the job for reuse, keeping the capacity of its vectors */
+    void reset();
     void set_flags(uint32_t flags);
     void push(uint32_t cmd);
+    void push(const uint32_t *cmds, size_t count);
+
+    /*
+     * References words of another BO, e.g. a shared prologue or another
+     * job, instead of copying them. Gathers execute in the order they
+     * were added, followed by the words pushed to this Submit. Relocs
+     * only apply to the pushed words.
+     */
+    void add_gather(GemBuffer &bo, uint32_t offset, uint32_t words);
     void add_incr(uint32_t syncpt, int count);
     void add_reloc(uint32_t cmdbuf_offset, uint32_t target,
                    uint32_t target_offset, uint32_t shift);
 
     drm_tegra_submit submit(Channel &ch, GemBuffer &cmdbuf_bo);
     drm_tegra_submit submit(Channel &ch);
+    drm_tegra_submit submit(Channel &ch, BoCache &cache);
+    drm_tegra_submit submit(Channel &ch, SubAllocator &allocator);
+
+    size_t words() const { return _cmdbuf.size(); }
+
+    /*
+     * Returns nullptr if the job passes, the reason otherwise. Gathers
+     * and the pushed words are decoded one after another, each on its
+     * own, like the kernel does.
+     */
+    const char *validate(CmdbufValidator &validator) const;
 
     SubmitQuirks quirks;
+
+    friend class PreparedSubmit;
 };
 
-void wait_syncpoint(DrmDevice &drm, uint32_t id, uint32_t threshold, uint32_t timeout);
+/*
+ * Job frozen for repeated submission: the command stream is copied into
+ * its BO, and the relocations and ioctl descriptors are set up once.
+ * Replays only rewrite the words patched in between, directly in the BO
+ * mapping, so the previous replay must have completed before patching.
+ * Gathers of the job are replayed as well, their BOs must stay alive.
+ */
+class PreparedSubmit {
+private:
+    Channel &_ch;
+    uint32_t *_words;
+    size_t _num_words;
+    std::vector<drm_tegra_syncpt> _incrs;
+    std::vector<drm_tegra_reloc> _relocs;
+    std::vector<drm_tegra_cmdbuf> _cmdbufs;
+    drm_tegra_submit _submit_desc;
+
+public:
+    PreparedSubmit(Channel &ch, const Submit &submit, GemBuffer &cmdbuf_bo);
+    PreparedSubmit(const PreparedSubmit &) = delete;
+
+    void patch(size_t index, uint32_t value) { _words[index] = value; }
+
+    drm_tegra_submit submit();
+};
+
+/*
+ * Job builder that emits commands straight into the mapping of its
+ * command buffer BO, saving the staging vector and the copy done by
+ * Submit. When the job outgrows the BO, it is moved to a newly allocated
+ * BO of twice the size. The BO is reused by the next job after reset(),
+ * so the caller must make sure the previous job has completed first.
+ */
+class DirectSubmit {
+private:
+    DrmDevice &_drm;
+    std::unique_ptr<GemBuffer> _bo;
+    uint32_t *_begin;
+    uint32_t *_cur;
+    uint32_t *_end;
+    std::vector<drm_tegra_syncpt> _incrs;
+    std::vector<drm_tegra_reloc> _relocs;
+    unsigned _spills;
+
+    void spill();
+
+public:
+    DirectSubmit(DrmDevice &drm, size_t bytes = 4096);
+
+    void reset();
+    void push(uint32_t cmd) {
+        if (_cur == _end)
+            spill();
+
+        *_cur++ = cmd;
+    }
+    void push(const uint32_t *cmds, size_t count);
+    void add_incr(uint32_t syncpt, int count);
+    void add_reloc(uint32_t cmdbuf_offset, uint32_t target,
+                   uint32_t target_offset, uint32_t shift);
+
+    drm_tegra_submit submit(Channel &ch);
+
+    size_t words() const { return _cur - _begin; }
+    size_t capacity() const { return _end - _begin; }
+    unsigned spills() const { return _spills; }
+};
+
+/*
+ * Job builder keeping its command stream and relocations in storage
+ * provided by the caller, e.g. an arena reused by every job, so that
+ * building and submitting a job never touches the heap. Overflowing the
+ * storage throws std::runtime_error. InlineSubmit carries its storage.
+ */
+class ArenaSubmit {
+public:
+    ArenaSubmit(uint32_t *words, size_t max_words,
+                drm_tegra_reloc *relocs, size_t max_relocs);
+    ArenaSubmit(const ArenaSubmit &) = delete;
+
+    void reset();
+    void push(uint32_t cmd) {
+        if (_num_words == _max_words)
+            overflow();
+
+        _words[_num_words++] = cmd;
+    }
+    void push(const uint32_t *cmds, size_t count);
+    void add_incr(uint32_t syncpt, int count);
+    void add_reloc(uint32_t cmdbuf_offset, uint32_t target,
+                   uint32_t target_offset, uint32_t shift);
+
+    drm_tegra_submit submit(Channel &ch, GemBuffer &cmdbuf_bo);
+
+    size_t words() const { return _num_words; }
+
+private:
+    static const unsigned MAX_INCRS = 4;
+
+    [[noreturn]] static void overflow();
+
+    uint32_t *_words;
+    size_t _max_words;
+    size_t _num_words;
+    drm_tegra_reloc *_relocs;
+    size_t _max_relocs;
+    size_t _num_relocs;
+    drm_tegra_syncpt _incrs[MAX_INCRS];
+    unsigned _num_incrs;
+};
+
+template <size_t Words, size_t Relocs = 16>
+class InlineSubmit : public ArenaSubmit {
+public:
+    InlineSubmit() : ArenaSubmit(_word_storage, Words,
+                                 _reloc_storage, Relocs) { }
+
+private:
+    uint32_t _word_storage[Words];
+    drm_tegra_reloc _reloc_storage[Relocs];
+};
+
+uint32_t wait_syncpoint(DrmDevice &drm, uint32_t id, uint32_t threshold, uint32_t timeout);
+
+enum WaitStrategy {
+    /* Sleep in SYNCPT_WAIT until the interrupt */
+    WAIT_BLOCK,
+    /* Poll the value with SYNCPT_READ */
+    WAIT_SPIN,
+    /* Poll for a budget, then sleep */
+    WAIT_HYBRID,
+};
+
+/*
+ * wait_syncpoint() with a selectable strategy, spin_ns being the polling
+ * budget of WAIT_HYBRID. Polling honours the timeout too and fails with
+ * EAGAIN like SYNCPT_WAIT does.
+ */
+uint32_t wait_syncpoint(DrmDevice &drm, uint32_t id, uint32_t threshold,
+                        uint32_t timeout, WaitStrategy strategy,
+                        uint64_t spin_ns = 0);
+
+uint32_t read_syncpoint(DrmDevice &drm, uint32_t id);
+
+void increment_syncpoint(DrmDevice &drm, uint32_t id);
 
 std::string read_file(const std::string& path);
 
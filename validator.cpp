@@ -0,0 +1,120 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "validator.h"
+
+#include "host1x.h"
+#include "platform.h"
+
+struct ValidationVisitor {
+    CmdbufValidator &validator;
+    bool track_opcodes;
+    uint32_t syncpt;
+    uint32_t syncpt_incrs;
+
+    void opcode(size_t index) {
+        if (track_opcodes)
+            validator._is_opcode[index] = 1;
+    }
+
+    const char *setClass(uint32_t class_id) {
+        if (!validator._classes.count(class_id))
+            return "Class not allowed on this channel";
+
+        return nullptr;
+    }
+
+    const char *write(uint32_t reg, uint32_t value, size_t) {
+        if (reg == 0) {
+            if ((value & validator._syncpt_id_mask) != syncpt)
+                return "Increment of a syncpoint not owned by the job";
+
+            syncpt_incrs++;
+        }
+
+        return nullptr;
+    }
+};
+
+CmdbufValidator::CmdbufValidator()
+{
+    _classes.insert(HOST1X_CLASS_HOST1X);
+    _classes.insert(platform.defaultClass());
+
+    _syncpt_id_mask = platform.syncpointIdMask();
+}
+
+const char *CmdbufValidator::validate(const Gather *gathers,
+                                      size_t num_gathers,
+                                      const drm_tegra_syncpt *incrs,
+                                      size_t num_incrs,
+                                      const drm_tegra_reloc *relocs,
+                                      size_t num_relocs)
+{
+    if (num_incrs != 1)
+        return "Job must increment exactly one syncpoint";
+    if (num_gathers == 0)
+        return "Job without gathers";
+
+    ValidationVisitor visitor = { *this, false, incrs[0].id, 0 };
+    size_t count = gathers[num_gathers - 1].count;
+
+    for (size_t i = 0; i < num_gathers; i++) {
+        const Gather &gather = gathers[i];
+
+        /* Only the last gather is patched by relocations */
+        visitor.track_opcodes = num_relocs != 0 && i == num_gathers - 1;
+        if (visitor.track_opcodes)
+            _is_opcode.assign(gather.count, 0);
+
+        const char *err = host1x_decode(gather.words, gather.count, visitor);
+        if (err)
+            return err;
+    }
+
+    if (visitor.syncpt_incrs != incrs[0].incrs)
+        return "Syncpoint increments don't match the job's fence";
+
+    for (size_t i = 0; i < num_relocs; i++) {
+        const drm_tegra_reloc &reloc = relocs[i];
+
+        if (reloc.cmdbuf.offset % 4)
+            return "Unaligned relocation offset";
+
+        size_t index = reloc.cmdbuf.offset / 4;
+        if (index >= count)
+            return "Relocation outside of command stream";
+        if (_is_opcode[index])
+            return "Relocation patches an opcode";
+
+        auto target = _bo_sizes.find(reloc.target.handle);
+        if (target == _bo_sizes.end())
+            return "Relocation target is unknown";
+        if (reloc.target.offset >= target->second)
+            return "Relocation target offset outside of target BO";
+        if (reloc.shift > 31)
+            return "Relocation shift too large";
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,162 @@
+/* kate: replace-tabs true; indent-width 4
+ *
+ * Copyright (c) 2017, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VALIDATOR_H
+#define VALIDATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <libdrm/tegra_drm.h>
+
+#include "gem.h"
+
+/*
+ * Decodes a host1x command stream the way the command DMA does. The
+ * visitor gets setClass(class_id) for class switches and
+ * write(reg, value, index) for every register write, where index is the
+ * position of the data word in the stream; both return nullptr or a
+ * reason to reject the stream. Only the opcodes accepted by the kernel
+ * firewall are allowed. Returns nullptr or the reason for rejection.
+ */
+template <typename Visitor>
+const char *host1x_decode(const uint32_t *words, size_t count,
+                          Visitor &visitor)
+{
+    const char *err;
+    size_t i = 0;
+
+    while (i < count) {
+        size_t opcode_index = i;
+        uint32_t op = words[i++];
+        uint32_t offset = (op >> 16) & 0xfff;
+        uint32_t mask, n, k;
+
+        visitor.opcode(opcode_index);
+
+        switch (op >> 28) {
+        case 0: /* SETCLASS */
+            err = visitor.setClass((op >> 6) & 0x3ff);
+            if (err)
+                return err;
+
+            mask = op & 0x3f;
+            for (k = 0; k < 6; k++) {
+                if (!(mask & (1 << k)))
+                    continue;
+                if (i >= count)
+                    return "Stream ends inside SETCLASS data";
+                err = visitor.write(offset + k, words[i], i);
+                if (err)
+                    return err;
+                i++;
+            }
+            break;
+        case 1: /* INCR */
+        case 2: /* NONINCR */
+            n = op & 0xffff;
+            if (n > count - i)
+                return "Stream ends inside INCR/NONINCR data";
+
+            for (k = 0; k < n; k++, i++) {
+                uint32_t reg = (op >> 28) == 1 ? offset + k : offset;
+
+                err = visitor.write(reg, words[i], i);
+                if (err)
+                    return err;
+            }
+            break;
+        case 3: /* MASK */
+            mask = op & 0xffff;
+            for (k = 0; k < 16; k++) {
+                if (!(mask & (1 << k)))
+                    continue;
+                if (i >= count)
+                    return "Stream ends inside MASK data";
+                err = visitor.write(offset + k, words[i], i);
+                if (err)
+                    return err;
+                i++;
+            }
+            break;
+        case 4: /* IMM */
+            err = visitor.write(offset, op & 0xffff, opcode_index);
+            if (err)
+                return err;
+            break;
+        default:
+            return "Opcode not allowed";
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+ * Userspace equivalent of the checks the kernel does on a job: opcodes,
+ * class switches, data word counts, syncpoint increments, and relocation
+ * offsets against the stream and the target BO sizes. Targets have to
+ * be registered with addBuffer() first.
+ *
+ * Like the kernel, each gather is decoded on its own, so an opcode's data
+ * can't run into the next gather. Relocations patch the last gather, the
+ * one Submit builds.
+ */
+class CmdbufValidator {
+public:
+    struct Gather {
+        const uint32_t *words;
+        size_t count;
+    };
+
+    CmdbufValidator();
+
+    void allowClass(uint32_t class_id) { _classes.insert(class_id); }
+    void addBuffer(const GemBuffer &bo) { _bo_sizes[bo.handle()] = bo.size(); }
+    void removeBuffer(const GemBuffer &bo) { _bo_sizes.erase(bo.handle()); }
+
+    const char *validate(const Gather *gathers, size_t num_gathers,
+                         const drm_tegra_syncpt *incrs, size_t num_incrs,
+                         const drm_tegra_reloc *relocs, size_t num_relocs);
+
+    const char *validate(const uint32_t *words, size_t count,
+                         const drm_tegra_syncpt *incrs, size_t num_incrs,
+                         const drm_tegra_reloc *relocs, size_t num_relocs) {
+        Gather gather = { words, count };
+
+        return validate(&gather, 1, incrs, num_incrs, relocs, num_relocs);
+    }
+
+private:
+    friend struct ValidationVisitor;
+
+    std::unordered_set<uint32_t> _classes;
+    std::unordered_map<gem_handle, size_t> _bo_sizes;
+    std::vector<uint8_t> _is_opcode;
+    uint32_t _syncpt_id_mask;
+};
+
+#endif // VALIDATOR_H